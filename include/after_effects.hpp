@@ -16,6 +16,7 @@ private:
   unsigned int texture_loc;
   unsigned int texture_vao;
   unsigned int*textures;
+  unsigned int newest;
   int width;
   int height;
 public:
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "simulation.hpp"
+#include <string>
+
+/*
+
+The scene of the animation (terraining_testing_2): the size of the
+terrain, the grid of spheres and the timeline of the plane. The
+renderer and the physics regression harness both build it from
+here, so that a golden trajectory stays the one of the animation.
+
+ */
+
+// Terrain
+#define TERRAIN_SIZE 8.0f
+#define TERRAIN_FRAMES 360
+
+// Physics
+#define SECONDS_PER_FRAME (1.f / 60.f)
+#define SPHERE_RADIUS 0.04f
+#define X_N_SPHERES 80
+#define Z_N_SPHERES 80
+#define SPHERES_DROP_HEIGHT 1.f
+#define SPHERES_APPEARANCE_FRAME 560
+#define SPHERES_RELEASE_FRAME 760
+#define SPHERES_TIME_STEP 0.015f
+// Seed of the terrain and the appearance of the spheres, all segments
+// of a render must use the same one
+#define SCENE_SEED 1
+
+// First Round of Tilts
+#define PLANE_TILT_ANGULAR_VELOCITY 0.6f, 0.f, 0.f
+#define PLANE_TILT_START_FRAME 920
+#define PLANE_TILT_INTERVAL 64
+#define PLANE_TILT_END_FRAME (920 + 8 * 64)
+
+// Second Round of Tilts
+#define PLANE_TILT_VERTICALLY_ANGULAR_VELOCITY 0.4f, -0.4f, 0.0f
+#define PLANE_TILT_VERTICALLY_START_FRAME (PLANE_TILT_END_FRAME + 2 * PLANE_TILT_INTERVAL)
+#define PLANE_TILT_VERTICALLY_END_FRAME 9999
+
+// Drop
+#define PLANE_DROP_START_FRAME PLANE_TILT_VERTICALLY_START_FRAME
+#define PLANE_DROP_INITIAL_VELOCITY 0.f, -0.001f, 0.f
+#define PLANE_DROP_FACTOR 1.05f
+
+// The settings of the scene with a terrain resolution and textures
+simulation_settings animation_settings(int terrain_resolution, const std::string & stone,
+	const std::string & grass, const std::string & snow);
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <future>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "common.hpp"
+#include "mesh.hpp"
+#include "shader.hpp"
+#include "texture_cache.hpp"
+
+/*
+
+Loads the assets of the scene on worker threads while the context
+thread does other work (e.g. generating the terrain heights).
+
+Textures are decoded (or their cache files mapped), meshes are
+imported through assimp and shader sources are read on the workers.
+Everything that needs the OpenGL context happens in the getters
+(texture(), mesh(), program()), which the context thread calls once
+it needs an asset: they wait for the worker and then upload. An
+asset that was not requested before is loaded by the getter itself.
+
+ */
+class asset_loader
+{
+	// The worker threads
+	std::vector<std::thread> workers;
+	// Protects the job queue
+	std::mutex mutex;
+	// Signals the workers that a job or the shutdown is pending
+	std::condition_variable wake;
+	// Jobs that have not been started yet
+	std::deque<std::function<void()>> jobs;
+	// Set when the loader is destroyed
+	bool stopping;
+
+	// Pending and finished assets, by file name
+	std::map<std::string, std::shared_future<std::shared_ptr<texture_cache>>> pending_textures;
+	std::map<std::string, unsigned int> textures;
+	std::map<std::string, std::shared_future<std::vector<geometry>>> pending_meshes;
+	std::map<std::string, std::shared_future<std::string>> shader_sources;
+
+	// Main loop of the worker threads
+	void worker_loop();
+	// Queue a job and get the future of its result
+	template <typename T>
+	std::shared_future<T> post(const std::function<T()> & job)
+	{
+		std::shared_ptr<std::packaged_task<T()>> task = std::make_shared<std::packaged_task<T()>>(job);
+		std::shared_future<T> result = task->get_future().share();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back([task]() { (*task)(); });
+		}
+		wake.notify_one();
+		return result;
+	}
+
+public:
+	// Start the given number of workers (0 = number of hardware
+	// threads minus the context thread)
+	asset_loader(int threads = 0);
+	// Finish the started jobs and join the workers
+	~asset_loader();
+
+	asset_loader(const asset_loader &) = delete;
+	asset_loader & operator=(const asset_loader &) = delete;
+
+	// Start loading a texture (see texture_cache), a mesh from the
+	// models folder or a shader source from SHADER_ROOT
+	void request_texture(const std::string & image_path);
+	void request_mesh(const std::string & filename, bool smooth);
+	void request_shader(const std::string & filename);
+
+	// Get the GL texture of an image, uploaded on the first call
+	unsigned int texture(const std::string & image_path);
+	// Get the first mesh of a scene with its buffers created
+	geometry mesh(const std::string & filename, bool smooth);
+	// Get the source code of a shader
+	std::string shader_source(const std::string & filename);
+	// Compile and link a program from two shader sources
+	unsigned int program(const std::string & vertex_filename, const std::string & fragment_filename);
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstddef>
+#include "memory_tracker.hpp"
+
+/*
+
+This class hands frames from the render thread over to writer
+threads. The frames live in a bounded ring of preallocated buffers:
+the render thread acquires a free buffer, fills it and submits it,
+a writer thread passes it to the write function and returns it to
+the free buffers. If all buffers are in flight, acquire() blocks
+(backpressure) and the time spent waiting is reported as stall time.
+
+With a single writer thread the frames are written in the order in
+which they were submitted.
+
+ */
+class async_frame_writer
+{
+public:
+	// Called on a writer thread for each submitted frame
+	typedef std::function<void(const unsigned char * data, size_t size, int frame_index)> write_function;
+
+	// Backpressure statistics
+	struct statistics
+	{
+		// Number of frames passed to the write function
+		int frames_written;
+		// Largest number of frames waiting to be written
+		int max_queue_depth;
+		// Average number of frames waiting at submission
+		double average_queue_depth;
+		// Number of acquire() calls that had to wait
+		int stalls;
+		// Total time spent waiting in acquire()
+		double stall_seconds;
+	};
+
+private:
+	// A submitted frame
+	struct queued_frame
+	{
+		unsigned char * buffer;
+		int frame_index;
+	};
+
+	// Size of each frame buffer in bytes
+	size_t frame_size;
+	// Memory of all frame buffers
+	tracked_vector<unsigned char, memory_capture> storage;
+	// Buffers that can be acquired
+	std::vector<unsigned char *> free_buffers;
+	// Ring of submitted frames
+	std::vector<queued_frame> queue;
+	int queue_head = 0;
+	int queue_count = 0;
+	// Number of frames currently in the write function
+	int writing = 0;
+	// The write function and its threads
+	write_function write;
+	std::vector<std::thread> threads;
+	bool stopping = false;
+
+	std::mutex mutex;
+	// Signals that a buffer has been returned
+	std::condition_variable buffer_freed;
+	// Signals that a frame has been submitted (or shutdown)
+	std::condition_variable frame_queued;
+	// Signals that a frame has been written
+	std::condition_variable frame_written;
+
+	statistics stats;
+	// Sum of the queue depths at submission for the average
+	double queue_depth_sum = 0.0;
+	int submissions = 0;
+
+	// Main loop of the writer threads
+	void writer_loop();
+
+public:
+	// Create buffer_count buffers of frame_size bytes and thread_count
+	// writer threads that call write for each frame
+	async_frame_writer(size_t frame_size, int buffer_count, int thread_count, write_function write);
+	// Write all pending frames and stop the writer threads
+	~async_frame_writer();
+
+	async_frame_writer(const async_frame_writer &) = delete;
+	async_frame_writer & operator=(const async_frame_writer &) = delete;
+
+	// Get a free buffer, blocks while all buffers are in flight
+	unsigned char * acquire();
+	// Queue a filled buffer for writing
+	void submit(unsigned char * buffer, int frame_index);
+	// Return an acquired buffer without writing it
+	void release(unsigned char * buffer);
+	// Wait until all submitted frames have been written
+	void flush();
+
+	// Get the size of each frame buffer in bytes
+	size_t get_frame_size() const;
+	// Get the backpressure statistics
+	statistics get_statistics();
+	// Print the backpressure statistics
+	void print_statistics(const char * name);
+};
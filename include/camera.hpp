@@ -19,4 +19,11 @@ struct camera {
 	void set_theta(float);
 	void set_distance(float);
 	void rotate(float angle = 0.002);
+
+	// Get and restore the raw orbit of the camera (angles in
+	// radians), e.g. for simulation snapshots
+	float get_phi() const;
+	float get_theta() const;
+	float get_distance() const;
+	void set_orbit(float phi, float theta, float distance);
 };
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "simulation.hpp"
+#include <map>
+#include <cstddef>
+
+/*
+
+This class keeps snapshots of the simulation in memory every few
+frames, so that any frame can be reached by restoring the nearest
+earlier checkpoint and simulating only the remaining frames.
+
+The checkpoints are limited by a memory budget: when it is exceeded
+the interval is doubled and every other checkpoint is dropped, so
+the whole timeline stays covered at a coarser resolution.
+
+ */
+class checkpoint_store
+{
+	// Frames between two checkpoints (grows when thinning out)
+	int interval;
+	// Maximum memory used by the checkpoints in bytes
+	size_t memory_budget;
+	// Memory currently used by the checkpoints in bytes
+	size_t memory;
+	// The checkpoints by frame
+	std::map<int, simulation_snapshot> checkpoints;
+
+	// Memory used by a checkpoint in bytes
+	static size_t size_of(const simulation_snapshot & snapshot);
+	// Double the interval and drop the checkpoints in between
+	void thin_out();
+
+public:
+	// Create a store with a checkpoint every interval frames
+	checkpoint_store(int interval, size_t memory_budget);
+
+	// Record a checkpoint if the next frame of the simulation is due
+	// and not recorded yet
+	void record(simulation & sim, const camera & cam);
+	// Get the latest checkpoint at or before frame, nullptr if none
+	const simulation_snapshot * nearest(int frame) const;
+	// Continue the simulation at frame: restore the nearest checkpoint
+	// (unless the simulation is already closer) and simulate the
+	// remaining frames, returns the number of simulated frames or -1
+	int seek(simulation & sim, camera & cam, int frame);
+	// Drop all checkpoints, e.g. after the settings changed
+	void clear();
+
+	// Get the current interval between checkpoints
+	int get_interval() const;
+	// Get the number of checkpoints
+	int get_count() const;
+	// Get the memory used by the checkpoints in bytes
+	size_t get_memory() const;
+};
@@ -19,3 +19,8 @@
 
 GLFWwindow*
 initOpenGL(int width, int height, const char* title);
+
+// Create an invisible window with a context for tools that only
+// compute, returns nullptr if there is no display
+GLFWwindow*
+initOpenGLHidden(const char* title);
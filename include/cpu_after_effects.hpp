@@ -0,0 +1,95 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "thread_pool.hpp"
+
+// Effect that is applied on the CPU to frames captured for the video,
+// i.e. after glReadPixels and before encoding. Frames are RGBA8 with
+// the rows in OpenGL order (bottom row first), the depth buffer is
+// only read back if an effect needs it.
+class FrameEffect
+{
+public:
+  virtual ~FrameEffect() {}
+  // Whether apply() needs the depth buffer
+  virtual bool needs_depth() const { return false; }
+  // Process one frame in place, depth is nullptr unless needs_depth()
+  virtual void apply(unsigned char *rgba, const float *depth) = 0;
+};
+
+// Temporal motion blur over the last blur_size frames. The frames are
+// kept in a fixed ring buffer together with a running sum, so each
+// frame costs one add and one subtract per channel regardless of
+// blur_size (at most 256 frames).
+class CpuMotionBlur : public FrameEffect
+{
+private:
+  unsigned int blur_size;
+  int width;
+  int height;
+  // Ring buffer of the last blur_size input frames
+  std::vector<unsigned char> frames;
+  // Per channel sum of all frames in the ring buffer
+  std::vector<uint16_t> sum;
+  // Slot of the oldest frame, i.e. the one to be replaced next
+  unsigned int next_slot;
+  // Number of valid frames in the ring buffer
+  unsigned int filled;
+  thread_pool *pool;
+public:
+  CpuMotionBlur(int width, int height, unsigned int blur_size,
+                thread_pool *pool = &thread_pool::shared());
+  // Forget all previous frames
+  void reset();
+  void apply(unsigned char *rgba, const float *depth);
+};
+
+// Depth of field with the same circle of confusion and Poisson disk as
+// depth_blur.frag. The frame is split into tiles that are classified
+// by the minimum and maximum circle of confusion of their pixels:
+// tiles that are in focus are skipped, tiles that are blurred
+// throughout gather from a half resolution copy of the frame at half
+// resolution and the rest gathers at full resolution.
+class CpuDepthBlur : public FrameEffect
+{
+private:
+  int width;
+  int height;
+  float near_v;
+  float far_v;
+  float blur_v;
+  float focus_v;
+  thread_pool *pool;
+  // Unmodified copy of the current frame
+  std::vector<unsigned char> source;
+  // Half resolution copy of the current frame
+  std::vector<unsigned char> half;
+  // Blur radius of each pixel in uv units
+  std::vector<float> coc;
+  // Classification of each tile
+  std::vector<unsigned char> tile_class;
+  int tiles_x;
+  int tiles_y;
+  // Number of tiles per class in the last frame
+  int skipped_tiles;
+  int full_tiles;
+  int reduced_tiles;
+
+  void classify_tiles(int tile_begin, int tile_end, const float *depth);
+  void downsample_rows(int row_begin, int row_end);
+  void gather_full(int tile, unsigned char *rgba);
+  void gather_reduced(int tile, unsigned char *rgba);
+public:
+  CpuDepthBlur(int width, int height, float near, float far, float blur, float focus,
+               thread_pool *pool = &thread_pool::shared());
+  void blur(float blur);
+  void focus(float focus);
+  bool needs_depth() const { return true; }
+  void apply(unsigned char *rgba, const float *depth);
+  // Tile statistics of the last frame
+  int get_skipped_tiles() const;
+  int get_full_tiles() const;
+  int get_reduced_tiles() const;
+};
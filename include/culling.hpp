@@ -0,0 +1,84 @@
+#pragma once
+
+#include "common.hpp"
+#include <vector>
+
+/*
+
+This class holds the six planes of a view frustum, extracted from a
+combined projection and view matrix, and tests bounding volumes
+against them
+
+ */
+class frustum
+{
+	// The planes (a,b,c,d) with normalized normals pointing inwards,
+	// in the order left, right, bottom, top, near, far
+	glm::vec4 planes[6];
+
+public:
+	// Create a frustum that contains everything
+	frustum();
+	// Create the frustum of proj_matrix * view_matrix
+	frustum(glm::mat4 view_proj);
+
+	// Extract the planes of proj_matrix * view_matrix
+	void set(glm::mat4 view_proj);
+	// Get one of the six planes
+	const glm::vec4 & get_plane(int index) const;
+
+	// Check whether a sphere is at least partially inside
+	bool contains_sphere(glm::vec3 center, float radius) const;
+	// Check whether an axis aligned box is at least partially inside
+	bool contains_box(glm::vec3 box_min, glm::vec3 box_max) const;
+	// Check whether an axis aligned box transformed by model_mat is at
+	// least partially inside
+	bool contains_box(glm::vec3 box_min, glm::vec3 box_max, const glm::mat4 & model_mat) const;
+};
+
+/*
+
+This class culls bounding spheres against a frustum. The spheres are
+stored as structure of arrays and tested four at a time with SSE,
+the result is the list of the indices of the visible spheres
+
+ */
+class sphere_culler
+{
+	// Sphere centers and radii (padded to a multiple of four)
+	std::vector<float> xs;
+	std::vector<float> ys;
+	std::vector<float> zs;
+	std::vector<float> radii;
+	// User supplied index of each sphere
+	std::vector<int> indices;
+	// Number of spheres added since the last clear()
+	int count = 0;
+	// Indices of the spheres that passed the last cull()
+	std::vector<int> visible;
+	// Number of visible spheres of the last cull()
+	int visible_count = 0;
+	// Number of culled spheres of the last cull()
+	int culled_count = 0;
+
+	// Make sure that n spheres plus padding fit without reallocating
+	void grow(int n);
+
+public:
+	// Create a new instance of sphere_culler
+	sphere_culler(int capacity = 0);
+
+	// Remove all spheres
+	void clear();
+	// Add a sphere, index is reported back if the sphere is visible
+	void add(glm::vec3 center, float radius, int index);
+	// Test all spheres against the frustum
+	void cull(const frustum & f);
+
+	// Indices of the visible spheres of the last cull()
+	const int * get_visible() const;
+	// Number of visible spheres of the last cull()
+	int get_visible_count() const;
+	// Number of culled spheres of the last cull()
+	int get_culled_count() const;
+};
@@ -1,8 +1,16 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include "config.hpp"
 #include "common.hpp"
+#include "cpu_after_effects.hpp"
+#include "async_frame_writer.hpp"
+#include "yuv_convert.hpp"
+#include "shm_frame_ring.hpp"
+#include "image_sequence.hpp"
+#include "image_scale.hpp"
+#include "memory_tracker.hpp"
 
 /*
 
@@ -15,6 +23,44 @@ video
  */
 class ffmpeg_wrapper
 {
+public:
+	// Format of the frames sent to ffmpeg
+	enum output_format
+	{
+		// Raw bottom-up RGBA, ffmpeg converts and flips
+		output_rgba,
+		// YUV 4:2:0 (BT.709) converted and flipped here, sent as Y4M
+		output_y4m,
+		// Raw bottom-up RGBA in a shared memory ring instead of a pipe,
+		// read by an external consumer (see shm_frame_consumer), the
+		// filename is the name of the shared memory object
+		output_shm,
+		// Numbered PNG, QOI or raw RGBA files instead of a video, encoded
+		// on all cores; the filename is a printf pattern for the frame
+		// index (e.g. "frames/frame_%05d.png") or a prefix
+		output_png,
+		output_qoi,
+		output_raw_images
+	};
+
+private:
+	// Additional output at another size, fed from the frames of the
+	// main output
+	struct scaled_output
+	{
+		// Size of the output
+		int width;
+		int height;
+		// Scales the frames, with the filter of the output
+		image_scaler * scaler;
+		// Pipe to ffmpeg, nullptr for image sequences
+		FILE * pipe;
+		// Writer thread(s) of the output
+		async_frame_writer * writer;
+		// Converted frame of the writer thread in Y4M mode
+		tracked_vector<unsigned char, memory_capture> yuv_frame;
+	};
+
     // Rendered video width
 	int width;
 	// Rendered video height
@@ -25,15 +71,110 @@ class ffmpeg_wrapper
 	int frame_counter;
 	// Handle for the video file to be created
 	FILE * ffmpeg;
+	// Ring of frame buffers drained into the ffmpeg pipe by a writer
+	// thread, so that encoding and rendering overlap
+	async_frame_writer * writer;
+	// Format of the frames sent to ffmpeg
+	output_format format;
+	// Converted frame of the writer thread in Y4M mode
+	tracked_vector<unsigned char, memory_capture> yuv_frame;
+	// Shared memory ring of output_shm, replaces ffmpeg and the writer
+	shm_frame_ring * ring;
+	// Effects applied to each captured frame before encoding
+	std::vector<FrameEffect *> effects;
+	// Depth buffer of the current frame (only read for effects)
+	tracked_vector<float, memory_capture> depth;
+	// Frame buffer of pre-roll frames, which are not saved
+	tracked_vector<unsigned char, memory_capture> preroll;
+	// Additional outputs at other sizes
+	std::vector<scaled_output *> scaled_outputs;
+
+	// Thumbnail strip: size of a thumbnail, frames between two
+	// thumbnails (0 = no strip), columns, the file name, the strip
+	// (top-down), the last scaled thumbnail and its scaler
+	int thumbnail_width;
+	int thumbnail_height;
+	int thumbnail_interval;
+	int thumbnail_columns;
+	std::string thumbnail_filename;
+	tracked_vector<unsigned char, memory_capture> thumbnail_strip;
+	tracked_vector<unsigned char, memory_capture> thumbnail;
+	image_scaler * thumbnail_scaler;
+	int thumbnail_count;
+
+	// Pixel buffer objects for asynchronous readback, empty for
+	// synchronous glReadPixels
+	std::vector<unsigned int> color_pbos;
+	std::vector<unsigned int> depth_pbos;
+	// Fence of the readback pending in each PBO
+	std::vector<GLsync> fences;
+	// Frame index pending in each PBO, -1 if the PBO is unused
+	std::vector<int> pending_frames;
+	// PBO used for the next frame
+	int next_pbo;
+
+	// Drop the shared memory ring and discard the frames from now on
+	void discard_frames(int buffer_count);
+	// Whether any effect needs the depth buffer
+	bool effects_need_depth();
+	// Get the buffer for the next frame, waits if the consumer falls behind
+	unsigned char * acquire_buffer();
+	// Apply the effects and hand the frame to the writer thread
+	void submit_frame(unsigned char * buffer, const float * depth_data, int index);
+	// Wait for the readback in a PBO and submit its frame
+	void finish_pbo(int pbo);
+	// Scale a frame into the additional outputs and the thumbnail strip
+	void submit_scaled(const unsigned char * buffer, int index);
+
+	// Start ffmpeg (pipe is set) or an image sequence writer for an
+	// output of the given size, yuv_frame is the conversion buffer
+	// of output_y4m
+	static async_frame_writer * open_output(int width, int height, const char * filename, output_format format,
+		int buffer_count, FILE ** pipe, tracked_vector<unsigned char, memory_capture> * yuv_frame);
+	// Close a pipe to ffmpeg
+	static void close_pipe(FILE * pipe);
 
 public:
     // Create a new ffmpeg_wrapper instance
-	ffmpeg_wrapper(int width, int height, int frames, char * render_filename);
-	// Clear up
+	ffmpeg_wrapper(int width, int height, int frames, char * render_filename, int buffer_count = 4,
+		output_format format = output_rgba);
+	// Clear up, waits until all frames have been written
 	~ffmpeg_wrapper();
 
+	ffmpeg_wrapper(const ffmpeg_wrapper &) = delete;
+	ffmpeg_wrapper & operator=(const ffmpeg_wrapper &) = delete;
+
+    // Add an effect that is applied to each frame before encoding
+	void add_effect(FrameEffect * effect);
+    // Encode every frame a second time at another size (e.g. a 720p
+    // preview next to the 1080p master), scaled once on the render
+    // thread and written by the output's own writer thread; returns
+    // false for output_shm, which only supports the main output
+	bool add_output(int width, int height, char * filename, output_format format,
+		scale_filter filter = scale_bilinear, int buffer_count = 4);
+    // Collect a thumbnail of every interval-th frame into a contact
+    // sheet with the given number of columns, written as PNG when the
+    // wrapper is destroyed
+	void add_thumbnail_strip(int width, int height, int interval, int columns, char * filename);
+    // Read frames back through pbo_count pixel buffer objects: frame
+    // N is read asynchronously while frame N - (pbo_count - 1) is
+    // mapped, 0 switches back to synchronous glReadPixels; call it
+    // after add_effect so depth is read back for effects needing it
+	void set_readback_pbos(int pbo_count);
     // Save a frame, e.g. send it to FFMPEG
 	void save_frame();
+    // Pass a frame through the effects without saving it, so that
+    // e.g. motion blur has its history at the first saved frame
+	void preroll_frame();
+    // Submit the frames still pending in PBOs, must be called while
+    // the OpenGL context is alive
+	void finish();
 	// Retrieve whether the rendering has finished
 	bool is_finished();
+	// Retrieve the backpressure statistics of the writer thread
+	async_frame_writer::statistics get_statistics();
+
+	// Join videos that were rendered with the same settings (e.g.
+	// segments of one render) without re-encoding them
+	static bool concat_segments(const std::vector<std::string> & segments, const std::string & output);
 };
\ No newline at end of file
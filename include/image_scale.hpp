@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "thread_pool.hpp"
+
+/*
+
+Resampling of RGBA images (8 bits per channel) to another size, e.g.
+to encode preview videos or thumbnails from the rendered frames.
+
+The image is filtered separably, first horizontally and then
+vertically. The filter weights of each output pixel are computed
+once per pair of sizes in 2.14 fixed point and are stretched by the
+scale factor when shrinking, so that every source pixel contributes
+(box = area average, bilinear = triangle, Lanczos = 3 lobes).
+
+An image_scaler keeps the weights and the intermediate rows of one
+pair of sizes, so that scaling every frame of a video does not
+allocate; scale_rgba() is the same for a single image.
+
+ */
+
+// Resampling filters
+enum scale_filter
+{
+	// Average of the covered source pixels, fastest
+	scale_box,
+	// Triangle filter, smooth but slightly blurry
+	scale_bilinear,
+	// Lanczos with 3 lobes, sharpest, slowest
+	scale_lanczos
+};
+
+// The filter weights of all output pixels along one axis, every
+// output pixel has the same (even) number of taps starting at
+// start[i], unused taps have a weight of 0
+struct scale_weights
+{
+	int taps;
+	std::vector<int> start;
+	std::vector<int16_t> weights;
+};
+
+/*
+
+Scales RGBA images of one size to another size, reusing its weights
+and buffers for every image
+
+ */
+class image_scaler
+{
+	int src_width;
+	int src_height;
+	int dst_width;
+	int dst_height;
+	// Weights of the horizontal and the vertical pass
+	scale_weights horizontal;
+	scale_weights vertical;
+	// The source rows after the horizontal pass
+	std::vector<unsigned char> rows;
+
+public:
+	// Prepare scaling src_width x src_height to dst_width x dst_height
+	image_scaler(int src_width, int src_height, int dst_width, int dst_height, scale_filter filter);
+
+	// Scale an image, the row order is kept
+	void scale(const unsigned char * src, unsigned char * dst, thread_pool * pool = &thread_pool::shared());
+};
+
+// Scale an RGBA image of src_width x src_height pixels to dst_width x
+// dst_height pixels, the row order is kept
+void scale_rgba(const unsigned char * src, int src_width, int src_height,
+	unsigned char * dst, int dst_width, int dst_height, scale_filter filter,
+	thread_pool * pool = &thread_pool::shared());
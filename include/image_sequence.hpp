@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+
+Encoders for writing rendered frames as numbered image files, e.g.
+as lossless intermediates for compositing. The functions only touch
+their arguments, so several frames can be encoded at the same time
+on different threads (see ffmpeg_wrapper::output_png etc.).
+
+The frames are RGBA with 8 bits per channel. Frames read back with
+glReadPixels are bottom-up and are flipped while encoding, the files
+are always stored top-down.
+
+ */
+
+// File formats of an image sequence
+enum image_format
+{
+	// PNG through stb_image_write, small but slow to encode
+	image_png,
+	// "Quite OK Image" format, lossless and many times faster than PNG
+	image_qoi,
+	// Uncompressed RGBA bytes without a header
+	image_raw
+};
+
+// Get the file extension of a format, without the dot
+const char * image_format_extension(image_format format);
+
+// Get the file name of frame index of a sequence, pattern contains a
+// printf conversion for the index, e.g. "frame_%05d.png"
+std::string image_sequence_path(const std::string & pattern, int index);
+
+// Encode an RGBA image as QOI into out (replacing its contents)
+void encode_qoi(const unsigned char * rgba, int width, int height, bool bottom_up, std::vector<unsigned char> & out);
+
+// Write an RGBA image to a file, returns false on failure
+bool write_image(const std::string & path, image_format format, const unsigned char * rgba,
+	int width, int height, bool bottom_up);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*
+
+A read-only view of a whole file, memory mapped on Linux and read
+into memory elsewhere. Used for the cache files in CACHE_ROOT, which
+are written once with write() and mapped on later runs.
+
+ */
+class mapped_file
+{
+	// The mapped file (or its content where mmap is not available)
+	const unsigned char * memory;
+	size_t memory_size;
+	std::vector<unsigned char> content;
+
+public:
+	// Create an empty view
+	mapped_file();
+	// Unmap the file
+	~mapped_file();
+
+	mapped_file(const mapped_file &) = delete;
+	mapped_file & operator=(const mapped_file &) = delete;
+
+	// Map a file, returns false if it cannot be read or is empty
+	bool open(const std::string & path);
+	// Unmap the file
+	void close();
+
+	// Whether a file is mapped
+	bool is_open() const;
+	// Get the content and the size of the file
+	const unsigned char * data() const;
+	size_t size() const;
+
+	// Write a file through a temporary file, so that an interrupted
+	// write never leaves a truncated file behind; creates the
+	// directory of the file if needed
+	static bool write(const std::string & path, const void * data, size_t size);
+	// Get the size and modification time of a file
+	static bool stat(const std::string & path, uint64_t * size, int64_t * time);
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <ostream>
+#include <vector>
+
+/*
+
+Accounting of the large CPU side allocations per subsystem: the
+current and the peak number of bytes and the number of allocations
+of every tag, reported with memory_report().
+
+Buffers are accounted either with memory_new_array() /
+memory_delete_array() instead of new[] / delete[], with a
+tracked_vector instead of a std::vector, or with memory_allocated()
+/ memory_released() around foreign allocations (e.g. stb_image).
+
+An optional budget, for all tags together or per tag, makes the
+allocation that would exceed it print the report and abort, instead
+of running out of memory somewhere later.
+
+Independent of the tags, every operator new is counted per thread,
+so that a loop can check that it does not allocate in its steady
+state (memory_thread_allocations() before and after), or abort on
+the first allocation of the thread with memory_forbid_allocations()
+to find where it happens. malloc() calls, e.g. in the OpenGL driver
+or GLFW, are not counted.
+
+ */
+
+// The subsystems memory is accounted for
+enum memory_tag
+{
+	// Height map of the terrain
+	memory_terrain,
+	// Collision geometry of the physics plane
+	memory_physics,
+	// Gradient tables of the perlin noise
+	memory_noise,
+	// Vertices and indices of meshes on the CPU
+	memory_geometry,
+	// Decoded images and mip chains
+	memory_textures,
+	// Frame buffers of the video output
+	memory_capture,
+	memory_tag_count
+};
+
+// Accounted memory of a tag (or all tags)
+struct memory_stats
+{
+	size_t current;
+	size_t peak;
+	size_t allocations;
+};
+
+// Account bytes allocated for a tag, aborts if a budget is exceeded
+void memory_allocated(memory_tag tag, size_t bytes);
+// Account bytes released by a tag
+void memory_released(memory_tag tag, size_t bytes);
+// Get the accounted memory of a tag
+memory_stats memory_get_stats(memory_tag tag);
+// Get the accounted memory of all tags together
+memory_stats memory_get_total();
+// Get the name of a tag
+const char * memory_tag_name(memory_tag tag);
+// Limit the memory of all tags together (0 = no limit)
+void memory_set_budget(size_t bytes);
+// Limit the memory of a tag (0 = no limit)
+void memory_set_budget(memory_tag tag, size_t bytes);
+// Print current, peak and allocation count of every tag
+void memory_report(std::ostream & out);
+// Get the number of heap allocations (operator new) of the calling
+// thread so far
+size_t memory_thread_allocations();
+// Abort on the next heap allocation of the calling thread until
+// allowed again
+void memory_forbid_allocations(bool forbid);
+
+// Allocate an array of count values for a tag
+template <typename T>
+T * memory_new_array(memory_tag tag, size_t count)
+{
+	memory_allocated(tag, count * sizeof(T));
+	return new T[count];
+}
+
+// Delete an array allocated with memory_new_array
+template <typename T>
+void memory_delete_array(memory_tag tag, T * values, size_t count)
+{
+	if (values)
+	{
+		delete[] values;
+		memory_released(tag, count * sizeof(T));
+	}
+}
+
+// Allocator that accounts everything it allocates for a tag
+template <typename T, memory_tag Tag>
+struct tracked_allocator
+{
+	typedef T value_type;
+
+	template <typename U>
+	struct rebind
+	{
+		typedef tracked_allocator<U, Tag> other;
+	};
+
+	tracked_allocator()
+	{
+	}
+
+	template <typename U>
+	tracked_allocator(const tracked_allocator<U, Tag> &)
+	{
+	}
+
+	T * allocate(size_t count)
+	{
+		memory_allocated(Tag, count * sizeof(T));
+		return static_cast<T *>(::operator new(count * sizeof(T)));
+	}
+
+	void deallocate(T * values, size_t count)
+	{
+		::operator delete(values);
+		memory_released(Tag, count * sizeof(T));
+	}
+};
+
+template <typename T, typename U, memory_tag Tag>
+bool operator==(const tracked_allocator<T, Tag> &, const tracked_allocator<U, Tag> &)
+{
+	return true;
+}
+
+template <typename T, typename U, memory_tag Tag>
+bool operator!=(const tracked_allocator<T, Tag> &, const tracked_allocator<U, Tag> &)
+{
+	return false;
+}
+
+// A std::vector accounted for a tag
+template <typename T, memory_tag Tag>
+using tracked_vector = std::vector<T, tracked_allocator<T, Tag>>;
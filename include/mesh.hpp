@@ -3,6 +3,52 @@
 #include <vector>
 
 #include "common.hpp"
+#include "vertex_layout.hpp"
+#include "memory_tracker.hpp"
+
+// Vertex format of meshes: position, normal, color
+typedef vertex_layout<attrib_float3, attrib_float3, attrib_float4> mesh_vertex_layout;
+
+// The vertices (in mesh_vertex_layout, the layout of the VBO),
+// the triangle indices and optionally the face normals of a mesh in
+// a single allocation, so that the data exists once on the CPU and
+// is uploaded from where it was built
+struct geometry_data {
+    // Bytes per vertex
+    static const size_t vertex_stride = mesh_vertex_layout::stride;
+
+    // Allocate room for @n_vertices vertices and @n_faces triangles,
+    // the face normals are only stored if @with_face_normals is set
+    void allocate(size_t n_vertices, size_t n_faces, bool with_face_normals);
+    // Release the memory
+    void clear();
+
+    // The vertex attributes are written and read through
+    // mesh_vertex_layout on vertex_data()
+    // View of the triangles in IBO order
+    strided_view<glm::uvec3> faces();
+    // View of the face normals (in the order chosen by the owner)
+    strided_view<glm::vec3> face_normals();
+
+    size_t vertex_count() const { return n_vertices; }
+    size_t face_count() const { return n_faces; }
+    // The VBO and IBO contents
+    void* vertex_data() { return memory.data(); }
+    const void* vertex_data() const { return memory.data(); }
+    size_t vertex_bytes() const { return n_vertices * vertex_stride; }
+    void* index_data() { return memory.data() + index_offset; }
+    const void* index_data() const { return memory.data() + index_offset; }
+    size_t index_bytes() const { return n_faces * sizeof(glm::uvec3); }
+    // Size of the allocation
+    size_t memory_size() const { return memory.size(); }
+
+private:
+    tracked_vector<unsigned char, memory_geometry> memory;
+    size_t n_vertices = 0;
+    size_t n_faces = 0;
+    size_t index_offset = 0;
+    size_t face_normal_offset = 0;
+};
 
 struct geometry {
     void bind();
@@ -15,14 +61,29 @@ struct geometry {
     unsigned int ibo;
     unsigned int vao;
     glm::mat4 transform;
+    // Index of the material in the imported scene
+    unsigned int material;
     unsigned int vertex_count;
-    std::vector<glm::vec3> positions;
-    std::vector<glm::vec3> normals;
-    std::vector<glm::vec4> colors;
-    std::vector<glm::uvec3> faces;
-	std::vector<glm::vec3> faces_normals;
+    tracked_vector<glm::vec3, memory_geometry> positions;
+    tracked_vector<glm::vec3, memory_geometry> normals;
+    tracked_vector<glm::vec4, memory_geometry> colors;
+    tracked_vector<glm::uvec3, memory_geometry> faces;
+	tracked_vector<glm::vec3, memory_geometry> faces_normals;
+    // Single allocation storage, used instead of the vectors above by
+    // large meshes that are built in place (e.g. the terrain)
+    geometry_data data;
 };
 
+// Import the meshes of a scene into the CPU side fields only (no
+// OpenGL calls, safe on worker threads)
+std::vector<geometry>
+importScene(const char* filename, bool smooth);
+
+// Create the vertex array and buffers of a mesh, straight from
+// @m.data if it holds the mesh, else from the vectors
+void
+uploadGeometry(geometry& m);
+
 std::vector<geometry>
 loadScene(const char* filename, bool smooth);
 
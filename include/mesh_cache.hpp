@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "mesh.hpp"
+
+/*
+
+Cache of imported scenes, so that assimp runs only once per model.
+
+importScene() stores the processed meshes of a model in CACHE_ROOT,
+keyed by the file name and the assimp processing flags, together
+with the size and modification time of the model. Later imports map
+the cache file instead of running assimp, a changed model is
+imported again.
+
+Layout of a cache file (all values native endian):
+
+    offset 0     header (see below), padded to 32 bytes
+    offset 32    object_count entries of (transform, material,
+                 counts, offsets)
+    ...          per object the vertices (position, normal, color as
+                 10 floats, the layout of the VBO) and the faces (3
+                 indices each), 16 byte aligned
+
+ */
+
+// Identifies a mesh cache file ("CGMC") and the version of its layout
+#define MESH_CACHE_MAGIC 0x434d4743u
+#define MESH_CACHE_VERSION 2u
+
+// Get the path of the cache file of a model imported with the given
+// assimp flags
+std::string mesh_cache_path(const std::string & model_path, int process);
+// Load the meshes of a model from its cache file into geometry::data,
+// returns false if there is none or the model has changed
+bool load_mesh_cache(const std::string & model_path, int process, std::vector<geometry> & objects);
+// Write the meshes of a model to its cache file
+bool save_mesh_cache(const std::string & model_path, int process, const std::vector<geometry> & objects);
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+
+A minimal header-only microbenchmark runner in the style of Google
+Benchmark, so that no dependency has to be fetched:
+
+    void bm_noise(benchmark_state & state)
+    {
+        perlin_noise noise(state.arg(), ...);
+        while (state.keep_running())
+        {
+            benchmark_do_not_optimize(noise.get_noise(...));
+        }
+    }
+    ...
+    benchmark_register("noise", bm_noise, {100, 1000, 4096});
+    return benchmark_main(argc, argv);
+
+Each benchmark runs with every argument as "name/arg". The number of
+iterations is doubled until a run takes at least --min_time seconds,
+the run is repeated --repetitions times and the median time per
+iteration is reported. The results are printed and, with --json=path,
+written in the JSON layout of Google Benchmark (so that the same
+comparison script works for both).
+
+With benchmark_set_allocation_counter() the heap allocations of the
+measured loop are reported per iteration as well, and a benchmark
+registered as allocation free fails the run if it allocates.
+
+Options: --filter=substring --min_time=seconds --repetitions=n
+         --json=path
+
+ */
+
+// Keep the compiler from optimizing a value away
+template <typename T>
+inline void benchmark_do_not_optimize(const T & value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	static volatile const void * sink;
+	sink = &value;
+#endif
+}
+
+// Returns the number of heap allocations of the calling thread so far
+inline std::function<size_t()> & benchmark_allocation_counter()
+{
+	static std::function<size_t()> counter;
+	return counter;
+}
+
+// Count the allocations of the benchmarks with counter
+inline void benchmark_set_allocation_counter(std::function<size_t()> counter)
+{
+	benchmark_allocation_counter() = counter;
+}
+
+// Loop state of a running benchmark
+class benchmark_state
+{
+	long argument;
+	long iterations;
+	long remaining;
+	bool started = false;
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::duration paused;
+	std::chrono::steady_clock::time_point pause_start;
+	// Time of the loop, taken when keep_running() returns false
+	std::chrono::steady_clock::duration measured;
+	double items = 0.0;
+	// Allocation count at the start and the end of the loop
+	size_t allocations_start = 0;
+	size_t allocations_end = 0;
+
+	static size_t count_allocations()
+	{
+		std::function<size_t()> & counter = benchmark_allocation_counter();
+		return counter ? counter() : 0;
+	}
+
+public:
+	benchmark_state(long argument, long iterations) :
+		argument(argument), iterations(iterations), remaining(iterations), paused(0), measured(0)
+	{
+	}
+
+	// Get the argument of this run
+	long arg() const
+	{
+		return argument;
+	}
+
+	// Returns true while iterations are left, the time between the
+	// first and the last call is measured (what the benchmark does
+	// after its loop, e.g. freeing memory, is not)
+	bool keep_running()
+	{
+		if (!started)
+		{
+			started = true;
+			allocations_start = count_allocations();
+			start = std::chrono::steady_clock::now();
+		}
+		if (remaining-- > 0)
+		{
+			return true;
+		}
+		measured = std::chrono::steady_clock::now() - start - paused;
+		allocations_end = count_allocations();
+		return false;
+	}
+
+	// Exclude the time until resume_timing(), e.g. for resetting state
+	void pause_timing()
+	{
+		pause_start = std::chrono::steady_clock::now();
+	}
+
+	void resume_timing()
+	{
+		paused += std::chrono::steady_clock::now() - pause_start;
+	}
+
+	// Report the number of items processed per iteration (e.g. points
+	// per call), shown as items per second
+	void set_items_per_iteration(double count)
+	{
+		items = count;
+	}
+
+	double get_items_per_iteration() const
+	{
+		return items;
+	}
+
+	long get_iterations() const
+	{
+		return iterations;
+	}
+
+	// Get the heap allocations per iteration of the loop
+	double get_allocations_per_iteration() const
+	{
+		return iterations > 0 ? (double)(allocations_end - allocations_start) / iterations : 0.0;
+	}
+
+	// Get the measured time of the loop in seconds
+	double elapsed() const
+	{
+		return std::chrono::duration<double>(measured).count();
+	}
+};
+
+// A registered benchmark and its arguments
+struct benchmark_entry
+{
+	std::string name;
+	std::function<void(benchmark_state &)> body;
+	std::vector<long> arguments;
+	// Whether an allocation in the loop is a failure
+	bool allocation_free;
+};
+
+// All registered benchmarks
+inline std::vector<benchmark_entry> & benchmark_registry()
+{
+	static std::vector<benchmark_entry> entries;
+	return entries;
+}
+
+// Register a benchmark that runs with each of the arguments, the run
+// fails if an allocation free benchmark allocates in its loop
+inline void benchmark_register(const std::string & name, std::function<void(benchmark_state &)> body,
+	std::vector<long> arguments, bool allocation_free = false)
+{
+	benchmark_entry entry;
+	entry.name = name;
+	entry.body = body;
+	entry.arguments = arguments;
+	entry.allocation_free = allocation_free;
+	benchmark_registry().push_back(entry);
+}
+
+// Run the registered benchmarks that match the command line
+inline int benchmark_main(int argc, char ** argv)
+{
+	std::string filter;
+	std::string json_path;
+	double min_time = 0.5;
+	int repetitions = 3;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+		if (option.compare(0, 9, "--filter=") == 0)
+		{
+			filter = option.substr(9);
+		}
+		else if (option.compare(0, 11, "--min_time=") == 0)
+		{
+			min_time = atof(option.c_str() + 11);
+		}
+		else if (option.compare(0, 14, "--repetitions=") == 0)
+		{
+			repetitions = std::max(1, atoi(option.c_str() + 14));
+		}
+		else if (option.compare(0, 7, "--json=") == 0)
+		{
+			json_path = option.substr(7);
+		}
+	}
+
+	struct result
+	{
+		std::string name;
+		long iterations;
+		double ns_per_iteration;
+		double items_per_second;
+		double allocations_per_iteration;
+	};
+	std::vector<result> results;
+	int allocating = 0;
+
+	printf("%-40s %14s %12s %14s %12s\n", "benchmark", "time/iter [ns]", "iterations", "items/s", "allocs/iter");
+	std::vector<benchmark_entry> & entries = benchmark_registry();
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		for (size_t j = 0; j < entries[i].arguments.size(); j++)
+		{
+			std::string name = entries[i].name + "/" + std::to_string(entries[i].arguments[j]);
+			if (!filter.empty() && name.find(filter) == std::string::npos)
+			{
+				continue;
+			}
+
+			// Find the number of iterations that takes min_time
+			long iterations = 1;
+			while (true)
+			{
+				benchmark_state state(entries[i].arguments[j], iterations);
+				entries[i].body(state);
+				double seconds = state.elapsed();
+				if (seconds >= min_time || iterations >= (1L << 30))
+				{
+					break;
+				}
+				long scaled = seconds > 0.0 ? (long)(iterations * 1.4 * min_time / seconds) : iterations * 10;
+				iterations = std::max(iterations * 2, std::min(scaled, iterations * 10));
+			}
+
+			// Median of the repetitions
+			std::vector<double> times;
+			double items = 0.0;
+			double allocations = 0.0;
+			for (int r = 0; r < repetitions; r++)
+			{
+				benchmark_state state(entries[i].arguments[j], iterations);
+				entries[i].body(state);
+				times.push_back(state.elapsed() * 1e9 / iterations);
+				items = state.get_items_per_iteration();
+				allocations = std::max(allocations, state.get_allocations_per_iteration());
+			}
+			std::sort(times.begin(), times.end());
+			result entry;
+			entry.name = name;
+			entry.iterations = iterations;
+			entry.ns_per_iteration = times[times.size() / 2];
+			entry.items_per_second = items > 0.0 ? items * 1e9 / entry.ns_per_iteration : 0.0;
+			entry.allocations_per_iteration = allocations;
+			results.push_back(entry);
+			bool allocates = entries[i].allocation_free && allocations > 0.0;
+			allocating += allocates ? 1 : 0;
+			printf("%-40s %14.1f %12ld %14.4g %12.3g%s\n", name.c_str(), entry.ns_per_iteration, iterations,
+				entry.items_per_second, allocations, allocates ? "  ALLOCATES" : "");
+			fflush(stdout);
+		}
+	}
+
+	if (allocating > 0)
+	{
+		fprintf(stderr, "benchmark:: %d allocation free benchmark(s) allocated\n", allocating);
+	}
+	if (json_path.empty())
+	{
+		return allocating > 0 ? 1 : 0;
+	}
+	FILE * file = fopen(json_path.c_str(), "w");
+	if (!file)
+	{
+		fprintf(stderr, "benchmark:: cannot write %s\n", json_path.c_str());
+		return 1;
+	}
+	fprintf(file, "{\n  \"context\": {\"repetitions\": %d, \"min_time\": %g},\n  \"benchmarks\": [\n",
+		repetitions, min_time);
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		fprintf(file, "    {\"name\": \"%s\", \"iterations\": %ld, \"real_time\": %.3f, \"cpu_time\": %.3f, "
+			"\"time_unit\": \"ns\", \"items_per_second\": %.6g, \"allocs_per_iter\": %.6g}%s\n",
+			results[i].name.c_str(), results[i].iterations, results[i].ns_per_iteration,
+			results[i].ns_per_iteration, results[i].items_per_second, results[i].allocations_per_iteration,
+			i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	fclose(file);
+	return allocating > 0 ? 1 : 0;
+}
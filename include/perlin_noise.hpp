@@ -4,6 +4,7 @@
 #include <math.h>
 #include <cstdlib>
 #include <iostream>
+#include "memory_tracker.hpp"
 
 /*
 
@@ -15,8 +16,9 @@ noise
  */
 class perlin_noise 
 {
-    // The gradients required for perlin noise
-    float *** gradients;
+    // The gradients required for perlin noise, (x, y) of the gradient
+    // at grid position (i, j) at index 2 * (i * gradients_count + j)
+    float * gradients;
     // The number of gradients in each dimension
     int gradients_count;
     // The maximum distance from (0,0)
@@ -27,6 +29,8 @@ class perlin_noise
     float scaling;
     // The distance between each gradient on the grid
     float gradient_grid_distance;
+    // The seed of the pseudo-random gradients
+    unsigned int seed;
 
     // Create pseudo-random gradients
     void create_gradients();
@@ -39,7 +43,7 @@ class perlin_noise
 
 public:
     // Create a new instance of perlin_noise
-    perlin_noise(int gradients_count, float grid_distance, float offset, float scaling);
+    perlin_noise(int gradients_count, float grid_distance, float offset, float scaling, unsigned int seed = time(0));
     // Clear up
     ~perlin_noise();
 
@@ -4,6 +4,7 @@
 #include <mesh.hpp>
 #include <camera.hpp>
 #include <shader.hpp>
+#include <asset_loader.hpp>
 #include <glm/gtx/transform.hpp>
 #include "glm/gtx/string_cast.hpp"
 
@@ -56,6 +57,12 @@ namespace phy {
   };
 
 
+  // Vertex format of the plane, the collision detection reads
+  // @vbo_data as 10 floats per vertex, so it must stay plain floats
+  typedef vertex_layout<attrib_float3, attrib_float3, attrib_float4> phy_vertex_layout;
+  static_assert(phy_vertex_layout::stride == 10 * sizeof(float),
+                "the collision detection indexes vbo_data as 10 floats per vertex");
+
   // TODO: Use class!
   struct phyPlane {
     unsigned int vao;
@@ -115,7 +122,56 @@ namespace phy {
     void destroy();
   };
 
-  void initShader();
+  // Load the sphere mesh and the shaders, from @assets if given
+  void initShader(asset_loader *assets = nullptr);
   void useShader(camera *cam, glm::mat4 proj_matrix, glm::vec3 light_dir);
+  // Render all spheres of @spheres that are visible at @frame with a
+  // single instanced draw call.
+  void renderSpheres(camera *cam, glm::mat4 proj_matrix, glm::vec3 light_dir,
+                     phySphere *const *spheres, int n_spheres, int frame);
+  // Same, but only for the spheres at the @n_indices given @indices.
+  void renderSpheres(camera *cam, glm::mat4 proj_matrix, glm::vec3 light_dir,
+                     phySphere *const *spheres, const int *indices, int n_indices);
+  // Number of draw calls issued by phy objects since the last reset.
+  int getDrawCalls();
+  void resetDrawCalls();
   float gauss_rand(float mean, float dev);
+
+  // Events of the collision code. Each thread counts into its own
+  // cache line, so counting costs a plain increment; the counters of
+  // all threads are summed when they are collected. Without
+  // ENABLE_PHYSICS_COUNTERS (cmake -DENABLE_PHYSICS_COUNTERS=OFF)
+  // nothing is counted and all counters stay 0. Counting changes the
+  // time of benchmark_kernels' physics/sphere_step by about 1%, less
+  // than the noise between two runs of the same build.
+  enum phyCounter
+    {
+     // phySphere::step() calls of spheres on a plane
+     counter_sphere_steps,
+     // reflections at a plane
+     counter_reflections,
+     // spheres that left their plane for good (plane = nullptr)
+     counter_detachments,
+     // getTriangleAt() calls
+     counter_triangle_lookups,
+     // steps that ended outside the bounding box of the plane
+     counter_outside_bounds,
+     counter_count
+    };
+
+  // Values of all counters
+  struct phyCounters {
+    unsigned long long values[counter_count];
+  };
+
+  // Sum of the counters of all threads since the last call, i.e. the
+  // events of a frame when called once per frame.
+  phyCounters collectCounters();
+  // Sum of the counters of all threads since the start.
+  phyCounters getCounterTotals();
+  const char *getCounterName(phyCounter counter);
+  // Write the counter names as a CSV header line and the counters of
+  // a frame as a CSV line.
+  void writeCounterHeader(std::ostream &out);
+  void writeCounterLine(std::ostream &out, int frame, const phyCounters &counters);
 }
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "config.hpp"
+
+/*
+
+Low overhead instrumentation: scoped timers, named counters and
+frame marks, recorded into a ring buffer per thread.
+
+    PROFILE_FRAME(frame)           start frame number frame
+    PROFILE_SCOPE("name")          time the enclosing scope
+    PROFILE_COUNTER("name", value) record a value, e.g. a draw count
+    PROFILE_THREAD_NAME("name")    name the calling thread in the trace
+    PROFILE_REPORT(out)            print p50/p95/p99 per scope over frames
+    PROFILE_WRITE_TRACE(path)      write a Chrome trace (chrome://tracing,
+                                   ui.perfetto.dev)
+
+Names must be string literals (only the pointer is stored). Recording
+takes no lock: each thread writes to its own buffer, the oldest
+events are overwritten once it is full. Reports and traces should be
+made while the other threads are idle.
+
+Everything is compiled out unless ENABLE_PROFILER is defined (cmake
+-DENABLE_PROFILER=ON), the macros then expand to nothing.
+
+ */
+
+#ifdef ENABLE_PROFILER
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Events kept per thread
+#define PROFILER_EVENTS_PER_THREAD 65536
+
+namespace profiler
+{
+	// Nanoseconds since the first call
+	uint64_t now();
+	// Record a finished scope
+	void record_scope(const char * name, uint64_t start, uint64_t end);
+	// Record the value of a counter
+	void counter(const char * name, double value);
+	// Mark the start of a frame, later events belong to it
+	void begin_frame(int frame);
+	// Name the calling thread in the trace
+	void set_thread_name(const char * name);
+	// Print count, mean, p50, p95 and p99 of the time per frame of
+	// every scope and of the values of every counter
+	void report(std::ostream & out);
+	// Write all recorded events as Chrome trace event JSON
+	bool write_trace(const std::string & path);
+}
+
+// Records the time from its creation to its destruction
+class profile_scope
+{
+	const char * name;
+	uint64_t start;
+
+public:
+	explicit profile_scope(const char * name) : name(name), start(profiler::now())
+	{
+	}
+
+	~profile_scope()
+	{
+		profiler::record_scope(name, start, profiler::now());
+	}
+
+	profile_scope(const profile_scope &) = delete;
+	profile_scope & operator=(const profile_scope &) = delete;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) profile_scope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNTER(name, value) profiler::counter(name, (double)(value))
+#define PROFILE_FRAME(frame) profiler::begin_frame(frame)
+#define PROFILE_THREAD_NAME(name) profiler::set_thread_name(name)
+#define PROFILE_REPORT(out) profiler::report(out)
+#define PROFILE_WRITE_TRACE(path) profiler::write_trace(path)
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNTER(name, value)
+#define PROFILE_FRAME(frame)
+#define PROFILE_THREAD_NAME(name)
+#define PROFILE_REPORT(out)
+#define PROFILE_WRITE_TRACE(path)
+
+#endif // ENABLE_PROFILER
@@ -10,6 +10,11 @@ loadShaderFile(const char* filename);
 unsigned int
 compileShader(const char* filename, unsigned int type);
 
+// compiles a shader from source code that has already been loaded
+// (e.g. by a worker thread) and checks for compilation errors
+unsigned int
+compileShaderSource(const char* source, unsigned int type);
+
 unsigned int
 linkProgram(unsigned int vertexShader, unsigned int fragmentShader);
 
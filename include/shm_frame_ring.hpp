@@ -0,0 +1,133 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+/*
+
+A ring of frame slots in POSIX shared memory, so that frames reach
+an encoder in another process without being copied through a pipe.
+The producer renders (or reads back) straight into a slot and
+publishes it, the consumer reads the slot in place and releases it.
+
+The handshake uses two sequence numbers in the shared header: the
+producer has published write_seq frames and the consumer has
+released read_seq frames. Frame n lives in slot n % slot_count, the
+producer waits while write_seq - read_seq == slot_count and the
+consumer waits while read_seq == write_seq. Each side only ever
+writes its own counter, so no locks are needed across processes.
+
+Layout of the shared memory object (all values native endian):
+
+    offset 0     header (see below), padded to 4096 bytes
+    offset 4096  slot_count slots of slot_stride bytes each
+
+The frames are RGBA with 8 bits per channel, bottom-up as returned
+by glReadPixels if the flag SHM_FRAME_BOTTOM_UP is set.
+
+ */
+
+// Identifies a frame ring ("CGFR") and the version of its layout
+#define SHM_FRAME_MAGIC 0x52464743u
+#define SHM_FRAME_VERSION 1u
+// The rows of the frames are stored bottom-up
+#define SHM_FRAME_BOTTOM_UP 1u
+
+class shm_frame_ring
+{
+public:
+	// Header at the start of the shared memory object
+	struct header
+	{
+		// SHM_FRAME_MAGIC, written last by the producer
+		std::atomic<uint32_t> magic;
+		// SHM_FRAME_VERSION
+		uint32_t version;
+		// Frame size in pixels
+		uint32_t width;
+		uint32_t height;
+		// Number of slots and distance between two slots in bytes
+		uint32_t slot_count;
+		uint32_t flags;
+		uint64_t frame_size;
+		uint64_t slot_stride;
+		// Frames published by the producer, on its own cache line
+		alignas(64) std::atomic<uint64_t> write_seq;
+		// Frames released by the consumer, on its own cache line
+		alignas(64) std::atomic<uint64_t> read_seq;
+		// Set by the producer after the last frame
+		alignas(64) std::atomic<uint32_t> closed;
+		// Set by the consumer when it attaches
+		std::atomic<uint32_t> consumer_attached;
+	};
+
+private:
+	// Name of the shared memory object, e.g. "/cg_frames"
+	std::string name;
+	// Whether this is the producing end, which removes the object
+	bool producer;
+	// Mapping of the whole object
+	unsigned char * memory;
+	size_t memory_size;
+	// Header inside the mapping
+	header * shared;
+	// Slots inside the mapping
+	unsigned char * slots;
+	// Producer: number of acquire() calls that had to wait and the
+	// time spent waiting
+	int stalls;
+	double stall_seconds;
+
+	// Map the object of file descriptor fd with the given size
+	bool map(int fd, size_t size);
+
+public:
+	// Create a ring for the producer with slot_count frames of
+	// width x height RGBA pixels
+	shm_frame_ring(const std::string & name, int width, int height, int slot_count, uint32_t flags = SHM_FRAME_BOTTOM_UP);
+	// Attach to an existing ring as the consumer, waits up to
+	// timeout_seconds until the producer has created it
+	shm_frame_ring(const std::string & name, double timeout_seconds);
+	// Unmap, the producer also marks the stream as closed and
+	// removes the name
+	~shm_frame_ring();
+
+	shm_frame_ring(const shm_frame_ring &) = delete;
+	shm_frame_ring & operator=(const shm_frame_ring &) = delete;
+
+	// Whether the ring has been created or attached successfully
+	bool is_valid() const;
+
+	// Producer: get the slot of the next frame, blocks while all
+	// slots hold frames the consumer has not released; returns
+	// nullptr if none is released within timeout_seconds (< 0 waits
+	// forever), e.g. because the consumer died or never attached
+	unsigned char * acquire(double timeout_seconds = -1.0);
+	// Producer: publish the frame in the acquired slot
+	void publish();
+	// Producer: mark the end of the stream
+	void close();
+
+	// Consumer: get the next frame, blocks until one is published,
+	// returns nullptr at the end of the stream
+	const unsigned char * wait_frame();
+	// Consumer: release the frame returned by wait_frame
+	void release();
+
+	// Get the properties of the frames
+	int get_width() const;
+	int get_height() const;
+	size_t get_frame_size() const;
+	uint32_t get_flags() const;
+	int get_slot_count() const;
+	// Get the number of frames published and released so far
+	uint64_t get_published() const;
+	uint64_t get_released() const;
+	// Whether a consumer has attached
+	bool is_consumer_attached() const;
+	// Get the number of producer stalls and the time spent in them
+	int get_stalls() const;
+	double get_stall_seconds() const;
+};
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "terrain.hpp"
+#include "physics.hpp"
+#include "camera.hpp"
+#include <string>
+#include <vector>
+
+/*
+
+The settings of the scene: the terrain, the grid of spheres that
+is dropped onto it and the timeline of the plane, which is tilted
+back and forth, then tilted sideways and finally dropped
+
+ */
+struct simulation_settings
+{
+	// Terrain
+	float terrain_size;
+	int terrain_resolution;
+	int terrain_frames;
+	std::string stone;
+	std::string grass;
+	std::string snow;
+
+	// Spheres
+	int x_spheres;
+	int z_spheres;
+	float sphere_radius;
+	float sphere_drop_height;
+	// Spheres appear around this frame (gaussian, deviation 60)
+	int sphere_appearance_frame;
+	// Spheres start to fall at this frame
+	int sphere_release_frame;
+	// Time step of the sphere simulation
+	float sphere_time_step;
+
+	// Time step of the plane transformations
+	float seconds_per_frame;
+
+	// Tilting back and forth
+	glm::vec3 tilt_angular_velocity;
+	int tilt_start_frame;
+	int tilt_interval;
+	int tilt_end_frame;
+	// Tilting sideways
+	glm::vec3 tilt_vertically_angular_velocity;
+	int tilt_vertically_start_frame;
+	int tilt_vertically_end_frame;
+	// Dropping
+	int drop_start_frame;
+	glm::vec3 drop_initial_velocity;
+	float drop_factor;
+
+	// Seed of the terrain and the appearance of the spheres
+	unsigned int seed;
+};
+
+/*
+
+The complete state of the simulation between two frames, i.e. all
+that is needed to continue from there in another process: the
+spheres, the plane transformation and velocities, the timeline
+frame, the rise of the terrain and the camera orbit. The terrain
+itself is rebuilt from the seed.
+
+ */
+struct simulation_snapshot
+{
+	// State of a sphere
+	struct sphere_state
+	{
+		glm::vec4 x;
+		glm::vec4 v;
+		glm::vec4 a;
+		glm::vec4 offset_vec;
+		glm::vec4 custom_color;
+		float radius;
+		int visibility_frame;
+		int last_triangle_index;
+		int touched_plane_last_step;
+		// Whether the sphere still interacts with the plane
+		int attached;
+	};
+
+	// The next frame that will be simulated
+	int frame;
+	// Seed the scene was built with
+	unsigned int seed;
+	// Plane transformation (the inverse is kept as the physics uses it)
+	glm::mat4 plane_model_mat;
+	glm::mat4 plane_inv_model_mat;
+	// Plane velocities and whether they are applied
+	glm::vec3 angular_velocity;
+	glm::vec3 vertical_velocity;
+	int angular_velocity_active;
+	int vertical_velocity_active;
+	// Current frame of the rise of the terrain
+	int terrain_frame;
+	// Camera orbit
+	float camera_phi;
+	float camera_theta;
+	float camera_distance;
+	// All spheres
+	std::vector<sphere_state> spheres;
+};
+
+// Write a snapshot to a file, returns false on failure
+bool save_snapshot(const std::string & path, const simulation_snapshot & snapshot);
+// Read a snapshot from a file, returns false on failure
+bool load_snapshot(const std::string & path, simulation_snapshot & snapshot);
+
+/*
+
+This class owns the scene (terrain, physics plane and spheres) and
+advances it frame by frame along the timeline, independent of the
+rendering
+
+ */
+class simulation
+{
+	// The settings of the scene
+	simulation_settings settings;
+	// The terrain, its heights are the physics plane
+	terrain * terr;
+	// The physics plane
+	phy::phyPlane * plane;
+	// The spheres
+	std::vector<phy::phySphere *> spheres;
+	// Current angular velocity of the plane
+	glm::vec3 angular_velocity;
+	// Current vertical velocity of the plane
+	glm::vec3 vertical_velocity;
+	// The next frame that will be simulated
+	int frame;
+
+	// Apply the events of the timeline at the current frame
+	void apply_timeline();
+
+public:
+	// Build the scene, requires an OpenGL context for the terrain,
+	// whose textures and shaders are taken from assets if given
+	simulation(const simulation_settings & settings, asset_loader * assets = nullptr);
+	// Clean up
+	~simulation();
+
+	simulation(const simulation &) = delete;
+	simulation & operator=(const simulation &) = delete;
+
+	// Simulate the next frame and return its index
+	int step();
+	// Same without updating the terrain, so that another thread can
+	// render it meanwhile (the terrain then follows the plane through
+	// terrain::set_model_mat() on the render thread)
+	int step_physics();
+	// Get the next frame that will be simulated
+	int get_frame();
+	// Simulate without rendering until frame is the next frame, the
+	// rise of the terrain and the camera advance as if rendered
+	void fast_forward(int frame, camera & cam);
+
+	// Get the terrain
+	terrain & get_terrain();
+	// Get the physics plane
+	phy::phyPlane & get_plane();
+	// Get the spheres
+	phy::phySphere ** get_spheres();
+	// Get the number of spheres
+	int get_sphere_count();
+
+	// Capture the state before the next frame
+	simulation_snapshot capture(const camera & cam);
+	// Continue from a snapshot, returns false if it does not fit the
+	// scene (e.g. a different number of spheres or seed)
+	bool restore(const simulation_snapshot & snapshot, camera & cam);
+};
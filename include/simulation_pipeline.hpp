@@ -0,0 +1,98 @@
+#pragma once
+
+#include "simulation.hpp"
+#include "memory_tracker.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+
+What the render loop needs of a simulated frame: copies of the
+spheres and the plane transformation (and the collision counters of
+the step), so that it can be drawn while the simulation continues
+
+ */
+struct render_state
+{
+	// Index of the frame
+	int frame;
+	// Transformation of the plane, the terrain follows it
+	glm::mat4 plane_model_mat;
+	// Copies of the spheres and pointers to them (for renderSpheres)
+	tracked_vector<phy::phySphere, memory_physics> spheres;
+	std::vector<phy::phySphere *> sphere_pointers;
+	// Collision events of the step
+	phy::phyCounters counters;
+};
+
+/*
+
+This class runs the simulation one frame ahead of the rendering:
+while frame N is drawn from an immutable render_state, a thread of
+its own simulates frame N + 1 into a second one.
+
+    const render_state & state = pipeline.acquire();
+    ... render state ...
+    pipeline.release();
+
+The two states form a single producer, single consumer ring that is
+handed over with atomics only. A side that has to wait spins briefly
+and then sleeps in short intervals, so the hand-off latency stays
+bounded without a lock. Every simulated frame is rendered exactly
+once and in order, so a video is the same frame for frame as with
+the serial loop.
+
+Until start() and after stop(), acquire() simulates the frame on the
+calling thread instead, i.e. the loop is serial and the simulation
+may be used directly between release() and the next acquire() (for
+snapshots, checkpoints and seeking). After stop() the simulation
+may be ahead of the rendered frames by the states that were not
+rendered.
+
+ */
+class simulation_pipeline
+{
+	// The simulation, only used by the thread while it runs
+	simulation & sim;
+	// The ring of states
+	render_state states[2];
+	// Number of states published by the producer and released by the
+	// consumer
+	std::atomic<unsigned int> produced;
+	std::atomic<unsigned int> consumed;
+	// Set to end the simulation thread
+	std::atomic<bool> stopping;
+	// The simulation thread, not joinable when serial
+	std::thread thread;
+	// Next frame that will be rendered while threaded
+	int next_frame;
+
+	// Simulate the next frame into a state
+	void simulate(render_state & state);
+	// Main loop of the simulation thread
+	void simulation_loop();
+
+public:
+	// Prepare the states for the spheres of the simulation
+	simulation_pipeline(simulation & sim);
+	// Stop the simulation thread
+	~simulation_pipeline();
+
+	simulation_pipeline(const simulation_pipeline &) = delete;
+	simulation_pipeline & operator=(const simulation_pipeline &) = delete;
+
+	// Start simulating on a thread of its own
+	void start();
+	// Stop the thread, the states it simulated ahead are dropped
+	void stop();
+	// Whether the simulation runs on its own thread
+	bool is_threaded() const;
+
+	// Get the state of the next frame, waits until it is simulated
+	const render_state & acquire();
+	// Done with the state of acquire(), its buffer may be reused
+	void release();
+	// Get the next frame that will be rendered
+	int get_frame() const;
+};
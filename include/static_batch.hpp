@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include "common.hpp"
+#include "mesh.hpp"
+
+/*
+
+This class merges the static meshes of a scene into one vertex and
+one index buffer, so that a scene of many meshes is drawn from a
+single vertex array instead of one VAO, VBO and IBO per mesh.
+
+add() pre-transforms the vertices of a mesh by its transform (the
+normals by the inverse transpose, mirrored meshes get their winding
+flipped) and rebases its indices onto the shared vertex buffer.
+upload() orders the meshes by material and creates the buffers, the
+meshes of a material become one contiguous range of the index
+buffer, i.e. one entry of the draw list. The model matrix of a batch
+is the identity.
+
+render() draws the whole batch with a single glDrawElements call, for
+a shader that takes the colors from the vertices. A renderer with
+materials sets the uniforms of draws[i].material and calls
+render(i) for each entry instead.
+
+No scene uses it yet (the only model is the sphere, which is
+instanced), static_batch_check tests the merged data and one draw
+headlessly.
+
+ */
+class static_batch
+{
+public:
+	// A range of the index buffer with a single material
+	struct draw
+	{
+		// Byte offset of the first index and number of indices
+		size_t offset;
+		GLsizei count;
+		// Material index of the meshes (see geometry::material)
+		unsigned int material;
+	};
+
+private:
+	// A mesh added before upload(), its indices are in staged_indices
+	struct piece
+	{
+		unsigned int material;
+		size_t first_index;
+		size_t count;
+	};
+
+	// Vertices (in mesh_vertex_layout) and rebased indices of the
+	// meshes added before upload()
+	std::vector<unsigned char> staged_vertices;
+	std::vector<unsigned int> staged_indices;
+	std::vector<piece> pieces;
+	size_t vertex_count = 0;
+	size_t mesh_count = 0;
+
+	// The draw list and the number of indices of all entries
+	std::vector<draw> draws;
+	GLsizei index_count = 0;
+
+	// Vertex array and buffers
+	unsigned int vao = 0;
+	unsigned int vbo = 0;
+	unsigned int ibo = 0;
+
+public:
+	static_batch() = default;
+	// Delete the buffers
+	~static_batch();
+
+	static_batch(const static_batch &) = delete;
+	static_batch & operator=(const static_batch &) = delete;
+
+	// Add a mesh (its CPU side data) with its transform applied
+	void add(const geometry & m);
+	// Add all meshes of a scene, e.g. the result of importScene()
+	void add(const std::vector<geometry> & scene);
+	// Create the buffers and the draw list once all meshes are added,
+	// the CPU side copies are released afterwards
+	void upload();
+	// Draw all meshes in one call, the shader and its uniforms must
+	// be set
+	void render() const;
+	// Draw the meshes of one material, i.e. one entry of the draw list
+	void render(int index) const;
+	// Delete the buffers and forget all meshes
+	void destroy();
+
+	// Get the draw list
+	const std::vector<draw> & get_draws() const;
+	// Get the vertex array, its buffers are the merged vertices and
+	// indices
+	unsigned int get_vertex_array() const;
+	// Get the number of meshes and vertices in the batch
+	size_t get_mesh_count() const;
+	size_t get_vertex_count() const;
+};
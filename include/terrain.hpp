@@ -2,6 +2,9 @@
 
 #include "mesh.hpp"
 #include "perlin_noise.hpp"
+#include "culling.hpp"
+#include "texture_cache.hpp"
+#include "asset_loader.hpp"
 #include <buffer.hpp>
 #include <camera.hpp>
 #include <shader.hpp>
@@ -18,6 +21,9 @@ functions to build and modify it
  */
 class terrain
 {
+	// Times the private kernels (src/benchmark_kernels.cpp)
+	friend struct terrain_benchmark;
+
 	// The starting frame of the rise of the terrain
 	int start_frame = 0;
 	// Frame counter
@@ -42,6 +48,32 @@ class terrain
 	float lowest_height = 0.0;
 	// Save the highest height that has been generated
 	float highest_height = 1.0;
+	// The seed of the height map
+	unsigned int seed;
+	// Whether build() logs its progress
+	bool log_progress = true;
+
+	// A square block of faces that is culled as a whole
+	struct chunk
+	{
+		// Offset of the first index of the chunk in the IBO
+		int first_index;
+		// Number of indices of the chunk
+		int index_count;
+		// Bounding box in model space
+		glm::vec3 box_min;
+		glm::vec3 box_max;
+	};
+	// The chunks of the terrain, the IBO is sorted by chunk
+	std::vector<chunk> chunks;
+	// Draw counts of the visible chunks (reused each frame)
+	std::vector<GLsizei> draw_counts;
+	// Draw offsets of the visible chunks (reused each frame)
+	std::vector<const void *> draw_offsets;
+	// Number of chunks that passed culling in the last render()
+	int visible_chunks = 0;
+	// Number of chunks that were culled in the last render()
+	int culled_chunks = 0;
 
 	// Handle for the terrain shader program
 	static int terrainShaderProgram;
@@ -78,25 +110,21 @@ class terrain
 	void set_frames(int start, int max);
 	// Reset the current frame
 	void reset_current_frame();
-	// Increase the current frame
-	void increase_current_frame(int increase = 1);
 
 	// Allocate shader texture locations
 	static void get_texture_locations(int shader_program);
-	// Load the stone, grass and snow textures
-	static void load_textures(std::string stone, std::string grass, std::string snow);
-	// Create textures from raw data
-	static unsigned create_texture_rgba32f(int width, int height, float* data);
-	// Load raw texture data
-	static float* load_texture_data(std::string filename, int* width, int* height);
+	// Load the stone, grass and snow textures (through assets if given)
+	static void load_textures(std::string stone, std::string grass, std::string snow, asset_loader * assets = nullptr);
 	// Set the texture filter mode of a texture
 	static void set_texture_filter_mode(unsigned int texture, GLenum mode);
 	// Set the texture wrap mode of a texture
 	static void set_texture_wrap_mode(unsigned int texture, GLenum mode);
 
 public:
-	// Create a new instance of terrain
-	terrain(float size, int resolution, int start_frame, int max_frame, std::string stone, std::string grass, std::string snow);
+	// Create a new instance of terrain, the textures and shaders are
+	// taken from assets if given (e.g. loaded while the heights are
+	// generated)
+	terrain(float size, int resolution, int start_frame, int max_frame, std::string stone, std::string grass, std::string snow, unsigned int seed = time(0), asset_loader * assets = nullptr);
 	// Clean up
 	~terrain();
 
@@ -109,9 +137,19 @@ public:
 	void render(camera * cam, glm::mat4 proj_matrix, glm::vec3 light_dir);
 	// Set the model matrix of the terrain
 	void set_model_mat(glm::mat4 model_mat);
+	// Get the number of chunks drawn by the last render()
+	int get_visible_chunks();
+	// Get the number of chunks culled by the last render()
+	int get_culled_chunks();
+	// Get the current frame of the rise of the terrain
+	int get_current_frame();
+	// Set the current frame, e.g. when restoring a snapshot
+	void set_current_frame(int frame);
+	// Increase the current frame (done by render())
+	void increase_current_frame(int increase = 1);
 
-	// Create the terrain shader program
-	static void create_terrain_shaders();
+	// Create the terrain shader program (from the sources in assets if given)
+	static void create_terrain_shaders(asset_loader * assets = nullptr);
 
 };
 
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "common.hpp"
+#include "thread_pool.hpp"
+#include "mapped_file.hpp"
+#include "memory_tracker.hpp"
+
+/*
+
+Cache of decoded textures, so that the JPEGs are decoded only once.
+
+The first load decodes the image to RGBA8, builds the full mip chain
+on the CPU (2x2 box filter, SIMD and threaded) and writes all levels
+to a cache file in CACHE_ROOT. Later loads map the file and upload
+the levels directly, without decoding, float expansion or
+glGenerateMipmap. The cache file is rebuilt when the size or the
+modification time of the source image changes.
+
+Layout of a cache file (all values native endian):
+
+    offset 0     header (see below), padded to 64 bytes
+    offset 64    level_count entries of (offset, width, height)
+    ...          the levels, RGBA8, top row first, each 16 byte aligned
+
+The texels are stored as they are in the image (no sRGB decode),
+which is how the terrain shader has always read them.
+
+ */
+
+// Identifies a texture cache file ("CGTC") and the version of its layout
+#define TEXTURE_CACHE_MAGIC 0x43544743u
+#define TEXTURE_CACHE_VERSION 1u
+
+class texture_cache
+{
+public:
+	// Header at the start of a cache file
+	struct header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t width;
+		uint32_t height;
+		uint32_t level_count;
+		uint32_t reserved;
+		// Size and modification time of the source image
+		uint64_t source_size;
+		int64_t source_time;
+	};
+
+	// Position and size of a mip level in the file
+	struct level
+	{
+		uint64_t offset;
+		uint32_t width;
+		uint32_t height;
+	};
+
+private:
+	// The mapped cache file
+	mapped_file file;
+	// Header and level table inside the file
+	const header * file_header;
+	const level * levels;
+
+	// Map a cache file, returns false if it is missing or broken
+	bool map(const std::string & path);
+	// Unmap the file
+	void unmap();
+
+public:
+	// Map the cache file of an image, building it first if it is
+	// missing or older than the image
+	texture_cache(const std::string & image_path, thread_pool * pool = &thread_pool::shared());
+	// Unmap the file
+	~texture_cache();
+
+	texture_cache(const texture_cache &) = delete;
+	texture_cache & operator=(const texture_cache &) = delete;
+
+	// Whether the cache file could be built and mapped
+	bool is_valid() const;
+	// Get the size of the full resolution level
+	int get_width() const;
+	int get_height() const;
+	// Get the number of mip levels
+	int get_level_count() const;
+	// Get the texels of a mip level and its size
+	const unsigned char * get_level(int index, int * width, int * height) const;
+	// Create an immutable GL_RGBA8 texture with all mip levels
+	unsigned int upload() const;
+
+	// Get the path of the cache file of an image
+	static std::string cache_path(const std::string & image_path);
+	// Decode an image and write its cache file
+	static bool build(const std::string & image_path, const std::string & path,
+		thread_pool * pool = &thread_pool::shared());
+	// Compute the next mip level of an RGBA8 image (2x2 box filter,
+	// a side of 1 texel is kept)
+	static void downsample(const unsigned char * src, int src_width, int src_height,
+		unsigned char * dst, thread_pool * pool = &thread_pool::shared());
+};
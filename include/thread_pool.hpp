@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/*
+
+A small pool of worker threads to split loops over rows, tiles etc.
+across all cores. The calling thread takes part in the work, so a
+pool on a single core machine simply runs the loop inline.
+
+Only one loop runs on the pool at a time. A parallel_for that is
+called from inside a running loop (of any pool) is executed serially
+on the thread that runs the loop body, and so is one that is called
+from another thread while the pool is busy.
+
+ */
+class thread_pool
+{
+	// The worker threads
+	std::vector<std::thread> workers;
+	// Protects the job description and the counters below
+	std::mutex mutex;
+	// Signals the workers that a new job or the shutdown is pending
+	std::condition_variable wake;
+	// Signals the caller that all workers finished the job
+	std::condition_variable done;
+	// Held by the thread that currently runs a job on the pool
+	std::mutex job_mutex;
+
+	// The current job: fn(ctx, begin, end) for chunks of [.., job_end)
+	void (*job_fn)(void *, int, int) = nullptr;
+	void * job_ctx = nullptr;
+	int job_end = 0;
+	int job_grain = 1;
+	// Start of the next chunk that has not been taken yet
+	std::atomic<int> job_next;
+	// Number of workers that have not finished the current job
+	int active_workers = 0;
+	// Increased for every job, so that workers can detect new ones
+	unsigned long generation = 0;
+	// Set when the pool is destroyed
+	bool stopping = false;
+
+	// Main loop of the worker threads
+	void worker_loop();
+	// Take and run chunks of the current job until none are left
+	void run_chunks();
+	// Run fn(ctx, begin, end) for chunks of grain iterations
+	void run(int begin, int end, int grain, void (*fn)(void *, int, int), void * ctx);
+
+	// Call a body of type F for a range
+	template <typename F>
+	static void invoke(void * body, int begin, int end)
+	{
+		(*static_cast<const F *>(body))(begin, end);
+	}
+
+public:
+	// Create a pool with the given number of threads, including the
+	// calling thread (0 = number of hardware threads)
+	thread_pool(int threads = 0);
+	// Join all workers
+	~thread_pool();
+
+	thread_pool(const thread_pool &) = delete;
+	thread_pool & operator=(const thread_pool &) = delete;
+
+	// Get the number of threads working on a loop (including the caller)
+	int get_thread_count() const;
+
+	// Call body(chunk_begin, chunk_end) for chunks of at most grain
+	// iterations covering [begin, end), and wait until all are done
+	template <typename F>
+	void parallel_for(int begin, int end, int grain, const F & body)
+	{
+		run(begin, end, grain, &thread_pool::invoke<F>, (void *)&body);
+	}
+
+	// Get the pool that is shared by the whole program
+	static thread_pool & shared();
+};
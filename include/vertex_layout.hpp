@@ -0,0 +1,363 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include "common.hpp"
+
+/*
+
+Interleaved vertex formats described by a list of attribute types,
+e.g. vertex_layout<attrib_float3, attrib_float3, attrib_float4> for
+position, normal and color as 10 floats.
+
+The stride and the offset of every attribute are computed at compile
+time, setup() makes the glVertexAttribPointer calls for locations
+0..n-1 and write<I>() / read<I>() pack and unpack attribute I of a
+vertex. Code that only uses these stays correct when an attribute
+type changes, e.g. attrib_float4 -> attrib_unorm8x4 for colors.
+
+Every attribute type provides:
+
+    value_type          the CPU type (glm vector)
+    size                bytes in the vertex, a multiple of 4
+    components, type,   the arguments of glVertexAttribPointer
+    normalized
+    pack(dst, value), unpack(src)
+    is_plain            value_type is stored as it is (so that the
+                        attribute can be viewed in place)
+
+ */
+
+// Convert a float to a half float (round to nearest even)
+inline uint16_t float_to_half(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000u;
+	int32_t exponent = (int32_t)((bits >> 23) & 0xffu) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffffu;
+
+	// NaN and infinity
+	if (((bits >> 23) & 0xffu) == 0xffu)
+	{
+		return (uint16_t)(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+	}
+	// Too large: infinity
+	if (exponent >= 31)
+	{
+		return (uint16_t)(sign | 0x7c00u);
+	}
+	// Too small for a normal half: denormal or zero
+	if (exponent <= 0)
+	{
+		if (exponent < -10)
+		{
+			return (uint16_t)sign;
+		}
+		mantissa |= 0x800000u;
+		uint32_t shift = (uint32_t)(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1u);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1u)))
+		{
+			half++;
+		}
+		return (uint16_t)(sign | half);
+	}
+
+	uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fffu;
+	// A carry into the exponent is the correct rounding
+	if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+	{
+		half++;
+	}
+	return (uint16_t)half;
+}
+
+// Convert a half float to a float
+inline float half_to_float(uint16_t half)
+{
+	uint32_t sign = (uint32_t)(half & 0x8000u) << 16;
+	uint32_t exponent = (half >> 10) & 0x1fu;
+	uint32_t mantissa = half & 0x3ffu;
+	uint32_t bits;
+	if (exponent == 0)
+	{
+		if (mantissa == 0)
+		{
+			bits = sign;
+		}
+		else
+		{
+			// Normalize the denormal
+			exponent = 127 - 15 + 1;
+			while ((mantissa & 0x400u) == 0)
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+		}
+	}
+	else if (exponent == 31)
+	{
+		bits = sign | 0x7f800000u | (mantissa << 13);
+	}
+	else
+	{
+		bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+	}
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// Three floats, e.g. positions and normals
+struct attrib_float3
+{
+	typedef glm::vec3 value_type;
+	static const size_t size = 3 * sizeof(float);
+	static const int components = 3;
+	static const GLenum type = GL_FLOAT;
+	static const GLboolean normalized = GL_FALSE;
+	static const bool is_plain = true;
+	static void pack(unsigned char * dst, const value_type & value) { memcpy(dst, &value[0], size); }
+	static value_type unpack(const unsigned char * src) { value_type value; memcpy(&value[0], src, size); return value; }
+};
+
+// Four floats, e.g. colors
+struct attrib_float4
+{
+	typedef glm::vec4 value_type;
+	static const size_t size = 4 * sizeof(float);
+	static const int components = 4;
+	static const GLenum type = GL_FLOAT;
+	static const GLboolean normalized = GL_FALSE;
+	static const bool is_plain = true;
+	static void pack(unsigned char * dst, const value_type & value) { memcpy(dst, &value[0], size); }
+	static value_type unpack(const unsigned char * src) { value_type value; memcpy(&value[0], src, size); return value; }
+};
+
+// Three half floats padded to 8 bytes, e.g. positions of small meshes
+struct attrib_half3
+{
+	typedef glm::vec3 value_type;
+	static const size_t size = 4 * sizeof(uint16_t);
+	static const int components = 3;
+	static const GLenum type = GL_HALF_FLOAT;
+	static const GLboolean normalized = GL_FALSE;
+	static const bool is_plain = false;
+	static void pack(unsigned char * dst, const value_type & value)
+	{
+		uint16_t half[4] = { float_to_half(value.x), float_to_half(value.y), float_to_half(value.z), 0 };
+		memcpy(dst, half, size);
+	}
+	static value_type unpack(const unsigned char * src)
+	{
+		uint16_t half[4];
+		memcpy(half, src, size);
+		return value_type(half_to_float(half[0]), half_to_float(half[1]), half_to_float(half[2]));
+	}
+};
+
+// Four half floats
+struct attrib_half4
+{
+	typedef glm::vec4 value_type;
+	static const size_t size = 4 * sizeof(uint16_t);
+	static const int components = 4;
+	static const GLenum type = GL_HALF_FLOAT;
+	static const GLboolean normalized = GL_FALSE;
+	static const bool is_plain = false;
+	static void pack(unsigned char * dst, const value_type & value)
+	{
+		uint16_t half[4] = { float_to_half(value.x), float_to_half(value.y), float_to_half(value.z), float_to_half(value.w) };
+		memcpy(dst, half, size);
+	}
+	static value_type unpack(const unsigned char * src)
+	{
+		uint16_t half[4];
+		memcpy(half, src, size);
+		return value_type(half_to_float(half[0]), half_to_float(half[1]), half_to_float(half[2]), half_to_float(half[3]));
+	}
+};
+
+// Signed normalized 10:10:10:2 bits (GL_INT_2_10_10_10_REV), for unit
+// normals, the shader sees (x, y, z, 0)
+struct attrib_snorm10
+{
+	typedef glm::vec3 value_type;
+	static const size_t size = sizeof(uint32_t);
+	static const int components = 4;
+	static const GLenum type = GL_INT_2_10_10_10_REV;
+	static const GLboolean normalized = GL_TRUE;
+	static const bool is_plain = false;
+	static uint32_t to_bits(float value)
+	{
+		value = value < -1.f ? -1.f : value > 1.f ? 1.f : value;
+		int32_t scaled = (int32_t)(value * 511.f + (value < 0.f ? -0.5f : 0.5f));
+		return (uint32_t)scaled & 0x3ffu;
+	}
+	static float from_bits(uint32_t bits)
+	{
+		// Sign extend the 10 bits
+		int32_t scaled = (int32_t)(bits << 22) >> 22;
+		float value = scaled / 511.f;
+		return value < -1.f ? -1.f : value;
+	}
+	static void pack(unsigned char * dst, const value_type & value)
+	{
+		uint32_t bits = to_bits(value.x) | (to_bits(value.y) << 10) | (to_bits(value.z) << 20);
+		memcpy(dst, &bits, size);
+	}
+	static value_type unpack(const unsigned char * src)
+	{
+		uint32_t bits;
+		memcpy(&bits, src, size);
+		return value_type(from_bits(bits), from_bits(bits >> 10), from_bits(bits >> 20));
+	}
+};
+
+// Four unsigned normalized bytes, for colors in [0, 1]
+struct attrib_unorm8x4
+{
+	typedef glm::vec4 value_type;
+	static const size_t size = 4;
+	static const int components = 4;
+	static const GLenum type = GL_UNSIGNED_BYTE;
+	static const GLboolean normalized = GL_TRUE;
+	static const bool is_plain = false;
+	static void pack(unsigned char * dst, const value_type & value)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			float c = value[i] < 0.f ? 0.f : value[i] > 1.f ? 1.f : value[i];
+			dst[i] = (unsigned char)(c * 255.f + 0.5f);
+		}
+	}
+	static value_type unpack(const unsigned char * src)
+	{
+		return value_type(src[0] / 255.f, src[1] / 255.f, src[2] / 255.f, src[3] / 255.f);
+	}
+};
+
+// Sum of the sizes of the attributes before index I
+template <size_t I, typename... Attribs>
+struct vertex_attrib_offset;
+
+template <typename First, typename... Rest>
+struct vertex_attrib_offset<0, First, Rest...>
+{
+	static const size_t value = 0;
+};
+
+template <size_t I, typename First, typename... Rest>
+struct vertex_attrib_offset<I, First, Rest...>
+{
+	static const size_t value = First::size + vertex_attrib_offset<I - 1, Rest...>::value;
+};
+
+// Sum of the sizes of all attributes
+template <typename... Attribs>
+struct vertex_attrib_size;
+
+template <>
+struct vertex_attrib_size<>
+{
+	static const size_t value = 0;
+};
+
+template <typename First, typename... Rest>
+struct vertex_attrib_size<First, Rest...>
+{
+	static const size_t value = First::size + vertex_attrib_size<Rest...>::value;
+};
+
+// Typed view of one attribute in an interleaved buffer: element i
+// starts stride bytes after element i - 1
+template <typename T>
+struct strided_view
+{
+	unsigned char * base;
+	size_t stride;
+	size_t count;
+
+	T & operator[](size_t i) const
+	{
+		return *reinterpret_cast<T *>(base + i * stride);
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+};
+
+template <typename... Attribs>
+struct vertex_layout
+{
+	// Bytes per vertex
+	static const size_t stride = vertex_attrib_size<Attribs...>::value;
+	// Number of attributes
+	static const size_t attrib_count = sizeof...(Attribs);
+
+	// Type of attribute I
+	template <size_t I>
+	struct attrib
+	{
+		typedef typename std::tuple_element<I, std::tuple<Attribs...>>::type type;
+		typedef typename type::value_type value_type;
+		static const size_t offset = vertex_attrib_offset<I, Attribs...>::value;
+	};
+
+	// Write attribute I of vertex i
+	template <size_t I>
+	static void write(void * vertices, size_t i, const typename attrib<I>::value_type & value)
+	{
+		attrib<I>::type::pack((unsigned char *)vertices + i * stride + attrib<I>::offset, value);
+	}
+
+	// Read attribute I of vertex i
+	template <size_t I>
+	static typename attrib<I>::value_type read(const void * vertices, size_t i)
+	{
+		return attrib<I>::type::unpack((const unsigned char *)vertices + i * stride + attrib<I>::offset);
+	}
+
+	// View attribute I of count vertices in place, only for attributes
+	// that store value_type as it is
+	template <size_t I>
+	static strided_view<typename attrib<I>::value_type> view(void * vertices, size_t count)
+	{
+		static_assert(attrib<I>::type::is_plain, "only plain attributes can be viewed in place, use read/write");
+		return strided_view<typename attrib<I>::value_type>{ (unsigned char *)vertices + attrib<I>::offset, stride, count };
+	}
+
+	// Describe the attributes to the bound vertex array for locations
+	// first_location.. with the bound GL_ARRAY_BUFFER
+	static void setup(GLuint first_location = 0)
+	{
+		setup_attrib<0>(first_location);
+	}
+
+private:
+	template <size_t I>
+	static typename std::enable_if<(I < sizeof...(Attribs))>::type setup_attrib(GLuint first_location)
+	{
+		typedef typename attrib<I>::type type;
+		glVertexAttribPointer(first_location + (GLuint)I, type::components, type::type, type::normalized,
+			(GLsizei)stride, (void *)attrib<I>::offset);
+		glEnableVertexAttribArray(first_location + (GLuint)I);
+		setup_attrib<I + 1>(first_location);
+	}
+
+	template <size_t I>
+	static typename std::enable_if<(I == sizeof...(Attribs))>::type setup_attrib(GLuint)
+	{
+	}
+};
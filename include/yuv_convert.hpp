@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include "thread_pool.hpp"
+
+/*
+
+Conversion of the captured RGBA frames to planar YUV 4:2:0 with the
+BT.709 matrix in limited (TV) range, so that the encoder receives
+less than half of the data and does not need to convert itself.
+
+The planes are stored one after another: Y with width x height
+samples, then U and V with ((width + 1) / 2) x ((height + 1) / 2)
+samples each. Chroma is the average of each 2x2 block, i.e. sited
+in the center of the block like "C420jpeg" in Y4M streams.
+
+ */
+
+// Size of a YUV 4:2:0 frame in bytes
+size_t yuv420p_frame_size(int width, int height);
+
+// Convert an RGBA frame to YUV 4:2:0 (BT.709, limited range), flip
+// the rows if the frame comes bottom-up from glReadPixels
+void rgba_to_yuv420p(const unsigned char * rgba, int width, int height, bool flip,
+	unsigned char * yuv, thread_pool * pool = &thread_pool::shared());
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""Compare two benchmark JSON files (benchmark_kernels --json=..., or
+Google Benchmark output) and flag regressions.
+
+    compare_benchmarks.py baseline.json results.json [--threshold 0.10]
+
+Prints the time per iteration of every benchmark in both files and the
+relative change. Exits with 1 if any benchmark got slower than the
+threshold allows or allocates more per iteration than before, so that
+it can gate a change.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    times = {}
+    allocations = {}
+    for entry in data.get("benchmarks", []):
+        # Google Benchmark also writes aggregates, keep the medians
+        if entry.get("run_type") == "aggregate" and entry.get("aggregate_name") != "median":
+            continue
+        name = entry["name"].replace("_median", "")
+        scale = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}[entry.get("time_unit", "ns")]
+        times[name] = entry["real_time"] * scale
+        if "allocs_per_iter" in entry:
+            allocations[name] = entry["allocs_per_iter"]
+    return times, allocations
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("results")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="relative slowdown that counts as a regression (default 0.10)")
+    args = parser.parse_args()
+
+    baseline, baseline_allocations = load(args.baseline)
+    results, results_allocations = load(args.results)
+
+    regressions = 0
+    print("%-40s %14s %14s %9s" % ("benchmark", "baseline [ns]", "result [ns]", "change"))
+    for name in sorted(set(baseline) | set(results)):
+        if name not in baseline or name not in results:
+            where = "baseline" if name in baseline else "results"
+            print("%-40s %39s" % (name, "only in " + where))
+            continue
+        change = results[name] / baseline[name] - 1.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif change < -args.threshold:
+            flag = "  faster"
+        if name in baseline_allocations and results_allocations.get(name, 0.0) > baseline_allocations[name]:
+            flag += "  ALLOCATES (%.3g/iter, was %.3g)" % (results_allocations[name], baseline_allocations[name])
+            regressions += 1
+        print("%-40s %14.1f %14.1f %+8.1f%%%s" % (name, baseline[name], results[name], 100.0 * change, flag))
+
+    if regressions:
+        print("%d regression(s) above %.0f%%" % (regressions, 100.0 * args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,32 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec4 color;
+// per-instance attributes: center (xyz) and radius (w) of the sphere
+// and its custom color
+layout (location = 3) in vec4 instance_center_radius;
+layout (location = 4) in vec4 instance_color;
+
+uniform mat4 view_mat;
+uniform mat4 proj_mat;
+
+out vec4 interp_color;
+out vec3 interp_normal;
+
+void main()
+{
+  vec3 world_pos = instance_center_radius.xyz + instance_center_radius.w * position;
+  gl_Position = proj_mat * view_mat * vec4(world_pos, 1.0);
+
+  if (instance_color != vec4(0)) {
+    // Use color from the instance buffer
+    interp_color = instance_color;
+  } else {
+    // Use color from the vbo
+    interp_color = color;
+  }
+
+  // Spheres are only translated and uniformly scaled, so the normal
+  // matrix is the identity.
+  interp_normal = normalize(normal);
+}
@@ -0,0 +1,264 @@
+#include "common.hpp"
+#include "perlin_noise.hpp"
+#include "terrain.hpp"
+#include "physics.hpp"
+#include "microbench.hpp"
+#include "memory_tracker.hpp"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+
+Microbenchmarks of the terrain, noise and collision kernels, each at
+the terrain resolutions 100, 1000 and 4096:
+
+    noise/get_noise             one perlin_noise::get_noise call
+    terrain/get_heights         the whole height map
+    terrain/build               vertices, normals and chunks (with the
+                                upload, like in the constructor)
+    terrain/get_normal_at_pos   one lookup
+    plane/getTriangleAt         one lookup
+    plane/isAbove               one test
+    plane/reflect               one reflection of a falling sphere
+    physics/sphere_step         one step of a sphere on the plane
+
+The heap allocations per iteration are reported too; the kernels
+that run every frame (all but get_heights and build) must not
+allocate, otherwise the run fails.
+
+    benchmark_kernels [--filter=terrain/] [--min_time=0.5]
+                      [--repetitions=3] [--json=results.json]
+
+The terrain and the plane need an OpenGL context (a hidden window),
+without one only the noise is measured. Resolution 4096 needs a few
+GB of memory, use --filter=/1000 etc. to leave it out. Compare two
+JSON files with scripts/compare_benchmarks.py, e.g. of a build with
+and one without -DENABLE_PHYSICS_COUNTERS to see what counting the
+collision events costs.
+
+ */
+
+// Size of the terrain and the seed, as in the animation
+#define BENCHMARK_TERRAIN_SIZE 8.0f
+#define BENCHMARK_SEED 1
+// Number of sample positions the lookups cycle through
+#define BENCHMARK_POINTS 4096
+
+// Runs the private terrain kernels
+struct terrain_benchmark
+{
+	static float * get_heights(terrain & terr)
+	{
+		return terr.get_heights(terr.size, 1.0);
+	}
+
+	static void release_heights(terrain & terr, float * heights)
+	{
+		memory_delete_array(memory_terrain, heights, (size_t)terr.resolution * terr.resolution);
+	}
+
+	static void build(terrain & terr)
+	{
+		terr.terra.destroy();
+		terr.build();
+	}
+
+	static void set_log_progress(terrain & terr, bool log_progress)
+	{
+		terr.log_progress = log_progress;
+	}
+};
+
+namespace
+{
+	// Whether a hidden OpenGL context could be created
+	bool has_context = false;
+
+	// A terrain and a physics plane of one resolution, created once
+	// and shared by all benchmarks of that resolution
+	struct fixture
+	{
+		std::unique_ptr<terrain> terr;
+		std::unique_ptr<phy::phyPlane> plane;
+		glm::vec3 angular_velocity;
+		// Pseudo random positions on the terrain
+		std::vector<glm::vec3> points;
+	};
+
+	std::map<long, std::unique_ptr<fixture>> fixtures;
+
+	// Positions in [-size / 2, size / 2] from a fixed LCG
+	std::vector<glm::vec3> sample_points(float size)
+	{
+		std::vector<glm::vec3> points(BENCHMARK_POINTS);
+		unsigned int state = 12345u;
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			float coords[3];
+			for (int c = 0; c < 3; c++)
+			{
+				state = state * 1664525u + 1013904223u;
+				coords[c] = (state >> 8) / 16777216.f;
+			}
+			points[i] = glm::vec3((coords[0] - 0.5f) * size * 0.999f, coords[1],
+				(coords[2] - 0.5f) * size * 0.999f);
+		}
+		return points;
+	}
+
+	// Get the fixture of a resolution, creating it on first use
+	fixture & get_fixture(long resolution)
+	{
+		std::unique_ptr<fixture> & entry = fixtures[resolution];
+		if (!entry)
+		{
+			entry.reset(new fixture());
+			entry->terr.reset(new terrain(BENCHMARK_TERRAIN_SIZE, (int)resolution, 0, 1, "mountain.jpg",
+				"grass.jpg", "snow.jpg", BENCHMARK_SEED));
+			terrain_benchmark::set_log_progress(*entry->terr, false);
+			entry->angular_velocity = glm::vec3(0.6f, 0.f, 0.f);
+			entry->plane.reset(new phy::phyPlane(-BENCHMARK_TERRAIN_SIZE / 2.f, BENCHMARK_TERRAIN_SIZE / 2.f,
+				-BENCHMARK_TERRAIN_SIZE / 2.f, BENCHMARK_TERRAIN_SIZE / 2.f, entry->terr->heights,
+				(int)resolution, (int)resolution, false, &entry->angular_velocity, nullptr));
+			entry->points = sample_points(BENCHMARK_TERRAIN_SIZE);
+		}
+		return *entry;
+	}
+
+	void bm_get_noise(benchmark_state & state)
+	{
+		int resolution = (int)state.arg();
+		perlin_noise noise(resolution, 1.0, 0.0, 1.3, BENCHMARK_SEED);
+		std::vector<glm::vec3> points = sample_points(BENCHMARK_TERRAIN_SIZE);
+		size_t i = 0;
+		while (state.keep_running())
+		{
+			const glm::vec3 & p = points[i++ % points.size()];
+			benchmark_do_not_optimize(noise.get_noise(p.x + BENCHMARK_TERRAIN_SIZE / 2.f,
+				p.z + BENCHMARK_TERRAIN_SIZE / 2.f));
+		}
+		noise.clear_gradients();
+	}
+
+	void bm_get_heights(benchmark_state & state)
+	{
+		fixture & f = get_fixture(state.arg());
+		state.set_items_per_iteration((double)state.arg() * state.arg());
+		while (state.keep_running())
+		{
+			float * heights = terrain_benchmark::get_heights(*f.terr);
+			benchmark_do_not_optimize(heights[0]);
+			terrain_benchmark::release_heights(*f.terr, heights);
+		}
+	}
+
+	void bm_build(benchmark_state & state)
+	{
+		fixture & f = get_fixture(state.arg());
+		state.set_items_per_iteration((double)state.arg() * state.arg());
+		// The upload is part of the build, so the GPU has to finish it
+		while (state.keep_running())
+		{
+			terrain_benchmark::build(*f.terr);
+			glFinish();
+		}
+	}
+
+	void bm_get_normal_at_pos(benchmark_state & state)
+	{
+		fixture & f = get_fixture(state.arg());
+		size_t i = 0;
+		while (state.keep_running())
+		{
+			const glm::vec3 & p = f.points[i++ % f.points.size()];
+			benchmark_do_not_optimize(f.terr->get_normal_at_pos(p.x, p.z));
+		}
+	}
+
+	void bm_get_triangle_at(benchmark_state & state)
+	{
+		fixture & f = get_fixture(state.arg());
+		size_t i = 0;
+		while (state.keep_running())
+		{
+			benchmark_do_not_optimize(f.plane->getTriangleAt(f.points[i++ % f.points.size()]));
+		}
+	}
+
+	void bm_is_above(benchmark_state & state)
+	{
+		fixture & f = get_fixture(state.arg());
+		size_t i = 0;
+		while (state.keep_running())
+		{
+			benchmark_do_not_optimize(f.plane->isAbove(f.points[i++ % f.points.size()]));
+		}
+	}
+
+	void bm_reflect(benchmark_state & state)
+	{
+		fixture & f = get_fixture(state.arg());
+		phy::phySphere sphere(glm::vec4(0.f), glm::vec4(0.f), 0.04f, f.plane.get(), glm::vec4(0.f), 0);
+		size_t i = 0;
+		// Resetting the sphere is part of the measured time
+		while (state.keep_running())
+		{
+			const glm::vec3 & p = f.points[i++ % f.points.size()];
+			sphere.x = glm::vec4(p.x, p.y - 0.01f, p.z, 1.f);
+			sphere.v = glm::vec4(0.1f, -1.f, 0.05f, 0.f);
+			f.plane->reflect(&sphere);
+			benchmark_do_not_optimize(sphere.v);
+		}
+	}
+
+	void bm_sphere_step(benchmark_state & state)
+	{
+		fixture & f = get_fixture(state.arg());
+		phy::phySphere sphere(glm::vec4(0.f), glm::vec4(0.f), 0.04f, f.plane.get(), glm::vec4(0.f), 0);
+		size_t i = 0;
+		// Resetting the sphere is part of the measured time
+		while (state.keep_running())
+		{
+			const glm::vec3 & p = f.points[i++ % f.points.size()];
+			sphere.plane = f.plane.get();
+			sphere.x = glm::vec4(p.x, p.y, p.z, 1.f);
+			sphere.v = glm::vec4(0.1f, -1.f, 0.05f, 0.f);
+			sphere.step(0.015f);
+			benchmark_do_not_optimize(sphere.x);
+		}
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	std::vector<long> resolutions = {100, 1000, 4096};
+	benchmark_set_allocation_counter(memory_thread_allocations);
+	benchmark_register("noise/get_noise", bm_get_noise, resolutions, true);
+
+	has_context = initOpenGLHidden(argv[0]) != nullptr;
+	if (has_context)
+	{
+		benchmark_register("terrain/get_heights", bm_get_heights, resolutions);
+		benchmark_register("terrain/build", bm_build, resolutions);
+		benchmark_register("terrain/get_normal_at_pos", bm_get_normal_at_pos, resolutions, true);
+		benchmark_register("plane/getTriangleAt", bm_get_triangle_at, resolutions, true);
+		benchmark_register("plane/isAbove", bm_is_above, resolutions, true);
+		benchmark_register("plane/reflect", bm_reflect, resolutions, true);
+		benchmark_register("physics/sphere_step", bm_sphere_step, resolutions, true);
+	}
+	else
+	{
+		fprintf(stderr, "benchmark:: no OpenGL context, only the noise is measured\n");
+	}
+
+	int result = benchmark_main(argc, argv);
+	fixtures.clear();
+	if (has_context)
+	{
+		glfwTerminate();
+	}
+	return result;
+}
@@ -1,4 +1,5 @@
 #include "after_effects.hpp"
+#include "profiler.hpp"
 
 MotionBlur::MotionBlur(int width, int height, unsigned int blur_size)
 {
@@ -21,6 +22,7 @@ MotionBlur::MotionBlur(int width, int height, unsigned int blur_size)
     {
       this->textures[i] = genTexture(width, height);
     }
+    this->newest = 0;
     this->texture_vao = genTextureVAO();
   }
   glUseProgram(current_shader);
@@ -32,13 +34,10 @@ MotionBlur::~MotionBlur()
 
 void MotionBlur::render()
 {
-  glDeleteTextures(1, this->textures + this->blur_size - 1);
-
-  for (int i = this->blur_size - 1; i > 0; i--) {
-    this->textures[i] = this->textures[i - 1];
-  }
-
-  this->textures[0] = genTexture(this->width, this->height);
+  PROFILE_SCOPE("MotionBlur::render");
+  // The oldest frame is overwritten, the textures are a ring (the
+  // blending adds them up, so their order does not matter)
+  this->newest = (this->newest + 1) % this->blur_size;
 
   int current_texture;
   int current_active_texture;
@@ -51,7 +50,7 @@ void MotionBlur::render()
   {
     // glReadBuffer(GL_BACK);//needs reset
     glActiveTexture(GL_TEXTURE0);//needs reset
-    glBindTexture(GL_TEXTURE_2D, this->textures[0]);
+    glBindTexture(GL_TEXTURE_2D, this->textures[this->newest]);
     glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, this->width, this->height);
 
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
@@ -124,6 +123,7 @@ void DepthBlur::focus(float focus)
 
 void DepthBlur::render()
 {
+  PROFILE_SCOPE("DepthBlur::render");
   int current_texture;
   int current_texture0;
   int current_texture1;
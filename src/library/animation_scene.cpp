@@ -0,0 +1,34 @@
+#include "animation_scene.hpp"
+
+// The settings of the scene with a terrain resolution and textures
+simulation_settings animation_settings(int terrain_resolution, const std::string & stone,
+	const std::string & grass, const std::string & snow)
+{
+	simulation_settings settings;
+	settings.terrain_size = TERRAIN_SIZE;
+	settings.terrain_resolution = terrain_resolution;
+	settings.terrain_frames = TERRAIN_FRAMES;
+	settings.stone = stone;
+	settings.grass = grass;
+	settings.snow = snow;
+	settings.x_spheres = X_N_SPHERES;
+	settings.z_spheres = Z_N_SPHERES;
+	settings.sphere_radius = SPHERE_RADIUS;
+	settings.sphere_drop_height = SPHERES_DROP_HEIGHT;
+	settings.sphere_appearance_frame = SPHERES_APPEARANCE_FRAME;
+	settings.sphere_release_frame = SPHERES_RELEASE_FRAME;
+	settings.sphere_time_step = SPHERES_TIME_STEP;
+	settings.seconds_per_frame = SECONDS_PER_FRAME;
+	settings.tilt_angular_velocity = glm::vec3(PLANE_TILT_ANGULAR_VELOCITY);
+	settings.tilt_start_frame = PLANE_TILT_START_FRAME;
+	settings.tilt_interval = PLANE_TILT_INTERVAL;
+	settings.tilt_end_frame = PLANE_TILT_END_FRAME;
+	settings.tilt_vertically_angular_velocity = glm::vec3(PLANE_TILT_VERTICALLY_ANGULAR_VELOCITY);
+	settings.tilt_vertically_start_frame = PLANE_TILT_VERTICALLY_START_FRAME;
+	settings.tilt_vertically_end_frame = PLANE_TILT_VERTICALLY_END_FRAME;
+	settings.drop_start_frame = PLANE_DROP_START_FRAME;
+	settings.drop_initial_velocity = glm::vec3(PLANE_DROP_INITIAL_VELOCITY);
+	settings.drop_factor = PLANE_DROP_FACTOR;
+	settings.seed = SCENE_SEED;
+	return settings;
+}
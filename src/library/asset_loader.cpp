@@ -0,0 +1,144 @@
+#include "asset_loader.hpp"
+
+// Start the workers
+asset_loader::asset_loader(int threads)
+{
+	stopping = false;
+	if (threads <= 0)
+	{
+		threads = (int)std::thread::hardware_concurrency() - 1;
+		threads = threads < 1 ? 1 : threads;
+	}
+	for (int i = 0; i < threads; i++)
+	{
+		workers.push_back(std::thread(&asset_loader::worker_loop, this));
+	}
+}
+
+// Finish the started jobs and join the workers
+asset_loader::~asset_loader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+}
+
+// Main loop of the worker threads
+void asset_loader::worker_loop()
+{
+	while (true)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			// Queued jobs are still run, a getter may wait for them
+			if (jobs.empty())
+			{
+				return;
+			}
+			job = jobs.front();
+			jobs.pop_front();
+		}
+		job();
+	}
+}
+
+// Start loading a texture
+void asset_loader::request_texture(const std::string & image_path)
+{
+	if (pending_textures.count(image_path) || textures.count(image_path))
+	{
+		return;
+	}
+	pending_textures[image_path] = post(std::function<std::shared_ptr<texture_cache>()>([image_path]() {
+		// The mip chain is built on a single core, the other workers
+		// decode the other textures in the meantime
+		thread_pool serial(1);
+		return std::make_shared<texture_cache>(image_path, &serial);
+	}));
+}
+
+// Start loading a mesh
+void asset_loader::request_mesh(const std::string & filename, bool smooth)
+{
+	std::string key = filename + (smooth ? "#smooth" : "#flat");
+	if (pending_meshes.count(key))
+	{
+		return;
+	}
+	pending_meshes[key] = post(std::function<std::vector<geometry>()>([filename, smooth]() {
+		return importScene(filename.c_str(), smooth);
+	}));
+}
+
+// Start loading a shader source
+void asset_loader::request_shader(const std::string & filename)
+{
+	if (shader_sources.count(filename))
+	{
+		return;
+	}
+	shader_sources[filename] = post(std::function<std::string()>([filename]() {
+		const char * code = loadShaderFile(filename.c_str());
+		std::string source(code);
+		delete[] code;
+		return source;
+	}));
+}
+
+// Get the GL texture of an image
+unsigned int asset_loader::texture(const std::string & image_path)
+{
+	std::map<std::string, unsigned int>::iterator uploaded = textures.find(image_path);
+	if (uploaded != textures.end())
+	{
+		return uploaded->second;
+	}
+
+	request_texture(image_path);
+	std::shared_ptr<texture_cache> cache = pending_textures[image_path].get();
+	pending_textures.erase(image_path);
+
+	// Uploading needs the context, the mapping is released afterwards
+	unsigned int handle = cache->upload();
+	textures[image_path] = handle;
+	return handle;
+}
+
+// Get the first mesh of a scene with its buffers created
+geometry asset_loader::mesh(const std::string & filename, bool smooth)
+{
+	request_mesh(filename, smooth);
+	std::vector<geometry> objects = pending_meshes[filename + (smooth ? "#smooth" : "#flat")].get();
+	geometry m = objects[0];
+	uploadGeometry(m);
+	return m;
+}
+
+// Get the source code of a shader
+std::string asset_loader::shader_source(const std::string & filename)
+{
+	request_shader(filename);
+	return shader_sources[filename].get();
+}
+
+// Compile and link a program from two shader sources
+unsigned int asset_loader::program(const std::string & vertex_filename, const std::string & fragment_filename)
+{
+	std::string vertex_source = shader_source(vertex_filename);
+	std::string fragment_source = shader_source(fragment_filename);
+	unsigned int vertexShader = compileShaderSource(vertex_source.c_str(), GL_VERTEX_SHADER);
+	unsigned int fragmentShader = compileShaderSource(fragment_source.c_str(), GL_FRAGMENT_SHADER);
+	unsigned int shaderProgram = linkProgram(vertexShader, fragmentShader);
+	// after linking the program the shader objects are no longer needed
+	glDeleteShader(fragmentShader);
+	glDeleteShader(vertexShader);
+	return shaderProgram;
+}
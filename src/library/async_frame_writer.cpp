@@ -0,0 +1,157 @@
+#include "async_frame_writer.hpp"
+#include "profiler.hpp"
+
+#include <chrono>
+#include <iostream>
+
+// Create buffer_count buffers of frame_size bytes and thread_count
+// writer threads that call write for each frame
+async_frame_writer::async_frame_writer(size_t frame_size, int buffer_count, int thread_count, write_function write)
+{
+	this->frame_size = frame_size;
+	this->write = write;
+	buffer_count = buffer_count < 1 ? 1 : buffer_count;
+	thread_count = thread_count < 1 ? 1 : thread_count;
+
+	storage.resize(frame_size * buffer_count);
+	free_buffers.reserve(buffer_count);
+	for (int i = 0; i < buffer_count; i++)
+	{
+		free_buffers.push_back(&storage[0] + i * frame_size);
+	}
+	queue.resize(buffer_count);
+
+	stats.frames_written = 0;
+	stats.max_queue_depth = 0;
+	stats.average_queue_depth = 0.0;
+	stats.stalls = 0;
+	stats.stall_seconds = 0.0;
+
+	for (int i = 0; i < thread_count; i++)
+	{
+		threads.push_back(std::thread(&async_frame_writer::writer_loop, this));
+	}
+}
+
+// Write all pending frames and stop the writer threads
+async_frame_writer::~async_frame_writer()
+{
+	flush();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	frame_queued.notify_all();
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+}
+
+// Main loop of the writer threads
+void async_frame_writer::writer_loop()
+{
+	PROFILE_THREAD_NAME("frame writer");
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		frame_queued.wait(lock, [&] { return stopping || queue_count > 0; });
+		if (queue_count == 0)
+		{
+			return;
+		}
+
+		queued_frame frame = queue[queue_head];
+		queue_head = (queue_head + 1) % (int)queue.size();
+		queue_count--;
+		writing++;
+
+		lock.unlock();
+		write(frame.buffer, frame_size, frame.frame_index);
+		lock.lock();
+
+		writing--;
+		stats.frames_written++;
+		free_buffers.push_back(frame.buffer);
+		buffer_freed.notify_one();
+		frame_written.notify_all();
+	}
+}
+
+// Get a free buffer, blocks while all buffers are in flight
+unsigned char * async_frame_writer::acquire()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (free_buffers.empty())
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		buffer_freed.wait(lock, [&] { return !free_buffers.empty(); });
+		stats.stalls++;
+		stats.stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	unsigned char * buffer = free_buffers.back();
+	free_buffers.pop_back();
+	return buffer;
+}
+
+// Queue a filled buffer for writing
+void async_frame_writer::submit(unsigned char * buffer, int frame_index)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queued_frame & frame = queue[(queue_head + queue_count) % (int)queue.size()];
+		frame.buffer = buffer;
+		frame.frame_index = frame_index;
+		queue_count++;
+
+		if (queue_count > stats.max_queue_depth)
+		{
+			stats.max_queue_depth = queue_count;
+		}
+		queue_depth_sum += queue_count;
+		submissions++;
+		stats.average_queue_depth = queue_depth_sum / submissions;
+	}
+	frame_queued.notify_one();
+}
+
+// Return an acquired buffer without writing it
+void async_frame_writer::release(unsigned char * buffer)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		free_buffers.push_back(buffer);
+	}
+	buffer_freed.notify_one();
+}
+
+// Wait until all submitted frames have been written
+void async_frame_writer::flush()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	frame_written.wait(lock, [&] { return queue_count == 0 && writing == 0; });
+}
+
+// Get the size of each frame buffer in bytes
+size_t async_frame_writer::get_frame_size() const
+{
+	return frame_size;
+}
+
+// Get the backpressure statistics
+async_frame_writer::statistics async_frame_writer::get_statistics()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+// Print the backpressure statistics
+void async_frame_writer::print_statistics(const char * name)
+{
+	statistics s = get_statistics();
+	std::cout << name << ":: frames written: " << s.frames_written
+			  << ", max queue depth: " << s.max_queue_depth
+			  << ", average queue depth: " << s.average_queue_depth
+			  << ", stalls: " << s.stalls
+			  << " (" << s.stall_seconds << " s)" << std::endl;
+}
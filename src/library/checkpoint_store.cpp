@@ -0,0 +1,115 @@
+#include "checkpoint_store.hpp"
+
+// Create a store with a checkpoint every interval frames
+checkpoint_store::checkpoint_store(int interval, size_t memory_budget)
+{
+	this->interval = interval < 1 ? 1 : interval;
+	this->memory_budget = memory_budget;
+	this->memory = 0;
+}
+
+// Memory used by a checkpoint in bytes
+size_t checkpoint_store::size_of(const simulation_snapshot & snapshot)
+{
+	return sizeof(simulation_snapshot) + snapshot.spheres.capacity() * sizeof(simulation_snapshot::sphere_state);
+}
+
+// Double the interval and drop the checkpoints in between
+void checkpoint_store::thin_out()
+{
+	interval *= 2;
+	for (auto it = checkpoints.begin(); it != checkpoints.end();)
+	{
+		// Frame 0 is always kept, it is the start of every seek
+		if (it->first % interval != 0)
+		{
+			memory -= size_of(it->second);
+			it = checkpoints.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+// Record a checkpoint if the next frame of the simulation is due
+void checkpoint_store::record(simulation & sim, const camera & cam)
+{
+	int frame = sim.get_frame();
+	if (frame % interval != 0 || checkpoints.count(frame) > 0)
+	{
+		return;
+	}
+
+	simulation_snapshot & snapshot = checkpoints[frame];
+	snapshot = sim.capture(cam);
+	memory += size_of(snapshot);
+
+	while (memory > memory_budget && checkpoints.size() > 1)
+	{
+		thin_out();
+	}
+}
+
+// Get the latest checkpoint at or before frame
+const simulation_snapshot * checkpoint_store::nearest(int frame) const
+{
+	auto it = checkpoints.upper_bound(frame);
+	if (it == checkpoints.begin())
+	{
+		return nullptr;
+	}
+	--it;
+	return &it->second;
+}
+
+// Continue the simulation at frame
+int checkpoint_store::seek(simulation & sim, camera & cam, int frame)
+{
+	// Going forward from the current state may be shorter
+	const simulation_snapshot * checkpoint = nearest(frame);
+	bool forward = sim.get_frame() <= frame && (!checkpoint || checkpoint->frame <= sim.get_frame());
+	if (!forward)
+	{
+		if (!checkpoint || !sim.restore(*checkpoint, cam))
+		{
+			return -1;
+		}
+	}
+
+	// Simulate the remaining frames, recording checkpoints on the way
+	int simulated = 0;
+	while (sim.get_frame() < frame)
+	{
+		record(sim, cam);
+		sim.fast_forward(sim.get_frame() + 1, cam);
+		simulated++;
+	}
+	return simulated;
+}
+
+// Drop all checkpoints
+void checkpoint_store::clear()
+{
+	checkpoints.clear();
+	memory = 0;
+}
+
+// Get the current interval between checkpoints
+int checkpoint_store::get_interval() const
+{
+	return interval;
+}
+
+// Get the number of checkpoints
+int checkpoint_store::get_count() const
+{
+	return (int)checkpoints.size();
+}
+
+// Get the memory used by the checkpoints in bytes
+size_t checkpoint_store::get_memory() const
+{
+	return memory;
+}
@@ -0,0 +1,391 @@
+#include "cpu_after_effects.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CPU_EFFECTS_USE_SSE2
+#endif
+
+// Rows per chunk when splitting a frame across threads
+#define CPU_EFFECTS_ROW_GRAIN 16
+
+// Edge length of the depth of field tiles in pixels (even)
+#define DEPTH_BLUR_TILE 16
+// Blur radius in pixels below which a pixel is in focus
+#define DEPTH_BLUR_IN_FOCUS 0.5f
+// Minimum blur radius in pixels of a tile to gather at half resolution
+#define DEPTH_BLUR_REDUCED 6.0f
+// Number of samples of the Poisson disk
+#define DEPTH_BLUR_TAPS 64
+
+// Tile classes
+#define DEPTH_BLUR_SKIP 0
+#define DEPTH_BLUR_FULL 1
+#define DEPTH_BLUR_REDUCED_RES 2
+
+namespace {
+  // Same distribution as in depth_blur.frag
+  const float poisson_disk[DEPTH_BLUR_TAPS][2] = {
+    {-0.613392f, 0.617481f}, {0.170019f, -0.040254f}, {-0.299417f, 0.791925f}, {0.645680f, 0.493210f},
+    {-0.651784f, 0.717887f}, {0.421003f, 0.027070f}, {-0.817194f, -0.271096f}, {-0.705374f, -0.668203f},
+    {0.977050f, -0.108615f}, {0.063326f, 0.142369f}, {0.203528f, 0.214331f}, {-0.667531f, 0.326090f},
+    {-0.098422f, -0.295755f}, {-0.885922f, 0.215369f}, {0.566637f, 0.605213f}, {0.039766f, -0.396100f},
+    {0.751946f, 0.453352f}, {0.078707f, -0.715323f}, {-0.075838f, -0.529344f}, {0.724479f, -0.580798f},
+    {0.222999f, -0.215125f}, {-0.467574f, -0.405438f}, {-0.248268f, -0.814753f}, {0.354411f, -0.887570f},
+    {0.175817f, 0.382366f}, {0.487472f, -0.063082f}, {-0.084078f, 0.898312f}, {0.488876f, -0.783441f},
+    {0.470016f, 0.217933f}, {-0.696890f, -0.549791f}, {-0.149693f, 0.605762f}, {0.034211f, 0.979980f},
+    {0.503098f, -0.308878f}, {-0.016205f, -0.872921f}, {0.385784f, -0.393902f}, {-0.146886f, -0.859249f},
+    {0.643361f, 0.164098f}, {0.634388f, -0.049471f}, {-0.688894f, 0.007843f}, {0.464034f, -0.188818f},
+    {-0.440840f, 0.137486f}, {0.364483f, 0.511704f}, {0.034028f, 0.325968f}, {0.099094f, -0.308023f},
+    {0.693960f, -0.366253f}, {0.678884f, -0.204688f}, {0.001801f, 0.780328f}, {0.145177f, -0.898984f},
+    {0.062655f, -0.611866f}, {0.315226f, -0.604297f}, {-0.780145f, 0.486251f}, {-0.371868f, 0.882138f},
+    {0.200476f, 0.494430f}, {-0.494552f, -0.711051f}, {0.612476f, 0.705252f}, {-0.578845f, -0.768792f},
+    {-0.772454f, -0.090976f}, {0.504440f, 0.372295f}, {0.155736f, 0.065157f}, {0.391522f, 0.849605f},
+    {-0.620106f, -0.328104f}, {0.789239f, -0.419965f}, {-0.545396f, 0.538133f}, {-0.178564f, -0.596057f}
+  };
+
+  // Average of the pixel at (x, y) of the w x h image @img and the
+  // Poisson disk samples around it with the radii (rx, ry) in pixels,
+  // written to @out (4 floats). Small disks cover only a few pixels,
+  // so they use only the first 16 or 32 samples of the disk.
+  inline void
+  poisson_gather(const unsigned char *img, int w, int h, int x, int y,
+                 float rx, float ry, float *out) {
+    float radius = std::max(rx, ry);
+    int taps = radius < 2.f ? DEPTH_BLUR_TAPS / 4 : (radius < 4.f ? DEPTH_BLUR_TAPS / 2 : DEPTH_BLUR_TAPS);
+    const unsigned char *center = img + ((size_t)y * w + x) * 4;
+    uint32_t r = center[0], g = center[1], b = center[2], a = center[3];
+    for (int k = 0; k < taps; k++) {
+      int sx = (int)floorf(x + 0.5f + poisson_disk[k][0] * rx);
+      int sy = (int)floorf(y + 0.5f + poisson_disk[k][1] * ry);
+      sx = sx < 0 ? 0 : (sx >= w ? w - 1 : sx);
+      sy = sy < 0 ? 0 : (sy >= h ? h - 1 : sy);
+      const unsigned char *p = img + ((size_t)sy * w + sx) * 4;
+      r += p[0];
+      g += p[1];
+      b += p[2];
+      a += p[3];
+    }
+    const float norm = 1.f / (taps + 1);
+    out[0] = r * norm;
+    out[1] = g * norm;
+    out[2] = b * norm;
+    out[3] = a * norm;
+  }
+
+  // Motion blur kernel for the bytes [begin, end) of a frame: remove
+  // the oldest frame from the running sum (if @subtract), add the new
+  // one, store the new one in the ring buffer and write the average
+  // of @count frames back to @rgba.
+  void
+  motion_blur_span(unsigned char *rgba, unsigned char *slot, uint16_t *sum,
+                   size_t begin, size_t end, bool subtract, unsigned int count) {
+    size_t i = begin;
+    // 16 bit fixed point reciprocal of count, rounded up. Together with
+    // the rounding offset the result is exact or one too large, which
+    // reaches 256 for a white pixel with some counts (e.g. 151), so it
+    // is clamped to 255 (packus saturates). sum + half never overflows
+    // for count <= 256.
+    uint16_t half = (uint16_t)(count / 2);
+    uint16_t recip = (uint16_t)((65536 + count - 1) / count);
+
+#ifdef CPU_EFFECTS_USE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half_v = _mm_set1_epi16((short)half);
+    const __m128i recip_v = _mm_set1_epi16((short)recip);
+    for (; i + 16 <= end; i += 16) {
+      __m128i in = _mm_loadu_si128((const __m128i *)(rgba + i));
+      __m128i s0 = _mm_loadu_si128((const __m128i *)(sum + i));
+      __m128i s1 = _mm_loadu_si128((const __m128i *)(sum + i + 8));
+      if (subtract) {
+        __m128i old = _mm_loadu_si128((const __m128i *)(slot + i));
+        s0 = _mm_sub_epi16(s0, _mm_unpacklo_epi8(old, zero));
+        s1 = _mm_sub_epi16(s1, _mm_unpackhi_epi8(old, zero));
+      }
+      s0 = _mm_add_epi16(s0, _mm_unpacklo_epi8(in, zero));
+      s1 = _mm_add_epi16(s1, _mm_unpackhi_epi8(in, zero));
+      _mm_storeu_si128((__m128i *)(sum + i), s0);
+      _mm_storeu_si128((__m128i *)(sum + i + 8), s1);
+      _mm_storeu_si128((__m128i *)(slot + i), in);
+
+      if (count > 1) {
+        __m128i a0 = _mm_mulhi_epu16(_mm_adds_epu16(s0, half_v), recip_v);
+        __m128i a1 = _mm_mulhi_epu16(_mm_adds_epu16(s1, half_v), recip_v);
+        _mm_storeu_si128((__m128i *)(rgba + i), _mm_packus_epi16(a0, a1));
+      }
+    }
+#endif // CPU_EFFECTS_USE_SSE2
+
+    for (; i < end; i++) {
+      if (subtract) {
+        sum[i] -= slot[i];
+      }
+      sum[i] += rgba[i];
+      slot[i] = rgba[i];
+      if (count > 1) {
+        rgba[i] = (unsigned char)std::min<uint32_t>(((uint32_t)(sum[i] + half) * recip) >> 16, 255u);
+      }
+    }
+  }
+}
+
+CpuMotionBlur::CpuMotionBlur(int width, int height, unsigned int blur_size, thread_pool *pool)
+{
+  if (blur_size < 1 || blur_size > 256) {
+    std::cerr << "CpuMotionBlur: blur_size must be in [1, 256], clamping " << blur_size << "\n";
+    blur_size = std::min(std::max(blur_size, 1u), 256u);
+  }
+
+  this->width = width;
+  this->height = height;
+  this->blur_size = blur_size;
+  this->pool = pool;
+
+  size_t frame_bytes = (size_t)width * height * 4;
+  this->frames.resize(frame_bytes * blur_size);
+  this->sum.resize(frame_bytes);
+  reset();
+}
+
+void CpuMotionBlur::reset()
+{
+  std::fill(this->sum.begin(), this->sum.end(), 0);
+  this->next_slot = 0;
+  this->filled = 0;
+}
+
+void CpuMotionBlur::apply(unsigned char *rgba, const float *)
+{
+  size_t row_bytes = (size_t)this->width * 4;
+  unsigned char *slot = &this->frames[this->next_slot * row_bytes * this->height];
+  uint16_t *sum = &this->sum[0];
+  // Once the ring buffer is full, the new frame replaces the oldest
+  bool subtract = this->filled == this->blur_size;
+  unsigned int count = subtract ? this->blur_size : this->filled + 1;
+
+  this->pool->parallel_for(0, this->height, CPU_EFFECTS_ROW_GRAIN, [&](int row_begin, int row_end) {
+      motion_blur_span(rgba, slot, sum, row_begin * row_bytes, row_end * row_bytes, subtract, count);
+    });
+
+  this->next_slot = (this->next_slot + 1) % this->blur_size;
+  this->filled = count;
+}
+
+
+CpuDepthBlur::CpuDepthBlur(int width, int height, float near_v, float far_v, float blur, float focus,
+                           thread_pool *pool)
+{
+  this->width = width;
+  this->height = height;
+  this->near_v = near_v;
+  this->far_v = far_v;
+  this->blur_v = blur;
+  this->focus_v = focus;
+  this->pool = pool;
+
+  this->source.resize((size_t)width * height * 4);
+  this->half.resize((size_t)(width / 2 + 1) * (height / 2 + 1) * 4);
+  this->coc.resize((size_t)width * height);
+  this->tiles_x = (width + DEPTH_BLUR_TILE - 1) / DEPTH_BLUR_TILE;
+  this->tiles_y = (height + DEPTH_BLUR_TILE - 1) / DEPTH_BLUR_TILE;
+  this->tile_class.resize(this->tiles_x * this->tiles_y);
+  this->skipped_tiles = 0;
+  this->full_tiles = 0;
+  this->reduced_tiles = 0;
+}
+
+void CpuDepthBlur::blur(float blur)
+{
+  this->blur_v = blur;
+}
+
+void CpuDepthBlur::focus(float focus)
+{
+  this->focus_v = focus;
+}
+
+// Compute the circle of confusion of all pixels of the tiles
+// [tile_begin, tile_end) and classify the tiles by its range
+void CpuDepthBlur::classify_tiles(int tile_begin, int tile_end, const float *depth)
+{
+  float n = this->near_v;
+  float f = this->far_v;
+  // The horizontal radius is the larger one for landscape frames
+  float to_pixels = (float)std::max(this->width, this->height);
+
+  for (int tile = tile_begin; tile < tile_end; tile++) {
+    int x0 = (tile % this->tiles_x) * DEPTH_BLUR_TILE;
+    int y0 = (tile / this->tiles_x) * DEPTH_BLUR_TILE;
+    int x1 = std::min(x0 + DEPTH_BLUR_TILE, this->width);
+    int y1 = std::min(y0 + DEPTH_BLUR_TILE, this->height);
+
+    float min_coc = 1e30f;
+    float max_coc = 0.f;
+    for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x++) {
+        size_t i = (size_t)y * this->width + x;
+        // Same as depth_blur.frag: linearized depth relative to the
+        // focus, the radius grows quadratically with the distance
+        float z = (2.f * n) / (f + n - depth[i] * (f - n)) - this->focus_v;
+        float c = this->blur_v * z * z;
+        this->coc[i] = c;
+        min_coc = std::min(min_coc, c);
+        max_coc = std::max(max_coc, c);
+      }
+    }
+
+    if (max_coc * to_pixels < DEPTH_BLUR_IN_FOCUS) {
+      this->tile_class[tile] = DEPTH_BLUR_SKIP;
+    } else if (min_coc * to_pixels >= DEPTH_BLUR_REDUCED) {
+      this->tile_class[tile] = DEPTH_BLUR_REDUCED_RES;
+    } else {
+      this->tile_class[tile] = DEPTH_BLUR_FULL;
+    }
+  }
+}
+
+// Box filter the rows [row_begin, row_end) of the half resolution copy
+void CpuDepthBlur::downsample_rows(int row_begin, int row_end)
+{
+  int half_w = this->width / 2;
+  for (int y = row_begin; y < row_end; y++) {
+    const unsigned char *row0 = &this->source[(size_t)(2 * y) * this->width * 4];
+    const unsigned char *row1 = &this->source[(size_t)std::min(2 * y + 1, this->height - 1) * this->width * 4];
+    unsigned char *out = &this->half[(size_t)y * half_w * 4];
+    for (int x = 0; x < half_w; x++) {
+      for (int c = 0; c < 4; c++) {
+        out[x * 4 + c] = (unsigned char)((row0[8 * x + c] + row0[8 * x + 4 + c]
+                                          + row1[8 * x + c] + row1[8 * x + 4 + c] + 2) / 4);
+      }
+    }
+  }
+}
+
+// Gather every pixel of a tile that is not in focus at full resolution
+void CpuDepthBlur::gather_full(int tile, unsigned char *rgba)
+{
+  int x0 = (tile % this->tiles_x) * DEPTH_BLUR_TILE;
+  int y0 = (tile / this->tiles_x) * DEPTH_BLUR_TILE;
+  int x1 = std::min(x0 + DEPTH_BLUR_TILE, this->width);
+  int y1 = std::min(y0 + DEPTH_BLUR_TILE, this->height);
+  float max_size = (float)std::max(this->width, this->height);
+
+  for (int y = y0; y < y1; y++) {
+    for (int x = x0; x < x1; x++) {
+      size_t i = (size_t)y * this->width + x;
+      float c = this->coc[i];
+      if (c * max_size < DEPTH_BLUR_IN_FOCUS) {
+        continue;
+      }
+      float color[4];
+      poisson_gather(&this->source[0], this->width, this->height, x, y,
+                     c * this->width, c * this->height, color);
+      for (int k = 0; k < 4; k++) {
+        rgba[i * 4 + k] = (unsigned char)(color[k] + 0.5f);
+      }
+    }
+  }
+}
+
+// Gather a tile at half resolution and upsample it bilinearly
+void CpuDepthBlur::gather_reduced(int tile, unsigned char *rgba)
+{
+  const int half_tile = DEPTH_BLUR_TILE / 2;
+  // Half resolution samples of the tile plus a border of one sample
+  float samples[half_tile + 2][half_tile + 2][4];
+
+  int half_w = this->width / 2;
+  int half_h = this->height / 2;
+  int x0 = (tile % this->tiles_x) * DEPTH_BLUR_TILE;
+  int y0 = (tile / this->tiles_x) * DEPTH_BLUR_TILE;
+  int x1 = std::min(x0 + DEPTH_BLUR_TILE, this->width);
+  int y1 = std::min(y0 + DEPTH_BLUR_TILE, this->height);
+  int hx0 = x0 / 2 - 1;
+  int hy0 = y0 / 2 - 1;
+
+  for (int j = 0; j < half_tile + 2; j++) {
+    int hy = std::min(std::max(hy0 + j, 0), half_h - 1);
+    for (int i = 0; i < half_tile + 2; i++) {
+      int hx = std::min(std::max(hx0 + i, 0), half_w - 1);
+      float c = this->coc[(size_t)(2 * hy) * this->width + 2 * hx];
+      poisson_gather(&this->half[0], half_w, half_h, hx, hy,
+                     c * half_w, c * half_h, samples[j][i]);
+    }
+  }
+
+  for (int y = y0; y < y1; y++) {
+    // Position of the pixel center in the sample grid
+    float v = (y + 0.5f) * 0.5f - 0.5f - hy0;
+    int j = std::min(std::max((int)floorf(v), 0), half_tile);
+    float fy = std::min(std::max(v - j, 0.f), 1.f);
+    for (int x = x0; x < x1; x++) {
+      float u = (x + 0.5f) * 0.5f - 0.5f - hx0;
+      int i = std::min(std::max((int)floorf(u), 0), half_tile);
+      float fx = std::min(std::max(u - i, 0.f), 1.f);
+      unsigned char *out = rgba + ((size_t)y * this->width + x) * 4;
+      for (int k = 0; k < 4; k++) {
+        float top = samples[j][i][k] + fx * (samples[j][i + 1][k] - samples[j][i][k]);
+        float bottom = samples[j + 1][i][k] + fx * (samples[j + 1][i + 1][k] - samples[j + 1][i][k]);
+        out[k] = (unsigned char)(top + fy * (bottom - top) + 0.5f);
+      }
+    }
+  }
+}
+
+void CpuDepthBlur::apply(unsigned char *rgba, const float *depth)
+{
+  int n_tiles = this->tiles_x * this->tiles_y;
+  memcpy(&this->source[0], rgba, this->source.size());
+
+  this->pool->parallel_for(0, n_tiles, this->tiles_x, [&](int begin, int end) {
+      classify_tiles(begin, end, depth);
+    });
+
+  this->skipped_tiles = 0;
+  this->full_tiles = 0;
+  this->reduced_tiles = 0;
+  for (int t = 0; t < n_tiles; t++) {
+    switch (this->tile_class[t]) {
+    case DEPTH_BLUR_SKIP: this->skipped_tiles++; break;
+    case DEPTH_BLUR_FULL: this->full_tiles++; break;
+    default: this->reduced_tiles++; break;
+    }
+  }
+
+  if (this->reduced_tiles > 0) {
+    this->pool->parallel_for(0, this->height / 2, CPU_EFFECTS_ROW_GRAIN, [&](int begin, int end) {
+        downsample_rows(begin, end);
+      });
+  }
+
+  if (this->full_tiles + this->reduced_tiles > 0) {
+    this->pool->parallel_for(0, n_tiles, 1, [&](int begin, int end) {
+        for (int t = begin; t < end; t++) {
+          if (this->tile_class[t] == DEPTH_BLUR_FULL) {
+            gather_full(t, rgba);
+          } else if (this->tile_class[t] == DEPTH_BLUR_REDUCED_RES) {
+            gather_reduced(t, rgba);
+          }
+        }
+      });
+  }
+}
+
+int CpuDepthBlur::get_skipped_tiles() const
+{
+  return this->skipped_tiles;
+}
+
+int CpuDepthBlur::get_full_tiles() const
+{
+  return this->full_tiles;
+}
+
+int CpuDepthBlur::get_reduced_tiles() const
+{
+  return this->reduced_tiles;
+}
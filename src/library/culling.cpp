@@ -0,0 +1,225 @@
+#include "culling.hpp"
+
+#include <cfloat>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULLING_USE_SSE
+#endif
+
+// Create a frustum that contains everything
+frustum::frustum()
+{
+	for (int i = 0; i < 6; i++)
+	{
+		planes[i] = glm::vec4(0.0, 0.0, 0.0, 1.0);
+	}
+}
+
+// Create the frustum of proj_matrix * view_matrix
+frustum::frustum(glm::mat4 view_proj)
+{
+	set(view_proj);
+}
+
+// Extract the planes of proj_matrix * view_matrix
+// (Gribb & Hartmann, "Fast Extraction of Viewing Frustum Planes
+// from the World-View-Projection Matrix")
+void frustum::set(glm::mat4 view_proj)
+{
+	// glm matrices are column major, m[column][row]
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+	{
+		rows[i] = glm::vec4(view_proj[0][i], view_proj[1][i], view_proj[2][i], view_proj[3][i]);
+	}
+
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	planes[4] = rows[3] + rows[2];
+	planes[5] = rows[3] - rows[2];
+
+	// Normalize, so that dot(plane, (p,1)) is the signed distance
+	for (int i = 0; i < 6; i++)
+	{
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+}
+
+// Get one of the six planes
+const glm::vec4 & frustum::get_plane(int index) const
+{
+	return planes[index];
+}
+
+// Check whether a sphere is at least partially inside
+bool frustum::contains_sphere(glm::vec3 center, float radius) const
+{
+	for (int i = 0; i < 6; i++)
+	{
+		if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Check whether an axis aligned box is at least partially inside
+bool frustum::contains_box(glm::vec3 box_min, glm::vec3 box_max) const
+{
+	return contains_box(box_min, box_max, glm::mat4(1.0));
+}
+
+// Check whether an axis aligned box transformed by model_mat is at
+// least partially inside
+bool frustum::contains_box(glm::vec3 box_min, glm::vec3 box_max, const glm::mat4 & model_mat) const
+{
+	// Transform center and half extent of the box (Arvo), the result
+	// is the world space box that encloses the transformed box
+	glm::vec3 center = glm::vec3(model_mat * glm::vec4(0.5f * (box_min + box_max), 1.0));
+	glm::vec3 half = 0.5f * (box_max - box_min);
+	glm::vec3 extent;
+	for (int i = 0; i < 3; i++)
+	{
+		extent[i] = fabs(model_mat[0][i]) * half.x
+			+ fabs(model_mat[1][i]) * half.y
+			+ fabs(model_mat[2][i]) * half.z;
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		glm::vec3 normal = glm::vec3(planes[i]);
+		float r = glm::dot(glm::abs(normal), extent);
+		if (glm::dot(normal, center) + planes[i].w < -r)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Create a new instance of sphere_culler
+sphere_culler::sphere_culler(int capacity)
+{
+	grow(capacity);
+}
+
+// Make sure that n spheres plus padding fit without reallocating
+void sphere_culler::grow(int n)
+{
+	int padded = (n + 3) & ~3;
+	if ((int)xs.size() >= padded)
+	{
+		return;
+	}
+	xs.resize(padded);
+	ys.resize(padded);
+	zs.resize(padded);
+	radii.resize(padded);
+	indices.resize(padded);
+	visible.resize(padded);
+}
+
+// Remove all spheres
+void sphere_culler::clear()
+{
+	count = 0;
+}
+
+// Add a sphere, index is reported back if the sphere is visible
+void sphere_culler::add(glm::vec3 center, float radius, int index)
+{
+	grow(count + 1);
+	xs[count] = center.x;
+	ys[count] = center.y;
+	zs[count] = center.z;
+	radii[count] = radius;
+	indices[count] = index;
+	count++;
+}
+
+// Test all spheres against the frustum
+void sphere_culler::cull(const frustum & f)
+{
+	visible_count = 0;
+
+	// Pad the last batch with spheres that can never be visible
+	int padded = (count + 3) & ~3;
+	for (int i = count; i < padded; i++)
+	{
+		xs[i] = ys[i] = zs[i] = 0.0;
+		radii[i] = -FLT_MAX;
+	}
+
+#ifdef CULLING_USE_SSE
+	__m128 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+	for (int p = 0; p < 6; p++)
+	{
+		plane_x[p] = _mm_set1_ps(f.get_plane(p).x);
+		plane_y[p] = _mm_set1_ps(f.get_plane(p).y);
+		plane_z[p] = _mm_set1_ps(f.get_plane(p).z);
+		plane_w[p] = _mm_set1_ps(f.get_plane(p).w);
+	}
+
+	for (int i = 0; i < padded; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&xs[i]);
+		__m128 y = _mm_loadu_ps(&ys[i]);
+		__m128 z = _mm_loadu_ps(&zs[i]);
+		__m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radii[i]));
+
+		// A sphere is visible if its signed distance to every plane
+		// is at least -radius
+		__m128 inside = _mm_cmpge_ps(
+			_mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x[0], x), _mm_mul_ps(plane_y[0], y)),
+					   _mm_add_ps(_mm_mul_ps(plane_z[0], z), plane_w[0])),
+			neg_r);
+		for (int p = 1; p < 6; p++)
+		{
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x[p], x), _mm_mul_ps(plane_y[p], y)),
+								  _mm_add_ps(_mm_mul_ps(plane_z[p], z), plane_w[p]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(d, neg_r));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (int j = 0; mask != 0; j++, mask >>= 1)
+		{
+			if (mask & 1)
+			{
+				visible[visible_count++] = indices[i + j];
+			}
+		}
+	}
+#else
+	for (int i = 0; i < count; i++)
+	{
+		if (f.contains_sphere(glm::vec3(xs[i], ys[i], zs[i]), radii[i]))
+		{
+			visible[visible_count++] = indices[i];
+		}
+	}
+#endif // CULLING_USE_SSE
+
+	culled_count = count - visible_count;
+}
+
+// Indices of the visible spheres of the last cull()
+const int * sphere_culler::get_visible() const
+{
+	return visible.data();
+}
+
+// Number of visible spheres of the last cull()
+int sphere_culler::get_visible_count() const
+{
+	return visible_count;
+}
+
+// Number of culled spheres of the last cull()
+int sphere_culler::get_culled_count() const
+{
+	return culled_count;
+}
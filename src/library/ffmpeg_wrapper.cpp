@@ -1,61 +1,553 @@
 #include "ffmpeg_wrapper.hpp"
+#include "profiler.hpp"
+
+#include <cstring>
+
+// Seconds the renderer waits for the shared memory consumer to
+// release a slot before it gives up on the consumer
+#define SHM_CONSUMER_TIMEOUT 30.0
 
 // Create a new ffmpeg_wrapper instance
-ffmpeg_wrapper::ffmpeg_wrapper(int width, int height, int frames, char * render_filename)
+ffmpeg_wrapper::ffmpeg_wrapper(int width, int height, int frames, char * render_filename, int buffer_count, output_format format)
 {
 	// Set properties
 	this->width = width;
 	this->height = height;
 	this->frames = frames;
 	this->frame_counter = 0;
+	this->next_pbo = 0;
+	this->format = format;
+	this->writer = nullptr;
+	this->ring = nullptr;
+	this->ffmpeg = nullptr;
+	this->thumbnail_width = 0;
+	this->thumbnail_height = 0;
+	this->thumbnail_interval = 0;
+	this->thumbnail_columns = 0;
+	this->thumbnail_count = 0;
+	this->thumbnail_scaler = nullptr;
+
+	// Frames go to an external consumer through shared memory, the
+	// filename is the name of the shared memory object
+	if (format == output_shm)
+	{
+		ring = new shm_frame_ring(render_filename, width, height, buffer_count);
+		if (ring->is_valid())
+		{
+			std::cerr << "ffmpeg_wrapper:: frames are written to shared memory " << render_filename
+					  << ", e.g. shm_frame_consumer " << render_filename
+					  << " --y4m | ffmpeg -f yuv4mpegpipe -i - out.mp4\n";
+			return;
+		}
+
+		std::cerr << "ffmpeg_wrapper:: no shared memory transport, frames are discarded\n";
+		discard_frames(buffer_count);
+		return;
+	}
+
+	writer = open_output(width, height, render_filename, format, buffer_count, &ffmpeg, &yuv_frame);
+}
+
+// Start ffmpeg or an image sequence writer for an output
+async_frame_writer * ffmpeg_wrapper::open_output(int width, int height, const char * filename, output_format format,
+	int buffer_count, FILE ** pipe_out, tracked_vector<unsigned char, memory_capture> * yuv_frame)
+{
+	*pipe_out = nullptr;
+
+	// Frames are encoded as numbered image files by a pool of writer
+	// threads, buffer_count bounds the frames in flight
+	if (format == output_png || format == output_qoi || format == output_raw_images)
+	{
+		image_format image = format == output_png ? image_png : format == output_qoi ? image_qoi : image_raw;
+		std::string pattern = FFMPEG_ROOT + std::string(filename);
+		if (pattern.find('%') == std::string::npos)
+		{
+			pattern += std::string("_%05d.") + image_format_extension(image);
+		}
+
+		// The render thread keeps one core busy
+		int thread_count = (int)std::thread::hardware_concurrency() - 1;
+		thread_count = thread_count < 1 ? 1 : thread_count;
+		buffer_count = buffer_count < thread_count + 1 ? thread_count + 1 : buffer_count;
+		return new async_frame_writer(sizeof(int) * width * height, buffer_count, thread_count,
+			[width, height, image, pattern](const unsigned char * data, size_t, int frame_index) {
+				std::string path = image_sequence_path(pattern, frame_index);
+				if (!write_image(path, image, data, width, height, true))
+				{
+					std::cerr << "ffmpeg_wrapper:: cannot write " << path << "\n";
+				}
+			});
+	}
+
+	// The Y4M stream carries the frame size, the frame rate and the
+	// chroma layout, the tags tell the encoder which matrix was used
+	std::string input_args = format == output_y4m
+		? std::string("-f yuv4mpegpipe -i - ")
+		: "-r 60 -f rawvideo -pix_fmt rgba -s " + std::to_string(width) + "x" + std::to_string(height) + " -i - ";
+	std::string output_args = format == output_y4m
+		? std::string("-colorspace bt709 -color_primaries bt709 -color_trc bt709 -color_range tv ")
+		: std::string("-pix_fmt yuv420p -vf vflip ");
 
 	// Distinguish between linux and windows
 	// and call ffmpeg accordingly
     #ifdef __linux__
-	std::string cmd = "ffmpeg -r 60 -f rawvideo -pix_fmt rgba -s "
-	  + std::to_string(width) + "x" + std::to_string(height) + " -i - "
-	  + "-threads 0 -preset fast -y -pix_fmt yuv420p -crf 21 -vf vflip "
-	  + FFMPEG_ROOT + std::string(render_filename);
-        ffmpeg = popen(cmd.c_str(), "w");
+	std::string cmd = "ffmpeg " + input_args
+	  + "-threads 0 -preset fast -y " + output_args + "-crf 21 "
+	  + FFMPEG_ROOT + std::string(filename);
+	FILE * pipe = popen(cmd.c_str(), "w");
     #else
-	std::string cmd = std::string("\"") + FFMPEG_ROOT + std::string("ffmpeg.exe\" -r 60 -f rawvideo -pix_fmt rgba -s " + std::to_string(width) + "x" + std::to_string(height) + " -i - "
-		"-threads 0 -preset fast -y -pix_fmt yuv420p -crf 15 -vf vflip ") + FFMPEG_ROOT + std::string(render_filename);
-	ffmpeg = _popen(cmd.c_str(), "wb");
+	std::string cmd = std::string("\"") + FFMPEG_ROOT + std::string("ffmpeg.exe\" ") + input_args
+		+ "-threads 0 -preset fast -y " + output_args + "-crf 15 " + FFMPEG_ROOT + std::string(filename);
+	FILE * pipe = _popen(cmd.c_str(), "wb");
     #endif
 
     // Check if the handle has been created
-	if (!ffmpeg) {
+	if (!pipe) {
 	  std::cerr << "Error starting ffmpeg process!\n";
 	}
+	*pipe_out = pipe;
+
+	// Preallocate the frame buffers and start the writer thread
+	if (format == output_y4m)
+	{
+		// Progressive 60 fps with square pixels and centered chroma
+		std::string header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height)
+			+ " F60:1 Ip A1:1 C420jpeg\n";
+		if (pipe) fwrite(header.data(), header.size(), 1, pipe);
+
+		// The writer thread converts and flips the frame on the shared
+		// thread pool, only a single writer uses the YUV buffer
+		yuv_frame->resize(yuv420p_frame_size(width, height));
+		return new async_frame_writer(sizeof(int) * width * height, buffer_count, 1,
+			[width, height, pipe, yuv_frame](const unsigned char * data, size_t, int) {
+				{
+					PROFILE_SCOPE("yuv convert");
+					rgba_to_yuv420p(data, width, height, true, yuv_frame->data());
+				}
+				if (pipe)
+				{
+					PROFILE_SCOPE("pipe write");
+					fwrite("FRAME\n", 6, 1, pipe);
+					fwrite(yuv_frame->data(), yuv_frame->size(), 1, pipe);
+				}
+			});
+	}
+	return new async_frame_writer(sizeof(int) * width * height, buffer_count, 1,
+		[pipe](const unsigned char * data, size_t size, int) {
+			PROFILE_SCOPE("pipe write");
+			if (pipe) fwrite(data, size, 1, pipe);
+		});
 }
 
-// Clear up
-ffmpeg_wrapper::~ffmpeg_wrapper()
+// Close a pipe to ffmpeg
+void ffmpeg_wrapper::close_pipe(FILE * pipe)
 {
+	if (!pipe)
+	{
+		return;
+	}
+
 	// Distinguish between linux and windows
 	// and close the file handle accordingly
     #ifdef __linux__
-	pclose(ffmpeg);
+	pclose(pipe);
     #else
-	_pclose(ffmpeg);
+	_pclose(pipe);
     #endif
 }
 
+// Clear up
+ffmpeg_wrapper::~ffmpeg_wrapper()
+{
+	// Frames left in PBOs can only be read with a GL context
+	for (size_t i = 0; i < pending_frames.size(); i++)
+	{
+		if (pending_frames[i] >= 0)
+		{
+			std::cerr << "ffmpeg_wrapper:: frame " << pending_frames[i]
+					  << " dropped, call finish() before destroying the GL context\n";
+		}
+	}
+
+	// The additional outputs have their own pipes
+	for (size_t i = 0; i < scaled_outputs.size(); i++)
+	{
+		scaled_output * output = scaled_outputs[i];
+		output->writer->flush();
+		output->writer->print_statistics(("ffmpeg_wrapper " + std::to_string(output->width) + "x"
+			+ std::to_string(output->height)).c_str());
+		delete output->writer;
+		close_pipe(output->pipe);
+		delete output->scaler;
+		delete output;
+	}
+
+	// The strip is written once all thumbnails are known
+	if (thumbnail_count > 0)
+	{
+		std::string path = FFMPEG_ROOT + thumbnail_filename;
+		int rows = (thumbnail_count + thumbnail_columns - 1) / thumbnail_columns;
+		if (!write_image(path, image_png, thumbnail_strip.data(), thumbnail_columns * thumbnail_width,
+				rows * thumbnail_height, false))
+		{
+			std::cerr << "ffmpeg_wrapper:: cannot write " << path << "\n";
+		}
+	}
+	delete thumbnail_scaler;
+
+	// Closing the ring tells the consumer that the stream has ended
+	if (ring)
+	{
+		std::cerr << "ffmpeg_wrapper:: " << ring->get_published() << " frames published, "
+				  << ring->get_stalls() << " stalls (" << ring->get_stall_seconds() << " s)\n";
+		delete ring;
+		return;
+	}
+
+	// Write the pending frames before closing the pipe
+	writer->flush();
+	writer->print_statistics("ffmpeg_wrapper");
+	delete writer;
+	close_pipe(ffmpeg);
+}
+
+// Add an effect that is applied to each frame before encoding
+void ffmpeg_wrapper::add_effect(FrameEffect * effect)
+{
+	effects.push_back(effect);
+}
+
+// Encode every frame a second time at another size
+bool ffmpeg_wrapper::add_output(int width, int height, char * filename, output_format format,
+	scale_filter filter, int buffer_count)
+{
+	if (format == output_shm)
+	{
+		std::cerr << "ffmpeg_wrapper:: shared memory is only supported for the main output\n";
+		return false;
+	}
+
+	scaled_output * output = new scaled_output();
+	output->width = width;
+	output->height = height;
+	output->scaler = new image_scaler(this->width, this->height, width, height, filter);
+	output->writer = open_output(width, height, filename, format, buffer_count, &output->pipe, &output->yuv_frame);
+	scaled_outputs.push_back(output);
+	return true;
+}
+
+// Collect a thumbnail of every interval-th frame into a contact sheet
+void ffmpeg_wrapper::add_thumbnail_strip(int width, int height, int interval, int columns, char * filename)
+{
+	thumbnail_width = width;
+	thumbnail_height = height;
+	thumbnail_interval = interval < 1 ? 1 : interval;
+	thumbnail_columns = columns < 1 ? 1 : columns;
+	thumbnail_filename = filename;
+	thumbnail.resize(sizeof(int) * width * height);
+	delete thumbnail_scaler;
+	thumbnail_scaler = new image_scaler(this->width, this->height, width, height, scale_box);
+
+	// Room for the thumbnails of all frames, so that the strip does not
+	// grow while rendering
+	int rows = (frames / thumbnail_interval + thumbnail_columns) / thumbnail_columns;
+	thumbnail_strip.reserve((size_t)rows * sizeof(int) * thumbnail_columns * width * height);
+}
+
+// Read frames back through pixel buffer objects
+void ffmpeg_wrapper::set_readback_pbos(int pbo_count)
+{
+	finish();
+
+	// pbo_count = 1 would wait for the frame that was just issued
+	pbo_count = pbo_count == 1 ? 2 : pbo_count;
+	if (pbo_count <= 0)
+	{
+		return;
+	}
+
+	color_pbos.resize(pbo_count);
+	glGenBuffers(pbo_count, color_pbos.data());
+	for (int i = 0; i < pbo_count; i++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, color_pbos[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(int) * width * height, nullptr, GL_STREAM_READ);
+	}
+	if (effects_need_depth())
+	{
+		depth_pbos.resize(pbo_count);
+		glGenBuffers(pbo_count, depth_pbos.data());
+		for (int i = 0; i < pbo_count; i++)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, depth_pbos[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(float) * width * height, nullptr, GL_STREAM_READ);
+		}
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	fences.assign(pbo_count, nullptr);
+	pending_frames.assign(pbo_count, -1);
+	next_pbo = 0;
+}
+
+// Whether any effect needs the depth buffer
+bool ffmpeg_wrapper::effects_need_depth()
+{
+	for (size_t i = 0; i < effects.size(); i++)
+	{
+		if (effects[i]->needs_depth())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Apply the effects and hand the frame to the writer thread
+void ffmpeg_wrapper::submit_frame(unsigned char * buffer, const float * depth_data, int index)
+{
+	PROFILE_SCOPE("submit_frame");
+	for (size_t i = 0; i < effects.size(); i++)
+	{
+		effects[i]->apply(buffer, depth_data);
+	}
+
+	// The buffer belongs to the writer after it was submitted
+	submit_scaled(buffer, index);
+	if (ring)
+	{
+		ring->publish();
+	}
+	else
+	{
+		writer->submit(buffer, index);
+	}
+}
+
+// Scale a frame into the additional outputs and the thumbnail strip
+void ffmpeg_wrapper::submit_scaled(const unsigned char * buffer, int index)
+{
+	// Each output is scaled from the full frame on all cores, so the
+	// previews keep the quality of the master
+	for (size_t i = 0; i < scaled_outputs.size(); i++)
+	{
+		scaled_output * output = scaled_outputs[i];
+		unsigned char * scaled = output->writer->acquire();
+		output->scaler->scale(buffer, scaled);
+		output->writer->submit(scaled, index);
+	}
+
+	if (thumbnail_interval == 0 || index % thumbnail_interval != 0)
+	{
+		return;
+	}
+
+	// Grow the strip by a row of thumbnails when needed
+	int column = thumbnail_count % thumbnail_columns;
+	int row = thumbnail_count / thumbnail_columns;
+	size_t row_size = sizeof(int) * thumbnail_columns * thumbnail_width * thumbnail_height;
+	if (thumbnail_strip.size() < (row + 1) * row_size)
+	{
+		thumbnail_strip.resize((row + 1) * row_size, 0);
+	}
+
+	// The frames are bottom-up, the strip is written top-down
+	thumbnail_scaler->scale(buffer, thumbnail.data());
+	size_t line_size = sizeof(int) * thumbnail_width;
+	for (int y = 0; y < thumbnail_height; y++)
+	{
+		unsigned char * line = thumbnail_strip.data() + row * row_size
+			+ (size_t)y * thumbnail_columns * line_size + column * line_size;
+		memcpy(line, thumbnail.data() + (size_t)(thumbnail_height - 1 - y) * line_size, line_size);
+	}
+	++thumbnail_count;
+}
+
+// Drop the shared memory ring and discard the frames from now on
+void ffmpeg_wrapper::discard_frames(int buffer_count)
+{
+	// Keep rendering, but the frames are lost
+	delete ring;
+	ring = nullptr;
+	writer = new async_frame_writer(sizeof(int) * width * height, buffer_count, 1,
+		[](const unsigned char *, size_t, int) {});
+}
+
+// Get the buffer for the next frame, waits if the consumer falls behind
+unsigned char * ffmpeg_wrapper::acquire_buffer()
+{
+	if (ring)
+	{
+		// The frame is read back straight into the shared slot
+		unsigned char * slot = ring->acquire(SHM_CONSUMER_TIMEOUT);
+		if (slot)
+		{
+			return slot;
+		}
+		std::cerr << "ffmpeg_wrapper:: " << (ring->is_consumer_attached() ? "the consumer has not released a frame"
+			: "no consumer has attached") << " for " << SHM_CONSUMER_TIMEOUT << " s, "
+				  << ring->get_released() << " frames were consumed, the rest is discarded\n";
+		discard_frames(ring->get_slot_count());
+	}
+	return writer->acquire();
+}
+
+// Wait for the readback in a PBO and submit its frame
+void ffmpeg_wrapper::finish_pbo(int pbo)
+{
+	PROFILE_SCOPE("readback wait");
+	// Usually the readback has long finished, the wait is a safety net
+	// (mapping the buffer waits for it anyway)
+	GLenum wait = glClientWaitSync(fences[pbo], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+	if (wait == GL_TIMEOUT_EXPIRED)
+	{
+		std::cerr << "ffmpeg_wrapper:: readback of frame " << pending_frames[pbo] << " takes longer than 1 s\n";
+	}
+	else if (wait == GL_WAIT_FAILED)
+	{
+		std::cerr << "ffmpeg_wrapper:: waiting for the readback of frame " << pending_frames[pbo] << " failed\n";
+	}
+	glDeleteSync(fences[pbo]);
+	fences[pbo] = nullptr;
+
+	// Take a preallocated buffer, this waits if ffmpeg falls behind
+	unsigned char * buffer = acquire_buffer();
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, color_pbos[pbo]);
+	const void * pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(int) * width * height, GL_MAP_READ_BIT);
+	if (pixels)
+	{
+		memcpy(buffer, pixels, sizeof(int) * width * height);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	else
+	{
+		// The framebuffer already holds a later frame, so the frame is
+		// lost; a black one keeps the timing instead of stale pixels
+		std::cerr << "ffmpeg_wrapper:: cannot map the readback of frame " << pending_frames[pbo]
+				  << " (GL error " << glGetError() << "), a black frame is written\n";
+		memset(buffer, 0, sizeof(int) * width * height);
+	}
+
+	const float * depth_data = nullptr;
+	if (!depth_pbos.empty())
+	{
+		depth.resize(width * height);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, depth_pbos[pbo]);
+		const void * values = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(float) * width * height, GL_MAP_READ_BIT);
+		if (values)
+		{
+			memcpy(depth.data(), values, sizeof(float) * width * height);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			depth_data = depth.data();
+		}
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	submit_frame(buffer, depth_data, pending_frames[pbo]);
+	pending_frames[pbo] = -1;
+}
+
 // Save a frame, e.g. send it to FFMPEG
 void ffmpeg_wrapper::save_frame()
 {
-    // Create a local buffer of the necessary size
-	int * buffer = new int[width * height];
+	PROFILE_SCOPE("save_frame");
+	if (!color_pbos.empty())
+	{
+		// Start the asynchronous readback of this frame
+		int pbo = next_pbo;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, color_pbos[pbo]);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+		if (!depth_pbos.empty())
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, depth_pbos[pbo]);
+			glReadPixels(0, 0, width, height, GL_DEPTH_COMPONENT, GL_FLOAT, (void*)0);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		fences[pbo] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		pending_frames[pbo] = frame_counter;
+		++frame_counter;
+
+		// Submit the oldest pending frame, i.e. the one whose PBO is
+		// used next
+		next_pbo = (next_pbo + 1) % (int)color_pbos.size();
+		if (pending_frames[next_pbo] >= 0)
+		{
+			finish_pbo(next_pbo);
+		}
+		return;
+	}
 
-    // Read the frame buffer and write it to the ffmpeg handle
+    // Take a preallocated buffer, this waits if ffmpeg falls behind
+	unsigned char * buffer = acquire_buffer();
+
+    // Read the frame buffer
 	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, buffer);
-	fwrite(buffer, sizeof(int)*width*height, 1, ffmpeg);
 
-    // Delete the local buffer and increase the frame counter 
-	delete[] buffer;
+	// Read the depth buffer only if an effect needs it
+	const float * depth_data = nullptr;
+	if (effects_need_depth())
+	{
+		depth.resize(width * height);
+		glReadPixels(0, 0, width, height, GL_DEPTH_COMPONENT, GL_FLOAT, depth.data());
+		depth_data = depth.data();
+	}
+
+    // Hand the frame to the writer thread and increase the frame counter
+	submit_frame(buffer, depth_data, frame_counter);
 	++frame_counter;
 }
 
+// Pass a frame through the effects without saving it
+void ffmpeg_wrapper::preroll_frame()
+{
+	if (effects.empty())
+	{
+		return;
+	}
+
+	preroll.resize(sizeof(int) * width * height);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, preroll.data());
+	const float * depth_data = nullptr;
+	if (effects_need_depth())
+	{
+		depth.resize(width * height);
+		glReadPixels(0, 0, width, height, GL_DEPTH_COMPONENT, GL_FLOAT, depth.data());
+		depth_data = depth.data();
+	}
+	for (size_t i = 0; i < effects.size(); i++)
+	{
+		effects[i]->apply(preroll.data(), depth_data);
+	}
+}
+
+// Submit the frames still pending in PBOs
+void ffmpeg_wrapper::finish()
+{
+	// The oldest pending frame is in the PBO used next
+	for (size_t i = 0; i < color_pbos.size(); i++)
+	{
+		int pbo = (next_pbo + i) % color_pbos.size();
+		if (pending_frames[pbo] >= 0)
+		{
+			finish_pbo(pbo);
+		}
+	}
+
+	if (!color_pbos.empty())
+	{
+		glDeleteBuffers((int)color_pbos.size(), color_pbos.data());
+		color_pbos.clear();
+	}
+	if (!depth_pbos.empty())
+	{
+		glDeleteBuffers((int)depth_pbos.size(), depth_pbos.data());
+		depth_pbos.clear();
+	}
+	fences.clear();
+	pending_frames.clear();
+}
+
 // Retrieve whether the rendering has finished
 bool ffmpeg_wrapper::is_finished()
 {
@@ -63,3 +555,53 @@ bool ffmpeg_wrapper::is_finished()
 	// is greater than the maximum number of frames
 	return frame_counter > frames;
 }
+
+
+// Retrieve the backpressure statistics of the writer thread
+async_frame_writer::statistics ffmpeg_wrapper::get_statistics()
+{
+	if (ring)
+	{
+		// Only the stalls are known for the shared memory transport
+		async_frame_writer::statistics stats = async_frame_writer::statistics();
+		stats.frames_written = (int)ring->get_released();
+		stats.stalls = ring->get_stalls();
+		stats.stall_seconds = ring->get_stall_seconds();
+		return stats;
+	}
+	return writer->get_statistics();
+}
+
+// Join videos without re-encoding them
+bool ffmpeg_wrapper::concat_segments(const std::vector<std::string> & segments, const std::string & output)
+{
+	// The concat demuxer reads the segments from a list file
+	std::string list_path = FFMPEG_ROOT + output + ".txt";
+	FILE * list = fopen(list_path.c_str(), "w");
+	if (!list)
+	{
+		std::cerr << "ffmpeg_wrapper:: cannot write " << list_path << "\n";
+		return false;
+	}
+	for (size_t i = 0; i < segments.size(); i++)
+	{
+		fprintf(list, "file '%s'\n", (FFMPEG_ROOT + segments[i]).c_str());
+	}
+	fclose(list);
+
+	// "-c copy" only remuxes, each segment starts with a key frame
+    #ifdef __linux__
+	std::string cmd = "ffmpeg -y -f concat -safe 0 -i " + list_path + " -c copy " + FFMPEG_ROOT + output;
+    #else
+	std::string cmd = std::string("\"") + FFMPEG_ROOT + "ffmpeg.exe\" -y -f concat -safe 0 -i \"" + list_path
+		+ "\" -c copy \"" + FFMPEG_ROOT + output + "\"";
+    #endif
+	int result = system(cmd.c_str());
+	remove(list_path.c_str());
+	if (result != 0)
+	{
+		std::cerr << "ffmpeg_wrapper:: concatenating " << segments.size() << " segments failed\n";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,251 @@
+#include "image_scale.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCALE_USE_SSE2
+#endif
+
+// Bits of the fixed point filter weights
+#define SCALE_WEIGHT_BITS 14
+#define SCALE_WEIGHT_ONE (1 << SCALE_WEIGHT_BITS)
+
+#ifndef M_PI
+#define M_PI 3.14159265359
+#endif
+
+namespace
+{
+	// Radius of a filter in source pixels at scale 1
+	double filter_support(scale_filter filter)
+	{
+		switch (filter)
+		{
+		case scale_box:
+			return 0.5;
+		case scale_bilinear:
+			return 1.0;
+		default:
+			return 3.0;
+		}
+	}
+
+	// Evaluate a filter at distance x
+	double filter_value(scale_filter filter, double x)
+	{
+		x = std::fabs(x);
+		switch (filter)
+		{
+		case scale_box:
+			return x < 0.5 ? 1.0 : 0.0;
+		case scale_bilinear:
+			return x < 1.0 ? 1.0 - x : 0.0;
+		default:
+			if (x < 1e-8)
+			{
+				return 1.0;
+			}
+			if (x >= 3.0)
+			{
+				return 0.0;
+			}
+			return 3.0 * std::sin(M_PI * x) * std::sin(M_PI * x / 3.0) / (M_PI * M_PI * x * x);
+		}
+	}
+
+	// Compute the weights for scaling src_size to dst_size pixels
+	scale_weights compute_weights(int src_size, int dst_size, scale_filter filter)
+	{
+		double scale = (double)src_size / dst_size;
+		double filter_scale = std::max(scale, 1.0);
+		double support = filter_support(filter) * filter_scale;
+
+		scale_weights result;
+		result.taps = (int)std::ceil(2.0 * support) + 2;
+		result.taps += result.taps & 1;
+		result.taps = std::min(result.taps, src_size);
+		result.start.resize(dst_size);
+		result.weights.assign((size_t)dst_size * result.taps, 0);
+
+		std::vector<double> w(result.taps);
+		for (int i = 0; i < dst_size; i++)
+		{
+			double center = (i + 0.5) * scale;
+			int first = (int)std::floor(center - support);
+			int last = (int)std::ceil(center + support);
+			first = std::max(first, 0);
+			last = std::min(last, src_size - 1);
+			if (last - first + 1 > result.taps)
+			{
+				last = first + result.taps - 1;
+			}
+
+			// Taps may only start where all of them are inside the image
+			int start = std::min(first, std::max(src_size - result.taps, 0));
+			result.start[i] = start;
+
+			double sum = 0.0;
+			for (int k = 0; k < result.taps; k++)
+			{
+				int j = start + k;
+				w[k] = j >= first && j <= last ? filter_value(filter, (j + 0.5 - center) / filter_scale) : 0.0;
+				sum += w[k];
+			}
+			if (sum == 0.0)
+			{
+				// Upscaling a box: take the nearest pixel
+				int nearest = std::min(std::max((int)center, 0), src_size - 1);
+				w[nearest - start] = 1.0;
+				sum = 1.0;
+			}
+
+			// Quantize, the rounding error goes to the largest weight
+			int16_t * out = &result.weights[(size_t)i * result.taps];
+			int total = 0;
+			int largest = 0;
+			for (int k = 0; k < result.taps; k++)
+			{
+				out[k] = (int16_t)std::lround(w[k] / sum * SCALE_WEIGHT_ONE);
+				total += out[k];
+				largest = out[k] > out[largest] ? k : largest;
+			}
+			out[largest] += (int16_t)(SCALE_WEIGHT_ONE - total);
+		}
+		return result;
+	}
+
+	// Round, shift and clamp an accumulated value
+	inline unsigned char to_byte(int value)
+	{
+		value = (value + (1 << (SCALE_WEIGHT_BITS - 1))) >> SCALE_WEIGHT_BITS;
+		return (unsigned char)(value < 0 ? 0 : (value > 255 ? 255 : value));
+	}
+
+	// Filter one row horizontally
+	void scale_row(const unsigned char * src, unsigned char * dst, int dst_width, const scale_weights & fw)
+	{
+		for (int x = 0; x < dst_width; x++)
+		{
+			const unsigned char * p = src + 4 * fw.start[x];
+			const int16_t * w = &fw.weights[(size_t)x * fw.taps];
+#ifdef SCALE_USE_SSE2
+			// Two pixels per step: interleave their channels as 16 bit
+			// pairs and multiply-add them with the two weights (the tap
+			// count is only odd for images narrower than the filter)
+			if ((fw.taps & 1) == 0)
+			{
+				__m128i acc = _mm_setzero_si128();
+				const __m128i zero = _mm_setzero_si128();
+				for (int k = 0; k < fw.taps; k += 2)
+				{
+					__m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + 4 * k)), zero);
+					px = _mm_unpacklo_epi16(px, _mm_srli_si128(px, 8));
+					__m128i wk = _mm_set1_epi32((int)(((uint32_t)(uint16_t)w[k + 1] << 16) | (uint16_t)w[k]));
+					acc = _mm_add_epi32(acc, _mm_madd_epi16(px, wk));
+				}
+				acc = _mm_srai_epi32(_mm_add_epi32(acc, _mm_set1_epi32(1 << (SCALE_WEIGHT_BITS - 1))), SCALE_WEIGHT_BITS);
+				acc = _mm_packs_epi32(acc, acc);
+				int32_t pixel = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+				memcpy(dst + 4 * x, &pixel, 4);
+				continue;
+			}
+#endif // SCALE_USE_SSE2
+			int acc[4] = { 0, 0, 0, 0 };
+			for (int k = 0; k < fw.taps; k++)
+			{
+				for (int c = 0; c < 4; c++)
+				{
+					acc[c] += p[4 * k + c] * w[k];
+				}
+			}
+			for (int c = 0; c < 4; c++)
+			{
+				dst[4 * x + c] = to_byte(acc[c]);
+			}
+		}
+	}
+
+	// Filter one output row vertically from the rows of src
+	void scale_column(const unsigned char * src, int row_bytes, unsigned char * dst,
+		int start, const int16_t * w, int taps)
+	{
+		int i = 0;
+#ifdef SCALE_USE_SSE2
+		// 8 bytes of two rows per step, interleaved as 16 bit pairs
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i round = _mm_set1_epi32(1 << (SCALE_WEIGHT_BITS - 1));
+		for (; (taps & 1) == 0 && i + 8 <= row_bytes; i += 8)
+		{
+			__m128i lo = _mm_setzero_si128();
+			__m128i hi = _mm_setzero_si128();
+			for (int k = 0; k < taps; k += 2)
+			{
+				const unsigned char * r0 = src + (size_t)(start + k) * row_bytes + i;
+				__m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)r0), zero);
+				__m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(r0 + row_bytes)), zero);
+				__m128i wk = _mm_set1_epi32((int)(((uint32_t)(uint16_t)w[k + 1] << 16) | (uint16_t)w[k]));
+				lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wk));
+				hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wk));
+			}
+			lo = _mm_srai_epi32(_mm_add_epi32(lo, round), SCALE_WEIGHT_BITS);
+			hi = _mm_srai_epi32(_mm_add_epi32(hi, round), SCALE_WEIGHT_BITS);
+			__m128i words = _mm_packs_epi32(lo, hi);
+			_mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(words, words));
+		}
+#endif // SCALE_USE_SSE2
+		for (; i < row_bytes; i++)
+		{
+			int acc = 0;
+			for (int k = 0; k < taps; k++)
+			{
+				acc += src[(size_t)(start + k) * row_bytes + i] * w[k];
+			}
+			dst[i] = to_byte(acc);
+		}
+	}
+}
+
+// Prepare scaling src_width x src_height to dst_width x dst_height
+image_scaler::image_scaler(int src_width, int src_height, int dst_width, int dst_height, scale_filter filter)
+	: src_width(src_width), src_height(src_height), dst_width(dst_width), dst_height(dst_height),
+	  horizontal(compute_weights(src_width, dst_width, filter)),
+	  vertical(compute_weights(src_height, dst_height, filter)),
+	  rows((size_t)4 * dst_width * src_height)
+{
+}
+
+// Scale an image
+void image_scaler::scale(const unsigned char * src, unsigned char * dst, thread_pool * pool)
+{
+	// Horizontal pass for all source rows
+	pool->parallel_for(0, src_height, 16, [&](int begin, int end) {
+		for (int y = begin; y < end; y++)
+		{
+			const unsigned char * in = src + (size_t)4 * src_width * y;
+			scale_row(in, &rows[(size_t)4 * dst_width * y], dst_width, horizontal);
+		}
+	});
+
+	// Vertical pass
+	int row_bytes = 4 * dst_width;
+	pool->parallel_for(0, dst_height, 8, [&](int begin, int end) {
+		for (int y = begin; y < end; y++)
+		{
+			scale_column(rows.data(), row_bytes, dst + (size_t)row_bytes * y,
+				vertical.start[y], &vertical.weights[(size_t)y * vertical.taps], vertical.taps);
+		}
+	});
+}
+
+// Scale an RGBA image
+void scale_rgba(const unsigned char * src, int src_width, int src_height,
+	unsigned char * dst, int dst_width, int dst_height, scale_filter filter,
+	thread_pool * pool)
+{
+	image_scaler scaler(src_width, src_height, dst_width, dst_height, filter);
+	scaler.scale(src, dst, pool);
+}
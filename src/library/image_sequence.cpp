@@ -0,0 +1,183 @@
+#include "image_sequence.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <stb_image_write.h>
+
+// QOI operations, see https://qoiformat.org/qoi-specification.pdf
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+#define QOI_MAX_RUN 62
+
+namespace
+{
+	// Append a 32 bit big endian value
+	inline void put_u32(unsigned char *& out, uint32_t value)
+	{
+		*out++ = (unsigned char)(value >> 24);
+		*out++ = (unsigned char)(value >> 16);
+		*out++ = (unsigned char)(value >> 8);
+		*out++ = (unsigned char)value;
+	}
+
+	// Index of a pixel in the table of recently seen pixels
+	inline int qoi_hash(const unsigned char * px)
+	{
+		return (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+	}
+}
+
+// Get the file extension of a format
+const char * image_format_extension(image_format format)
+{
+	switch (format)
+	{
+	case image_png:
+		return "png";
+	case image_qoi:
+		return "qoi";
+	default:
+		return "rgba";
+	}
+}
+
+// Get the file name of frame index of a sequence
+std::string image_sequence_path(const std::string & pattern, int index)
+{
+	std::vector<char> path(pattern.size() + 32);
+	snprintf(path.data(), path.size(), pattern.c_str(), index);
+	return std::string(path.data());
+}
+
+// Encode an RGBA image as QOI
+void encode_qoi(const unsigned char * rgba, int width, int height, bool bottom_up, std::vector<unsigned char> & out)
+{
+	// Worst case is one QOI_OP_RGBA per pixel plus header and end marker
+	out.resize(14 + (size_t)width * height * 5 + 8);
+	unsigned char * o = out.data();
+
+	memcpy(o, "qoif", 4);
+	o += 4;
+	put_u32(o, width);
+	put_u32(o, height);
+	*o++ = 4;
+	*o++ = 0;
+
+	unsigned char index[64][4];
+	memset(index, 0, sizeof(index));
+	unsigned char prev[4] = { 0, 0, 0, 255 };
+	int run = 0;
+
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned char * row = rgba + (size_t)4 * width * (bottom_up ? height - 1 - y : y);
+		bool last_row = y == height - 1;
+		for (int x = 0; x < width; x++)
+		{
+			const unsigned char * px = row + 4 * x;
+			if (memcmp(px, prev, 4) == 0)
+			{
+				run++;
+				if (run == QOI_MAX_RUN || (last_row && x == width - 1))
+				{
+					*o++ = (unsigned char)(QOI_OP_RUN | (run - 1));
+					run = 0;
+				}
+				continue;
+			}
+
+			if (run > 0)
+			{
+				*o++ = (unsigned char)(QOI_OP_RUN | (run - 1));
+				run = 0;
+			}
+
+			int hash = qoi_hash(px);
+			if (memcmp(index[hash], px, 4) == 0)
+			{
+				*o++ = (unsigned char)(QOI_OP_INDEX | hash);
+			}
+			else
+			{
+				memcpy(index[hash], px, 4);
+				if (px[3] == prev[3])
+				{
+					signed char dr = (signed char)(px[0] - prev[0]);
+					signed char dg = (signed char)(px[1] - prev[1]);
+					signed char db = (signed char)(px[2] - prev[2]);
+					signed char dr_dg = (signed char)(dr - dg);
+					signed char db_dg = (signed char)(db - dg);
+					if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+					{
+						*o++ = (unsigned char)(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+					}
+					else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+					{
+						*o++ = (unsigned char)(QOI_OP_LUMA | (dg + 32));
+						*o++ = (unsigned char)((dr_dg + 8) << 4 | (db_dg + 8));
+					}
+					else
+					{
+						*o++ = QOI_OP_RGB;
+						memcpy(o, px, 3);
+						o += 3;
+					}
+				}
+				else
+				{
+					*o++ = QOI_OP_RGBA;
+					memcpy(o, px, 4);
+					o += 4;
+				}
+			}
+			memcpy(prev, px, 4);
+		}
+	}
+
+	// End marker
+	static const unsigned char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	memcpy(o, padding, 8);
+	o += 8;
+	out.resize(o - out.data());
+}
+
+// Write an RGBA image to a file
+bool write_image(const std::string & path, image_format format, const unsigned char * rgba,
+	int width, int height, bool bottom_up)
+{
+	int stride = 4 * width;
+	if (format == image_png)
+	{
+		// A negative stride flips the image, stbi_flip_vertically_on_write
+		// would change a global setting shared by all threads
+		const unsigned char * first_row = bottom_up ? rgba + (size_t)stride * (height - 1) : rgba;
+		return stbi_write_png(path.c_str(), width, height, 4, first_row, bottom_up ? -stride : stride) != 0;
+	}
+
+	FILE * file = fopen(path.c_str(), "wb");
+	if (!file)
+	{
+		return false;
+	}
+	bool written = true;
+	if (format == image_qoi)
+	{
+		std::vector<unsigned char> data;
+		encode_qoi(rgba, width, height, bottom_up, data);
+		written = fwrite(data.data(), data.size(), 1, file) == 1;
+	}
+	else
+	{
+		for (int y = 0; y < height && written; y++)
+		{
+			const unsigned char * row = rgba + (size_t)stride * (bottom_up ? height - 1 - y : y);
+			written = fwrite(row, stride, 1, file) == 1;
+		}
+	}
+	return fclose(file) == 0 && written;
+}
@@ -0,0 +1,151 @@
+#include "mapped_file.hpp"
+
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <direct.h>
+#endif
+
+// Create an empty view
+mapped_file::mapped_file()
+{
+	memory = nullptr;
+	memory_size = 0;
+}
+
+// Unmap the file
+mapped_file::~mapped_file()
+{
+	close();
+}
+
+// Map a file
+bool mapped_file::open(const std::string & path)
+{
+	close();
+
+#ifdef __linux__
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat file;
+	if (fstat(fd, &file) != 0 || file.st_size <= 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void * address = mmap(nullptr, (size_t)file.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (address == MAP_FAILED)
+	{
+		return false;
+	}
+	memory = (const unsigned char *)address;
+	memory_size = (size_t)file.st_size;
+#else
+	// Without mmap the file is read in one go
+	FILE * file = fopen(path.c_str(), "rb");
+	if (!file)
+	{
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	content.resize(size > 0 ? (size_t)size : 0);
+	bool complete = size > 0 && fread(content.data(), content.size(), 1, file) == 1;
+	fclose(file);
+	if (!complete)
+	{
+		content.clear();
+		return false;
+	}
+	memory = content.data();
+	memory_size = content.size();
+#endif
+	return true;
+}
+
+// Unmap the file
+void mapped_file::close()
+{
+#ifdef __linux__
+	if (memory)
+	{
+		munmap((void *)memory, memory_size);
+	}
+#endif
+	content.clear();
+	memory = nullptr;
+	memory_size = 0;
+}
+
+// Whether a file is mapped
+bool mapped_file::is_open() const
+{
+	return memory != nullptr;
+}
+
+// Get the content of the file
+const unsigned char * mapped_file::data() const
+{
+	return memory;
+}
+
+// Get the size of the file
+size_t mapped_file::size() const
+{
+	return memory_size;
+}
+
+// Write a file through a temporary file
+bool mapped_file::write(const std::string & path, const void * data, size_t size)
+{
+	size_t slash = path.find_last_of("/\\");
+	if (slash != std::string::npos)
+	{
+		std::string directory = path.substr(0, slash);
+#ifdef __linux__
+		mkdir(directory.c_str(), 0755);
+#else
+		_mkdir(directory.c_str());
+#endif
+	}
+
+	std::string temporary = path + ".tmp";
+	FILE * out = fopen(temporary.c_str(), "wb");
+	if (!out)
+	{
+		return false;
+	}
+	bool written = fwrite(data, size, 1, out) == 1;
+	written = fclose(out) == 0 && written;
+	remove(path.c_str());
+	if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+	{
+		remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Get the size and modification time of a file
+bool mapped_file::stat(const std::string & path, uint64_t * size, int64_t * time)
+{
+	struct ::stat file;
+	if (::stat(path.c_str(), &file) != 0)
+	{
+		return false;
+	}
+	*size = (uint64_t)file.st_size;
+	*time = (int64_t)file.st_mtime;
+	return true;
+}
@@ -0,0 +1,225 @@
+#include "memory_tracker.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+	// Counters of every tag and of all tags together (the last entry)
+	std::atomic<size_t> current[memory_tag_count + 1];
+	std::atomic<size_t> peak[memory_tag_count + 1];
+	std::atomic<size_t> allocations[memory_tag_count + 1];
+	std::atomic<size_t> budget[memory_tag_count + 1];
+
+	const char * tag_names[memory_tag_count] = {
+		"terrain",
+		"physics",
+		"noise",
+		"geometry",
+		"textures",
+		"capture"
+	};
+
+	// Heap allocations of the thread and whether they abort
+	thread_local size_t thread_allocations = 0;
+	thread_local bool allocations_forbidden = false;
+
+	// Count an allocation of the thread
+	void count_allocation(size_t bytes)
+	{
+		thread_allocations++;
+		if (allocations_forbidden)
+		{
+			// Reporting allocates itself
+			allocations_forbidden = false;
+			std::cerr << "memory:: heap allocation of " << bytes << " bytes where none are allowed\n";
+			std::abort();
+		}
+	}
+
+	// Allocate with malloc like the default operator new
+	void * allocate(size_t bytes)
+	{
+		count_allocation(bytes);
+		for (;;)
+		{
+			void * memory = std::malloc(bytes ? bytes : 1);
+			if (memory)
+			{
+				return memory;
+			}
+			std::new_handler handler = std::get_new_handler();
+			if (!handler)
+			{
+				throw std::bad_alloc();
+			}
+			handler();
+		}
+	}
+
+	// Add bytes to a counter and raise its peak
+	size_t add(int index, size_t bytes)
+	{
+		size_t value = current[index].fetch_add(bytes) + bytes;
+		size_t highest = peak[index].load();
+		while (value > highest && !peak[index].compare_exchange_weak(highest, value))
+		{
+		}
+		return value;
+	}
+
+	// Print the report and abort
+	void budget_exceeded(memory_tag tag, int index, size_t bytes)
+	{
+		std::cerr << "memory:: allocating " << bytes << " bytes for " << tag_names[tag]
+				  << " exceeds the budget of " << budget[index].load() << " bytes"
+				  << (index == memory_tag_count ? "" : " of the tag") << "\n";
+		memory_report(std::cerr);
+		std::abort();
+	}
+}
+
+// Account bytes allocated for a tag
+void memory_allocated(memory_tag tag, size_t bytes)
+{
+	allocations[tag]++;
+	allocations[memory_tag_count]++;
+	size_t tag_value = add(tag, bytes);
+	size_t total_value = add(memory_tag_count, bytes);
+
+	size_t tag_budget = budget[tag].load(std::memory_order_relaxed);
+	size_t total_budget = budget[memory_tag_count].load(std::memory_order_relaxed);
+	if (tag_budget != 0 && tag_value > tag_budget)
+	{
+		budget_exceeded(tag, tag, bytes);
+	}
+	if (total_budget != 0 && total_value > total_budget)
+	{
+		budget_exceeded(tag, memory_tag_count, bytes);
+	}
+}
+
+// Account bytes released by a tag
+void memory_released(memory_tag tag, size_t bytes)
+{
+	current[tag].fetch_sub(bytes);
+	current[memory_tag_count].fetch_sub(bytes);
+}
+
+// Get the accounted memory of a tag
+memory_stats memory_get_stats(memory_tag tag)
+{
+	memory_stats stats;
+	stats.current = current[tag].load();
+	stats.peak = peak[tag].load();
+	stats.allocations = allocations[tag].load();
+	return stats;
+}
+
+// Get the accounted memory of all tags together
+memory_stats memory_get_total()
+{
+	return memory_get_stats(memory_tag_count);
+}
+
+// Get the name of a tag
+const char * memory_tag_name(memory_tag tag)
+{
+	return tag < memory_tag_count ? tag_names[tag] : "total";
+}
+
+// Limit the memory of all tags together
+void memory_set_budget(size_t bytes)
+{
+	budget[memory_tag_count] = bytes;
+}
+
+// Limit the memory of a tag
+void memory_set_budget(memory_tag tag, size_t bytes)
+{
+	budget[tag] = bytes;
+}
+
+// Print current, peak and allocation count of every tag
+void memory_report(std::ostream & out)
+{
+	char line[128];
+	snprintf(line, sizeof(line), "memory:: %-10s %12s %12s %12s\n", "tag", "current MB", "peak MB", "allocations");
+	out << line;
+	for (int i = 0; i <= memory_tag_count; i++)
+	{
+		memory_stats stats = memory_get_stats((memory_tag)i);
+		snprintf(line, sizeof(line), "         %-10s %12.1f %12.1f %12zu\n", memory_tag_name((memory_tag)i),
+			stats.current / 1048576.0, stats.peak / 1048576.0, stats.allocations);
+		out << line;
+	}
+}
+
+// Get the number of heap allocations of the calling thread so far
+size_t memory_thread_allocations()
+{
+	return thread_allocations;
+}
+
+// Abort on the next heap allocation of the calling thread
+void memory_forbid_allocations(bool forbid)
+{
+	allocations_forbidden = forbid;
+}
+
+// The global allocation functions, replaced to count the allocations
+void * operator new(size_t bytes)
+{
+	return allocate(bytes);
+}
+
+void * operator new[](size_t bytes)
+{
+	return allocate(bytes);
+}
+
+void * operator new(size_t bytes, const std::nothrow_t &) noexcept
+{
+	try
+	{
+		return allocate(bytes);
+	}
+	catch (const std::bad_alloc &)
+	{
+		return nullptr;
+	}
+}
+
+void * operator new[](size_t bytes, const std::nothrow_t &) noexcept
+{
+	try
+	{
+		return allocate(bytes);
+	}
+	catch (const std::bad_alloc &)
+	{
+		return nullptr;
+	}
+}
+
+void operator delete(void * memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void * memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void * memory, const std::nothrow_t &) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void * memory, const std::nothrow_t &) noexcept
+{
+	std::free(memory);
+}
@@ -0,0 +1,168 @@
+#include "mesh_cache.hpp"
+#include "mapped_file.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+// Size of the header and alignment of the vertex and index data
+#define MESH_CACHE_HEADER_SIZE 32
+#define MESH_CACHE_ALIGNMENT 16
+// Floats per vertex: position, normal, color
+#define MESH_CACHE_VERTEX_FLOATS 10
+
+static_assert(MESH_CACHE_VERTEX_FLOATS * sizeof(float) == geometry_data::vertex_stride,
+	"the cached vertices are copied into geometry_data as they are");
+
+namespace
+{
+	// Header at the start of a cache file
+	struct header
+	{
+		uint32_t magic;
+		uint32_t version;
+		int32_t process;
+		uint32_t object_count;
+		// Size and modification time of the model
+		uint64_t source_size;
+		int64_t source_time;
+	};
+
+	// Transformation, material, size and position of a mesh in the file
+	struct object
+	{
+		float transform[16];
+		uint32_t material;
+		uint32_t reserved;
+		uint32_t vertex_count;
+		uint32_t face_count;
+		uint64_t vertex_offset;
+		uint64_t face_offset;
+	};
+
+	// Round up to the alignment of the data
+	uint64_t align(uint64_t offset)
+	{
+		return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(uint64_t)(MESH_CACHE_ALIGNMENT - 1);
+	}
+}
+
+// Get the path of the cache file of a model
+std::string mesh_cache_path(const std::string & model_path, int process)
+{
+	size_t slash = model_path.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? model_path : model_path.substr(slash + 1);
+	char flags[16];
+	snprintf(flags, sizeof(flags), "%08x", (unsigned int)process);
+	return CACHE_ROOT + name + "." + flags + ".mesh";
+}
+
+// Load the meshes of a model from its cache file
+bool load_mesh_cache(const std::string & model_path, int process, std::vector<geometry> & objects)
+{
+	uint64_t source_size;
+	int64_t source_time;
+	mapped_file file;
+	if (!mapped_file::stat(model_path, &source_size, &source_time)
+		|| !file.open(mesh_cache_path(model_path, process)) || file.size() < MESH_CACHE_HEADER_SIZE)
+	{
+		return false;
+	}
+
+	const header * file_header = (const header *)file.data();
+	const object * table = (const object *)(file.data() + MESH_CACHE_HEADER_SIZE);
+	if (file_header->magic != MESH_CACHE_MAGIC || file_header->version != MESH_CACHE_VERSION
+		|| file_header->process != process || file_header->source_size != source_size
+		|| file_header->source_time != source_time
+		|| MESH_CACHE_HEADER_SIZE + (uint64_t)file_header->object_count * sizeof(object) > file.size())
+	{
+		return false;
+	}
+
+	objects.clear();
+	objects.reserve(file_header->object_count);
+	for (uint32_t i = 0; i < file_header->object_count; i++)
+	{
+		const object & entry = table[i];
+		if (entry.vertex_offset + (uint64_t)entry.vertex_count * MESH_CACHE_VERTEX_FLOATS * sizeof(float) > file.size()
+			|| entry.face_offset + (uint64_t)entry.face_count * sizeof(glm::uvec3) > file.size())
+		{
+			objects.clear();
+			return false;
+		}
+
+		geometry m{};
+		memcpy(&m.transform[0][0], entry.transform, sizeof(entry.transform));
+		m.material = entry.material;
+		// The file has the layout of the VBO and the IBO, so both are
+		// copied as they are and uploaded from there
+		m.data.allocate(entry.vertex_count, entry.face_count, false);
+		memcpy(m.data.vertex_data(), file.data() + entry.vertex_offset, m.data.vertex_bytes());
+		memcpy(m.data.index_data(), file.data() + entry.face_offset, m.data.index_bytes());
+		m.vertex_count = 3 * entry.face_count;
+		objects.push_back(std::move(m));
+	}
+	return true;
+}
+
+// Write the meshes of a model to its cache file
+bool save_mesh_cache(const std::string & model_path, int process, const std::vector<geometry> & objects)
+{
+	uint64_t source_size;
+	int64_t source_time;
+	if (!mapped_file::stat(model_path, &source_size, &source_time))
+	{
+		return false;
+	}
+
+	// Lay out the table and the data of all objects
+	std::vector<object> table(objects.size());
+	uint64_t offset = MESH_CACHE_HEADER_SIZE + objects.size() * sizeof(object);
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		const geometry & m = objects[i];
+		memcpy(table[i].transform, &m.transform[0][0], sizeof(table[i].transform));
+		table[i].material = m.material;
+		table[i].reserved = 0;
+		table[i].vertex_count = (uint32_t)m.positions.size();
+		table[i].face_count = (uint32_t)m.faces.size();
+		table[i].vertex_offset = offset = align(offset);
+		offset += (uint64_t)table[i].vertex_count * MESH_CACHE_VERTEX_FLOATS * sizeof(float);
+		table[i].face_offset = offset = align(offset);
+		offset += (uint64_t)table[i].face_count * sizeof(glm::uvec3);
+	}
+
+	std::vector<unsigned char> content((size_t)offset, 0);
+	header * file_header = (header *)content.data();
+	file_header->magic = MESH_CACHE_MAGIC;
+	file_header->version = MESH_CACHE_VERSION;
+	file_header->process = process;
+	file_header->object_count = (uint32_t)objects.size();
+	file_header->source_size = source_size;
+	file_header->source_time = source_time;
+	if (!table.empty())
+	{
+		memcpy(content.data() + MESH_CACHE_HEADER_SIZE, table.data(), table.size() * sizeof(object));
+	}
+
+	// Interleave the vertices like the VBO
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		const geometry & m = objects[i];
+		float * vertices = (float *)(content.data() + table[i].vertex_offset);
+		for (size_t v = 0; v < m.positions.size(); v++)
+		{
+			float * vertex = vertices + MESH_CACHE_VERTEX_FLOATS * v;
+			memcpy(vertex, &m.positions[v][0], 3 * sizeof(float));
+			memcpy(vertex + 3, &m.normals[v][0], 3 * sizeof(float));
+			memcpy(vertex + 6, &m.colors[v][0], 4 * sizeof(float));
+		}
+		if (!m.faces.empty())
+		{
+			memcpy(content.data() + table[i].face_offset, m.faces.data(), m.faces.size() * sizeof(glm::uvec3));
+		}
+	}
+
+	return mapped_file::write(mesh_cache_path(model_path, process), content.data(), content.size());
+}
@@ -1,8 +1,9 @@
 #include "perlin_noise.hpp"
 
 // Create a new instance of perlin_noise
-perlin_noise::perlin_noise(int gradients_count, float grid_distance, float offset, float scaling)
+perlin_noise::perlin_noise(int gradients_count, float grid_distance, float offset, float scaling, unsigned int seed)
 {
+    this->seed = seed;
     this->gradients_count = gradients_count;
     this->gradient_grid_distance = grid_distance;
     this->offset = offset;
@@ -25,22 +26,21 @@ float perlin_noise::fade(float x)
 // Create pseudo-random gradients
 void perlin_noise::create_gradients()
 {
-    srand(time(0));
+    srand(seed);
 
-    gradients = new float**[gradients_count];
+    // A single table instead of an allocation per gradient
+    gradients = memory_new_array<float>(memory_noise, 2 * (size_t)gradients_count * gradients_count);
 
     for (int x = 0; x < gradients_count; x++)
     {
-        gradients[x] = new float*[gradients_count];
-
         for (int y = 0; y < gradients_count; y++)
         {
-            gradients[x][y] = new float[2];
+            float * gradient = gradients + 2 * ((size_t)x * gradients_count + y);
             float a = 2.0 * (rand() - RAND_MAX / 2.0) / RAND_MAX;
             float b = 2.0 * (rand() - RAND_MAX / 2.0) / RAND_MAX;
             float length = sqrt(a * a + b * b);
-            gradients[x][y][0] = a / length;
-            gradients[x][y][1] = b / length;
+            gradient[0] = a / length;
+            gradient[1] = b / length;
         }
     }
 }
@@ -52,7 +52,8 @@ float perlin_noise::dot_grid_gradient(int index_x, int index_y, float x, float y
 		return 0.0;
     float dx = x - (-max_distance + index_x * gradient_grid_distance);
     float dy = y - (-max_distance + index_y * gradient_grid_distance);
-    return (dx * gradients[index_x][index_y][0] + dy * gradients[index_x][index_y][1]);
+    const float * gradient = gradients + 2 * ((size_t)index_x * gradients_count + index_y);
+    return (dx * gradient[0] + dy * gradient[1]);
 }
 
 // Perform linear interpolation
@@ -93,14 +94,6 @@ float perlin_noise::get_noise(float x, float y)
 // Clear the memory occupied by the gradients
 void perlin_noise::clear_gradients()
 {
-	for (int i = 0; i < this->gradients_count; i++)
-	{
-		for (int j = 0; j < this->gradients_count; j++)
-		{
-			delete[] gradients[i][j];
-		}
-		delete[] gradients[i];
-	}
-	delete[] gradients;
+	memory_delete_array(memory_noise, gradients, 2 * (size_t)gradients_count * gradients_count);
 	gradients = nullptr;
 }
\ No newline at end of file
@@ -1,5 +1,9 @@
 #include <physics.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
 // Author: Volker Sobek <vsobek@uni-bonn.de>
 
 // physics.cpp and physics.hpp provide a tiny 'just-get-it-working'
@@ -29,6 +33,21 @@
 // This is our gravity (in negative y-direction)
 #define PHY_DEFAULT_ACCELERATION 0.f, -4.f, 0.f, 0.f
 
+// Number of floats per sphere in the instance buffer: center (3),
+// radius (1) and custom color (4)
+#define PHY_INSTANCE_FLOATS 8
+
+// Size of a cache line, the counters of a thread are padded to it
+#define PHY_CACHE_LINE 64
+// Threads that get counters of their own
+#define PHY_COUNTER_THREADS 64
+
+#ifdef ENABLE_PHYSICS_COUNTERS
+#define PHY_COUNT(counter) countEvent(counter)
+#else
+#define PHY_COUNT(counter)
+#endif
+
 
 namespace phy {
   namespace {
@@ -39,6 +58,87 @@ namespace phy {
     int view_mat_loc;
     int custom_color_loc;
     geometry geo;
+
+    // instanced sphere rendering
+    int phyInstancedShaderProgram;
+    int inst_light_dir_loc;
+    int inst_proj_mat_loc;
+    int inst_view_mat_loc;
+    unsigned int instance_vao;
+    unsigned int instance_vbo;
+    // number of spheres the instance buffer can currently hold
+    int instance_capacity = 0;
+
+    int draw_calls = 0;
+
+    // The counters of a thread, padded so that no other data shares
+    // their cache lines. Only the owning thread writes them, the
+    // atomics let other threads read them while it runs.
+    struct counterBlock {
+      char front[PHY_CACHE_LINE];
+      std::atomic<unsigned long long> values[counter_count];
+      char back[PHY_CACHE_LINE];
+    };
+
+    // The blocks of the threads that counted, in static memory so that
+    // the first event of a thread does not allocate and its events stay
+    // in the totals after it exits. Threads beyond the pool share the
+    // last block and count with locked increments.
+    counterBlock counter_blocks[PHY_COUNTER_THREADS];
+    std::atomic<int> counter_blocks_used(0);
+    // Protects the totals at the last collectCounters()
+    std::mutex counter_mutex;
+    phyCounters collected_totals = {};
+
+    const char *counter_names[counter_count] = {
+      "sphere_steps",
+      "reflections",
+      "detachments",
+      "triangle_lookups",
+      "outside_bounds"
+    };
+
+#ifdef ENABLE_PHYSICS_COUNTERS
+    thread_local counterBlock *thread_counters = nullptr;
+
+    // Take a block for the calling thread.
+    counterBlock *
+    registerCounters() {
+      int index = counter_blocks_used.fetch_add(1);
+      if (index >= PHY_COUNTER_THREADS) {
+        counter_blocks_used = PHY_COUNTER_THREADS;
+        index = PHY_COUNTER_THREADS - 1;
+      }
+      thread_counters = &counter_blocks[index];
+      return thread_counters;
+    }
+
+    // Count an event on the calling thread, without a locked
+    // instruction unless the block is shared.
+    inline void
+    countEvent(phyCounter counter) {
+      counterBlock *block = thread_counters ? thread_counters : registerCounters();
+      std::atomic<unsigned long long> &value = block->values[counter];
+      if (block == &counter_blocks[PHY_COUNTER_THREADS - 1]) {
+        value.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      }
+    }
+#endif // ENABLE_PHYSICS_COUNTERS
+
+    // Sum of the counters of all threads.
+    phyCounters
+    sumCounters() {
+      phyCounters totals = {};
+      int used = std::min(counter_blocks_used.load(), PHY_COUNTER_THREADS);
+      for (int i = 0; i < used; i++) {
+        for (int j = 0; j < counter_count; j++) {
+          totals.values[j] += counter_blocks[i].values[j].load(std::memory_order_relaxed);
+        }
+      }
+      return totals;
+    }
   }
 
   phySphere::phySphere(glm::vec4 x,
@@ -67,6 +167,7 @@ namespace phy {
   bool
   phySphere::step(float deltaT) {
     if (plane) {
+      PHY_COUNT(counter_sphere_steps);
       // Next position if there were no obstacles.
       glm::vec3 targetPos = x + v * deltaT + 0.5f * a * deltaT * deltaT;
 
@@ -86,6 +187,11 @@ namespace phy {
       //
       // The bounding box is only applied to the x and z direction.
       if(plane->useBoundingBox) {
+        if (targetPos.x < plane->xStart + radius || targetPos.x > plane->xEnd - radius
+            || targetPos.z < plane->zStart + radius || targetPos.z > plane->zEnd - radius) {
+          PHY_COUNT(counter_outside_bounds);
+        }
+
         // maybe reflect in x direction
         if (targetPos.x  < plane->xStart + radius) {
           x.x = plane->xStart + radius + 0.0001f;
@@ -115,7 +221,7 @@ namespace phy {
         // ignoring the bounding box.
         if(targetPos.x < plane->xStart || targetPos.x > plane->xEnd
            || targetPos.z < plane->zStart || targetPos.z > plane->zEnd) {
-          // EMPTY
+          PHY_COUNT(counter_outside_bounds);
         } else {
           // inside bounding box, reflect
           if (plane->isAbove(targetPos)) {
@@ -173,6 +279,7 @@ namespace phy {
         if (x.y < -plane->zEnd || x.x < plane->xStart || x.x > plane->xEnd
             || x.z < plane->zStart || x.z > plane->zEnd) {
           plane = nullptr;
+          PHY_COUNT(counter_detachments);
         }
 
       }
@@ -221,6 +328,7 @@ namespace phy {
     // Set custom color for this sphere
     glUniform4fv(custom_color_loc, 1, &custom_color[0]);
     glDrawElements(GL_TRIANGLES, geo.vertex_count, GL_UNSIGNED_INT, (void*) 0);
+    draw_calls++;
   }
 
   phyPlane::phyPlane(float xStart,
@@ -284,7 +392,7 @@ namespace phy {
     // (m-2)*(n-2)*6 + 2*(n-2)*3 + 2*(m-2)*3 + 1 + 1 + 2 + 2
     //  = 6*(n*m - n - m + 1)
     n_vertices = 6 * (xNumPoints * zNumPoints - xNumPoints - zNumPoints + 1);
-    vbo_data = new float[n_vertices * 10];
+    vbo_data = memory_new_array<float>(memory_physics, (size_t)n_vertices * 10);
     float deltaX = (xEnd - xStart) / (xNumPoints - 1);
     float deltaZ = (zEnd - zStart) / (zNumPoints - 1);
 
@@ -392,20 +500,13 @@ namespace phy {
     // the collision detection methods.
     glGenBuffers(1, &vbo);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, n_vertices * 10 * sizeof(float), vbo_data, GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(3*sizeof(float)));
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(6*sizeof(float)));
-
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
+    glBufferData(GL_ARRAY_BUFFER, n_vertices * phy_vertex_layout::stride, vbo_data, GL_STATIC_DRAW);
+    phy_vertex_layout::setup();
   }
 
   phyPlane::~phyPlane() {
     destroy();
-    delete[] vbo_data;
+    memory_delete_array(memory_physics, vbo_data, (size_t)n_vertices * 10);
   }
 
   void
@@ -463,6 +564,8 @@ namespace phy {
   // transformations.
   int
   phyPlane::getTriangleAt(glm::vec3 pos) {
+    PHY_COUNT(counter_triangle_lookups);
+
     // coordinates in the plane:
     //  +----→ x
     //  |
@@ -654,6 +757,7 @@ namespace phy {
       }
     }
 
+    PHY_COUNT(counter_reflections);
     int index = getTriangleAt(s->x);
 
     // normal of the triangle's plane
@@ -695,24 +799,57 @@ namespace phy {
     glUniformMatrix4fv(model_mat_loc, 1, GL_FALSE, &model_mat[0][0]);
     glUniform4fv(custom_color_loc, 1, &custom_color[0]);
     glDrawArrays(GL_TRIANGLES, 0, n_vertices);
+    draw_calls++;
   }
 
   void
-  initShader() {
-    geo = loadMesh("sphere.obj", false);
-
-    unsigned int vertexShader = compileShader("physics.vert", GL_VERTEX_SHADER);
-    unsigned int fragmentShader = compileShader("physics.frag", GL_FRAGMENT_SHADER);
-    phyShaderProgram = linkProgram(vertexShader, fragmentShader);
-    // after linking the program the shader objects are no longer needed
-    glDeleteShader(fragmentShader);
-    glDeleteShader(vertexShader);
+  initShader(asset_loader *assets) {
+    if (assets) {
+      geo = assets->mesh("sphere.obj", false);
+      phyShaderProgram = assets->program("physics.vert", "physics.frag");
+    } else {
+      geo = loadMesh("sphere.obj", false);
+
+      unsigned int vertexShader = compileShader("physics.vert", GL_VERTEX_SHADER);
+      unsigned int fragmentShader = compileShader("physics.frag", GL_FRAGMENT_SHADER);
+      phyShaderProgram = linkProgram(vertexShader, fragmentShader);
+      // after linking the program the shader objects are no longer needed
+      glDeleteShader(fragmentShader);
+      glDeleteShader(vertexShader);
+    }
 
     light_dir_loc = glGetUniformLocation(phyShaderProgram, "light_dir");
     model_mat_loc = glGetUniformLocation(phyShaderProgram, "model_mat");
     proj_mat_loc = glGetUniformLocation(phyShaderProgram, "proj_mat");
     view_mat_loc = glGetUniformLocation(phyShaderProgram, "view_mat");
     custom_color_loc = glGetUniformLocation(phyShaderProgram, "custom_color");
+
+    phyInstancedShaderProgram = assets ? assets->program("physics_instanced.vert", "physics.frag")
+                                       : getShader("physics_instanced.vert", "physics.frag");
+    inst_light_dir_loc = glGetUniformLocation(phyInstancedShaderProgram, "light_dir");
+    inst_proj_mat_loc = glGetUniformLocation(phyInstancedShaderProgram, "proj_mat");
+    inst_view_mat_loc = glGetUniformLocation(phyInstancedShaderProgram, "view_mat");
+
+    // The instanced VAO shares the vertex and index buffers of the
+    // sphere mesh and adds the per-instance attributes 3 (center and
+    // radius) and 4 (custom color) from a streamed instance buffer.
+    glGenVertexArrays(1, &instance_vao);
+    glBindVertexArray(instance_vao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, geo.vbo);
+    mesh_vertex_layout::setup();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geo.ibo);
+
+    glGenBuffers(1, &instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, PHY_INSTANCE_FLOATS * sizeof(float), (void*)0);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, PHY_INSTANCE_FLOATS * sizeof(float), (void*)(4*sizeof(float)));
+    glVertexAttribDivisor(3, 1);
+    glVertexAttribDivisor(4, 1);
+    glEnableVertexAttribArray(3);
+    glEnableVertexAttribArray(4);
+
+    glBindVertexArray(0);
   }
 
   // Load the phyShaderProgram and set all values that are identical
@@ -727,6 +864,121 @@ namespace phy {
     glUniform3fv(light_dir_loc, 1, &light_dir[0]);
   }
 
+  namespace {
+    // Bind the instanced program and VAO and map room for
+    // @n_spheres instances in the instance buffer.
+    float *
+    beginInstances(camera *cam, glm::mat4 proj_matrix, glm::vec3 light_dir, int n_spheres) {
+      glUseProgram(phyInstancedShaderProgram);
+      glUniformMatrix4fv(inst_proj_mat_loc, 1, GL_FALSE, &proj_matrix[0][0]);
+      glUniformMatrix4fv(inst_view_mat_loc, 1, GL_FALSE, &cam->view_matrix()[0][0]);
+      glUniform3fv(inst_light_dir_loc, 1, &light_dir[0]);
+
+      glBindVertexArray(instance_vao);
+      glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+
+      // Only grow the buffer, invalidating the mapping below orphans
+      // the storage of the last frame without reallocating it.
+      if (n_spheres > instance_capacity) {
+        glBufferData(GL_ARRAY_BUFFER, n_spheres * PHY_INSTANCE_FLOATS * sizeof(float),
+                     nullptr, GL_STREAM_DRAW);
+        instance_capacity = n_spheres;
+      }
+
+      float *data = (float*) glMapBufferRange(GL_ARRAY_BUFFER, 0,
+                                              n_spheres * PHY_INSTANCE_FLOATS * sizeof(float),
+                                              GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+      if (!data) {
+        std::cerr << "phy:: mapping the instance buffer failed\n";
+        glBindVertexArray(0);
+      }
+      return data;
+    }
+
+    // Write center, radius and color of @s to @instance.
+    void
+    packInstance(float *instance, const phySphere *s) {
+      glm::vec4 center = s->x + s->offset_vec;
+      instance[0] = center.x;
+      instance[1] = center.y;
+      instance[2] = center.z;
+      instance[3] = s->radius;
+      instance[4] = s->custom_color.r;
+      instance[5] = s->custom_color.g;
+      instance[6] = s->custom_color.b;
+      instance[7] = s->custom_color.a;
+    }
+
+    // Unmap the instance buffer and draw the first @n_instances.
+    void
+    endInstances(int n_instances) {
+      glUnmapBuffer(GL_ARRAY_BUFFER);
+      if (n_instances > 0) {
+        glDrawElementsInstanced(GL_TRIANGLES, geo.vertex_count, GL_UNSIGNED_INT,
+                                (void*) 0, n_instances);
+        draw_calls++;
+      }
+      glBindVertexArray(0);
+    }
+  }
+
+  // Instanced counterpart of calling phySphere::render() for every
+  // visible sphere: the center, radius and color of all spheres with
+  // @frame > visibility_frame are streamed into the instance buffer
+  // and drawn with a single glDrawElementsInstanced call.
+  void
+  renderSpheres(camera *cam, glm::mat4 proj_matrix, glm::vec3 light_dir,
+                phySphere *const *spheres, int n_spheres, int frame) {
+    if (n_spheres <= 0) {
+      return;
+    }
+
+    float *data = beginInstances(cam, proj_matrix, light_dir, n_spheres);
+    if (!data) {
+      return;
+    }
+
+    int n_instances = 0;
+    for (int i = 0; i < n_spheres; i++) {
+      if (frame > spheres[i]->visibility_frame) {
+        packInstance(data + n_instances * PHY_INSTANCE_FLOATS, spheres[i]);
+        n_instances++;
+      }
+    }
+    endInstances(n_instances);
+  }
+
+  // Same as above, but only for the spheres whose indices are listed
+  // in @indices, e.g. the visible spheres reported by a
+  // sphere_culler.
+  void
+  renderSpheres(camera *cam, glm::mat4 proj_matrix, glm::vec3 light_dir,
+                phySphere *const *spheres, const int *indices, int n_indices) {
+    if (n_indices <= 0) {
+      return;
+    }
+
+    float *data = beginInstances(cam, proj_matrix, light_dir, n_indices);
+    if (!data) {
+      return;
+    }
+
+    for (int i = 0; i < n_indices; i++) {
+      packInstance(data + i * PHY_INSTANCE_FLOATS, spheres[indices[i]]);
+    }
+    endInstances(n_indices);
+  }
+
+  int
+  getDrawCalls() {
+    return draw_calls;
+  }
+
+  void
+  resetDrawCalls() {
+    draw_calls = 0;
+  }
+
   // Box-Muller Transform for gaussian random values
   float
   gauss_rand(float mean, float dev) {
@@ -735,4 +987,44 @@ namespace phy {
 	  float rsn = sqrt(-2.f * log(x)) * sin(2.f * 3.14159f * y);
 	  return mean + dev * rsn;
   }
+
+  phyCounters
+  collectCounters() {
+    std::lock_guard<std::mutex> lock(counter_mutex);
+    phyCounters totals = sumCounters();
+    phyCounters frame;
+    for (int i = 0; i < counter_count; i++) {
+      frame.values[i] = totals.values[i] - collected_totals.values[i];
+    }
+    collected_totals = totals;
+    return frame;
+  }
+
+  phyCounters
+  getCounterTotals() {
+    return sumCounters();
+  }
+
+  const char *
+  getCounterName(phyCounter counter) {
+    return counter >= 0 && counter < counter_count ? counter_names[counter] : "";
+  }
+
+  void
+  writeCounterHeader(std::ostream &out) {
+    out << "frame";
+    for (int i = 0; i < counter_count; i++) {
+      out << "," << counter_names[i];
+    }
+    out << "\n";
+  }
+
+  void
+  writeCounterLine(std::ostream &out, int frame, const phyCounters &counters) {
+    out << frame;
+    for (int i = 0; i < counter_count; i++) {
+      out << "," << counters.values[i];
+    }
+    out << "\n";
+  }
 }
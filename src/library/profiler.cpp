@@ -0,0 +1,283 @@
+#include "profiler.hpp"
+
+#ifdef ENABLE_PROFILER
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	enum event_type
+	{
+		event_scope,
+		event_counter,
+		event_frame
+	};
+
+	// A recorded scope (start, end), counter (start, value) or frame
+	// mark (start)
+	struct event
+	{
+		const char * name;
+		uint64_t start;
+		uint64_t end;
+		double value;
+		int frame;
+		int type;
+	};
+
+	// The ring buffer of one thread, only that thread writes to it
+	struct thread_buffer
+	{
+		std::vector<event> events;
+		// Number of events recorded so far, the latest ones are at
+		// (written - 1) % size, (written - 2) % size, ...
+		std::atomic<uint64_t> written;
+		int id;
+		std::string name;
+	};
+
+	// All buffers, they live until the end of the program so that
+	// the events of finished threads can still be exported
+	std::mutex registry_mutex;
+	std::vector<std::unique_ptr<thread_buffer>> registry;
+
+	// Frame that the events belong to, -1 before the first frame
+	std::atomic<int> current_frame(-1);
+
+	thread_local thread_buffer * local_buffer = nullptr;
+
+	// Get the buffer of the calling thread, creating it on first use
+	thread_buffer & get_buffer()
+	{
+		if (!local_buffer)
+		{
+			std::unique_ptr<thread_buffer> buffer(new thread_buffer());
+			buffer->events.resize(PROFILER_EVENTS_PER_THREAD);
+			buffer->written = 0;
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			buffer->id = (int)registry.size() + 1;
+			local_buffer = buffer.get();
+			registry.push_back(std::move(buffer));
+		}
+		return *local_buffer;
+	}
+
+	// Append an event to the buffer of the calling thread
+	void push(const char * name, uint64_t start, uint64_t end, double value, int type)
+	{
+		thread_buffer & buffer = get_buffer();
+		uint64_t index = buffer.written.load(std::memory_order_relaxed);
+		event & entry = buffer.events[index % buffer.events.size()];
+		entry.name = name;
+		entry.start = start;
+		entry.end = end;
+		entry.value = value;
+		entry.frame = current_frame.load(std::memory_order_relaxed);
+		entry.type = type;
+		buffer.written.store(index + 1, std::memory_order_release);
+	}
+
+	// Copy the events still in a buffer, oldest first
+	std::vector<event> collect(const thread_buffer & buffer)
+	{
+		uint64_t written = buffer.written.load(std::memory_order_acquire);
+		uint64_t size = buffer.events.size();
+		uint64_t first = written > size ? written - size : 0;
+		std::vector<event> events;
+		events.reserve((size_t)(written - first));
+		for (uint64_t i = first; i < written; i++)
+		{
+			events.push_back(buffer.events[i % size]);
+		}
+		return events;
+	}
+
+	// Nearest rank percentile of sorted values
+	double percentile(const std::vector<double> & sorted, double p)
+	{
+		size_t rank = (size_t)(p / 100.0 * sorted.size() + 0.5);
+		rank = rank < 1 ? 1 : rank > sorted.size() ? sorted.size() : rank;
+		return sorted[rank - 1];
+	}
+
+	// Print one line of the report
+	void report_line(std::ostream & out, const char * name, std::vector<double> & values)
+	{
+		std::sort(values.begin(), values.end());
+		double sum = 0.0;
+		for (size_t i = 0; i < values.size(); i++)
+		{
+			sum += values[i];
+		}
+		char line[256];
+		snprintf(line, sizeof(line), "  %-28s %6zu %10.3f %10.3f %10.3f %10.3f\n", name, values.size(),
+			sum / values.size(), percentile(values, 50.0), percentile(values, 95.0), percentile(values, 99.0));
+		out << line;
+	}
+
+	// Write a string as a JSON string
+	void write_json_string(FILE * file, const char * text)
+	{
+		fputc('"', file);
+		for (const char * c = text; *c; c++)
+		{
+			if (*c == '"' || *c == '\\')
+			{
+				fputc('\\', file);
+			}
+			fputc(*c, file);
+		}
+		fputc('"', file);
+	}
+}
+
+namespace profiler
+{
+	// Nanoseconds since the first call
+	uint64_t now()
+	{
+		static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - origin).count();
+	}
+
+	// Record a finished scope
+	void record_scope(const char * name, uint64_t start, uint64_t end)
+	{
+		push(name, start, end, 0.0, event_scope);
+	}
+
+	// Record the value of a counter
+	void counter(const char * name, double value)
+	{
+		uint64_t time = now();
+		push(name, time, time, value, event_counter);
+	}
+
+	// Mark the start of a frame
+	void begin_frame(int frame)
+	{
+		current_frame.store(frame, std::memory_order_relaxed);
+		uint64_t time = now();
+		push("frame", time, time, (double)frame, event_frame);
+	}
+
+	// Name the calling thread in the trace
+	void set_thread_name(const char * name)
+	{
+		get_buffer().name = name;
+	}
+
+	// Print the statistics per frame of all scopes and counters
+	void report(std::ostream & out)
+	{
+		// Time per frame of every scope (summed over all threads and
+		// calls) and the last value per frame of every counter
+		std::map<std::string, std::map<int, double>> scopes;
+		std::map<std::string, std::map<int, double>> counters;
+		{
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			for (size_t i = 0; i < registry.size(); i++)
+			{
+				std::vector<event> events = collect(*registry[i]);
+				for (size_t j = 0; j < events.size(); j++)
+				{
+					const event & entry = events[j];
+					if (entry.type == event_scope)
+					{
+						scopes[entry.name][entry.frame] += (entry.end - entry.start) * 1e-6;
+					}
+					else if (entry.type == event_counter)
+					{
+						counters[entry.name][entry.frame] = entry.value;
+					}
+				}
+			}
+		}
+
+		char line[256];
+		snprintf(line, sizeof(line), "profiler:: %-28s %6s %10s %10s %10s %10s\n",
+			"per frame", "frames", "mean", "p50", "p95", "p99");
+		out << line;
+		for (auto & scope : scopes)
+		{
+			std::vector<double> values;
+			for (auto & frame : scope.second)
+			{
+				values.push_back(frame.second);
+			}
+			report_line(out, (scope.first + " [ms]").c_str(), values);
+		}
+		for (auto & named : counters)
+		{
+			std::vector<double> values;
+			for (auto & frame : named.second)
+			{
+				values.push_back(frame.second);
+			}
+			report_line(out, named.first.c_str(), values);
+		}
+	}
+
+	// Write all recorded events as Chrome trace event JSON
+	bool write_trace(const std::string & path)
+	{
+		FILE * file = fopen(path.c_str(), "w");
+		if (!file)
+		{
+			return false;
+		}
+
+		fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+		bool first = true;
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		for (size_t i = 0; i < registry.size(); i++)
+		{
+			const thread_buffer & buffer = *registry[i];
+			if (!buffer.name.empty())
+			{
+				fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+					first ? "" : ",\n", buffer.id);
+				write_json_string(file, buffer.name.c_str());
+				fputs("}}", file);
+				first = false;
+			}
+
+			// Times are in microseconds
+			std::vector<event> events = collect(buffer);
+			for (size_t j = 0; j < events.size(); j++)
+			{
+				const event & entry = events[j];
+				fputs(first ? "{\"name\":" : ",\n{\"name\":", file);
+				first = false;
+				write_json_string(file, entry.name);
+				if (entry.type == event_scope)
+				{
+					fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%d}}",
+						buffer.id, entry.start * 1e-3, (entry.end - entry.start) * 1e-3, entry.frame);
+				}
+				else if (entry.type == event_counter)
+				{
+					fprintf(file, ",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"value\":%g}}",
+						buffer.id, entry.start * 1e-3, entry.value);
+				}
+				else
+				{
+					fprintf(file, ",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"frame\":%d}}",
+						buffer.id, entry.start * 1e-3, entry.frame);
+				}
+			}
+		}
+		fputs("\n]}\n", file);
+		return fclose(file) == 0;
+	}
+}
+
+#endif // ENABLE_PROFILER
@@ -17,14 +17,19 @@ loadShaderFile(const char* filename) {
 unsigned int
 compileShader(const char* filename, unsigned int type) {
     const char* shaderSource = loadShaderFile(filename);
+    unsigned int shader = compileShaderSource(shaderSource, type);
+    // source code is no longer needed
+    delete [] shaderSource;
+    return shader;
+}
 
+unsigned int
+compileShaderSource(const char* shaderSource, unsigned int type) {
     // create shader object
     unsigned int shader = glCreateShader(type);
     glShaderSource(shader, 1, &shaderSource, NULL);
     // try to compile
     glCompileShader(shader);
-    // source code is no longer needed
-    delete [] shaderSource;
 
     // check if compilation succeeded
     int  success;
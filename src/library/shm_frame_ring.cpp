@@ -0,0 +1,307 @@
+#include "shm_frame_ring.hpp"
+
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Size reserved for the header in front of the slots
+#define SHM_FRAME_HEADER_SIZE 4096
+
+static_assert(sizeof(shm_frame_ring::header) <= SHM_FRAME_HEADER_SIZE, "header does not fit");
+
+namespace
+{
+	// Wait until done() returns true, spinning briefly before sleeping
+	template <typename F>
+	bool wait_until(const F & done, double timeout_seconds = -1.0)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; !done(); i++)
+		{
+			if (i < 64)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			if (timeout_seconds >= 0.0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > timeout_seconds)
+			{
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		return true;
+	}
+}
+
+// Create a ring for the producer
+shm_frame_ring::shm_frame_ring(const std::string & name, int width, int height, int slot_count, uint32_t flags)
+{
+	this->name = name;
+	this->producer = true;
+	this->memory = nullptr;
+	this->memory_size = 0;
+	this->shared = nullptr;
+	this->slots = nullptr;
+	this->stalls = 0;
+	this->stall_seconds = 0.0;
+
+#ifdef __linux__
+	slot_count = slot_count < 1 ? 1 : slot_count;
+	size_t frame_size = (size_t)4 * width * height;
+	size_t slot_stride = (frame_size + 4095) & ~(size_t)4095;
+
+	// Start from a fresh object, a crashed run may have left one
+	shm_unlink(name.c_str());
+	int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0)
+	{
+		std::cerr << "shm_frame_ring:: cannot create " << name << ": " << strerror(errno) << "\n";
+		return;
+	}
+	size_t size = SHM_FRAME_HEADER_SIZE + slot_stride * slot_count;
+	if (ftruncate(fd, (off_t)size) != 0 || !map(fd, size))
+	{
+		std::cerr << "shm_frame_ring:: cannot allocate " << size << " bytes for " << name << "\n";
+		::close(fd);
+		shm_unlink(name.c_str());
+		return;
+	}
+	::close(fd);
+
+	// The memory is zero-filled, so the counters start at zero
+	shared->version = SHM_FRAME_VERSION;
+	shared->width = width;
+	shared->height = height;
+	shared->slot_count = slot_count;
+	shared->flags = flags;
+	shared->frame_size = frame_size;
+	shared->slot_stride = slot_stride;
+	// The consumer only looks at the header once the magic is set
+	shared->magic.store(SHM_FRAME_MAGIC, std::memory_order_release);
+#else
+	(void)width; (void)height; (void)slot_count; (void)flags;
+	std::cerr << "shm_frame_ring:: shared memory transport is only supported on Linux\n";
+#endif
+}
+
+// Attach to an existing ring as the consumer
+shm_frame_ring::shm_frame_ring(const std::string & name, double timeout_seconds)
+{
+	this->name = name;
+	this->producer = false;
+	this->memory = nullptr;
+	this->memory_size = 0;
+	this->shared = nullptr;
+	this->slots = nullptr;
+	this->stalls = 0;
+	this->stall_seconds = 0.0;
+
+#ifdef __linux__
+	// Wait for the producer to create and initialize the object
+	int fd = -1;
+	bool created = wait_until([&] {
+		fd = shm_open(name.c_str(), O_RDWR, 0);
+		if (fd < 0)
+		{
+			return false;
+		}
+		struct stat info;
+		if (fstat(fd, &info) == 0 && info.st_size >= SHM_FRAME_HEADER_SIZE)
+		{
+			return true;
+		}
+		::close(fd);
+		return false;
+	}, timeout_seconds);
+	if (!created)
+	{
+		std::cerr << "shm_frame_ring:: " << name << " has not been created\n";
+		return;
+	}
+
+	struct stat info;
+	fstat(fd, &info);
+	bool mapped = map(fd, (size_t)info.st_size);
+	::close(fd);
+	if (!mapped || !wait_until([&] { return shared->magic.load(std::memory_order_acquire) == SHM_FRAME_MAGIC; }, timeout_seconds))
+	{
+		std::cerr << "shm_frame_ring:: " << name << " is not a frame ring\n";
+		shared = nullptr;
+		return;
+	}
+	if (shared->version != SHM_FRAME_VERSION)
+	{
+		std::cerr << "shm_frame_ring:: " << name << " has version " << shared->version
+				  << ", expected " << SHM_FRAME_VERSION << "\n";
+		shared = nullptr;
+		return;
+	}
+	shared->consumer_attached.store(1, std::memory_order_release);
+#else
+	(void)timeout_seconds;
+	std::cerr << "shm_frame_ring:: shared memory transport is only supported on Linux\n";
+#endif
+}
+
+// Unmap, the producer also closes the stream and removes the name
+shm_frame_ring::~shm_frame_ring()
+{
+#ifdef __linux__
+	if (producer && shared)
+	{
+		close();
+		shm_unlink(name.c_str());
+	}
+	if (memory)
+	{
+		munmap(memory, memory_size);
+	}
+#endif
+}
+
+// Map the object of file descriptor fd with the given size
+bool shm_frame_ring::map(int fd, size_t size)
+{
+#ifdef __linux__
+	void * address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (address == MAP_FAILED)
+	{
+		return false;
+	}
+	memory = (unsigned char *)address;
+	memory_size = size;
+	shared = (header *)memory;
+	slots = memory + SHM_FRAME_HEADER_SIZE;
+	return true;
+#else
+	(void)fd; (void)size;
+	return false;
+#endif
+}
+
+// Whether the ring has been created or attached successfully
+bool shm_frame_ring::is_valid() const
+{
+	return shared != nullptr;
+}
+
+// Producer: get the slot of the next frame
+unsigned char * shm_frame_ring::acquire(double timeout_seconds)
+{
+	uint64_t write_seq = shared->write_seq.load(std::memory_order_relaxed);
+	auto slot_free = [&] {
+		return write_seq - shared->read_seq.load(std::memory_order_acquire) < shared->slot_count;
+	};
+	if (!slot_free())
+	{
+		auto start = std::chrono::steady_clock::now();
+		bool released = wait_until(slot_free, timeout_seconds);
+		stalls++;
+		stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (!released)
+		{
+			return nullptr;
+		}
+	}
+	return slots + (write_seq % shared->slot_count) * shared->slot_stride;
+}
+
+// Producer: publish the frame in the acquired slot
+void shm_frame_ring::publish()
+{
+	shared->write_seq.fetch_add(1, std::memory_order_release);
+}
+
+// Producer: mark the end of the stream
+void shm_frame_ring::close()
+{
+	shared->closed.store(1, std::memory_order_release);
+}
+
+// Consumer: get the next frame, nullptr at the end of the stream
+const unsigned char * shm_frame_ring::wait_frame()
+{
+	uint64_t read_seq = shared->read_seq.load(std::memory_order_relaxed);
+	bool available = false;
+	wait_until([&] {
+		// Check closed first, so a frame published right before
+		// closing is not missed
+		bool closed = shared->closed.load(std::memory_order_acquire) != 0;
+		available = shared->write_seq.load(std::memory_order_acquire) > read_seq;
+		return available || closed;
+	});
+	if (!available)
+	{
+		return nullptr;
+	}
+	return slots + (read_seq % shared->slot_count) * shared->slot_stride;
+}
+
+// Consumer: release the frame returned by wait_frame
+void shm_frame_ring::release()
+{
+	shared->read_seq.fetch_add(1, std::memory_order_release);
+}
+
+// Get the properties of the frames
+int shm_frame_ring::get_width() const
+{
+	return (int)shared->width;
+}
+
+int shm_frame_ring::get_height() const
+{
+	return (int)shared->height;
+}
+
+size_t shm_frame_ring::get_frame_size() const
+{
+	return (size_t)shared->frame_size;
+}
+
+uint32_t shm_frame_ring::get_flags() const
+{
+	return shared->flags;
+}
+
+int shm_frame_ring::get_slot_count() const
+{
+	return (int)shared->slot_count;
+}
+
+// Get the number of frames published and released so far
+uint64_t shm_frame_ring::get_published() const
+{
+	return shared->write_seq.load(std::memory_order_acquire);
+}
+
+uint64_t shm_frame_ring::get_released() const
+{
+	return shared->read_seq.load(std::memory_order_acquire);
+}
+
+// Whether a consumer has attached
+bool shm_frame_ring::is_consumer_attached() const
+{
+	return shared->consumer_attached.load(std::memory_order_acquire) != 0;
+}
+
+// Get the number of producer stalls and the time spent in them
+int shm_frame_ring::get_stalls() const
+{
+	return stalls;
+}
+
+double shm_frame_ring::get_stall_seconds() const
+{
+	return stall_seconds;
+}
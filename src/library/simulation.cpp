@@ -0,0 +1,363 @@
+#include "simulation.hpp"
+#include "profiler.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#ifndef M_PI
+#define M_PI 3.14159265359
+#endif
+
+// Identifies a snapshot file ("CGSS") and the version of its layout
+#define SNAPSHOT_MAGIC 0x53534743u
+#define SNAPSHOT_VERSION 2u
+
+namespace
+{
+	// Write a value as raw bytes
+	template <typename T>
+	bool write_value(FILE * file, const T & value)
+	{
+		return fwrite(&value, sizeof(T), 1, file) == 1;
+	}
+
+	// Read a value as raw bytes
+	template <typename T>
+	bool read_value(FILE * file, T & value)
+	{
+		return fread(&value, sizeof(T), 1, file) == 1;
+	}
+}
+
+// Write a snapshot to a file
+bool save_snapshot(const std::string & path, const simulation_snapshot & snapshot)
+{
+	FILE * file = fopen(path.c_str(), "wb");
+	if (!file)
+	{
+		std::cerr << "simulation:: cannot write snapshot " << path << "\n";
+		return false;
+	}
+
+	unsigned int sphere_count = (unsigned int)snapshot.spheres.size();
+	bool written = write_value(file, SNAPSHOT_MAGIC)
+		&& write_value(file, SNAPSHOT_VERSION)
+		&& write_value(file, snapshot.frame)
+		&& write_value(file, snapshot.seed)
+		&& write_value(file, snapshot.plane_model_mat)
+		&& write_value(file, snapshot.plane_inv_model_mat)
+		&& write_value(file, snapshot.angular_velocity)
+		&& write_value(file, snapshot.vertical_velocity)
+		&& write_value(file, snapshot.angular_velocity_active)
+		&& write_value(file, snapshot.vertical_velocity_active)
+		&& write_value(file, snapshot.terrain_frame)
+		&& write_value(file, snapshot.camera_phi)
+		&& write_value(file, snapshot.camera_theta)
+		&& write_value(file, snapshot.camera_distance)
+		&& write_value(file, sphere_count);
+	if (written && sphere_count > 0)
+	{
+		written = fwrite(snapshot.spheres.data(), sizeof(simulation_snapshot::sphere_state), sphere_count, file) == sphere_count;
+	}
+
+	if (fclose(file) != 0 || !written)
+	{
+		std::cerr << "simulation:: cannot write snapshot " << path << "\n";
+		return false;
+	}
+	return true;
+}
+
+// Read a snapshot from a file
+bool load_snapshot(const std::string & path, simulation_snapshot & snapshot)
+{
+	FILE * file = fopen(path.c_str(), "rb");
+	if (!file)
+	{
+		std::cerr << "simulation:: cannot read snapshot " << path << "\n";
+		return false;
+	}
+
+	unsigned int magic = 0;
+	unsigned int version = 0;
+	unsigned int sphere_count = 0;
+	bool read = read_value(file, magic) && magic == SNAPSHOT_MAGIC
+		&& read_value(file, version) && version == SNAPSHOT_VERSION
+		&& read_value(file, snapshot.frame)
+		&& read_value(file, snapshot.seed)
+		&& read_value(file, snapshot.plane_model_mat)
+		&& read_value(file, snapshot.plane_inv_model_mat)
+		&& read_value(file, snapshot.angular_velocity)
+		&& read_value(file, snapshot.vertical_velocity)
+		&& read_value(file, snapshot.angular_velocity_active)
+		&& read_value(file, snapshot.vertical_velocity_active)
+		&& read_value(file, snapshot.terrain_frame)
+		&& read_value(file, snapshot.camera_phi)
+		&& read_value(file, snapshot.camera_theta)
+		&& read_value(file, snapshot.camera_distance)
+		&& read_value(file, sphere_count);
+	if (read)
+	{
+		snapshot.spheres.resize(sphere_count);
+		read = sphere_count == 0
+			|| fread(snapshot.spheres.data(), sizeof(simulation_snapshot::sphere_state), sphere_count, file) == sphere_count;
+	}
+	fclose(file);
+
+	if (!read)
+	{
+		std::cerr << "simulation:: " << path << " is not a valid snapshot\n";
+		return false;
+	}
+	return true;
+}
+
+// Build the scene
+simulation::simulation(const simulation_settings & settings, asset_loader * assets)
+{
+	this->settings = settings;
+	this->frame = 0;
+	this->angular_velocity = settings.tilt_angular_velocity;
+	this->vertical_velocity = settings.drop_initial_velocity;
+
+	// Prepare terrain
+	terr = new terrain(settings.terrain_size,
+					   settings.terrain_resolution,
+					   0,
+					   settings.terrain_frames,
+					   settings.stone,
+					   settings.grass,
+					   settings.snow,
+					   settings.seed,
+					   assets);
+
+	// Prepare physics plane
+	plane = new phy::phyPlane(-settings.terrain_size / 2.f,
+							  settings.terrain_size / 2.f,
+							  -settings.terrain_size / 2.f,
+							  settings.terrain_size / 2.f,
+							  terr->heights,
+							  settings.terrain_resolution,
+							  settings.terrain_resolution,
+							  false,
+							  nullptr,
+							  nullptr,
+							  glm::vec4(0.9f, 0.9f, 0.9f, 1.f));
+
+	// Set model matrices
+	plane->set_model_mat(glm::mat4(1.f));
+	terr->set_model_mat(plane->get_model_mat());
+
+	// Prepare spheres, the appearance frames are random but
+	// reproducible through the seed
+	srand(settings.seed);
+	int x_n = settings.x_spheres;
+	int z_n = settings.z_spheres;
+	float dx = (plane->xEnd - plane->xStart) / x_n;
+	float dz = (plane->zEnd - plane->zStart) / z_n;
+	spheres.resize(x_n * z_n);
+	for (int x = 0; x < x_n; x++) {
+		for (int z = 0; z < z_n; z++) {
+			spheres[x * z_n + z]
+				= new phy::phySphere(glm::vec4(plane->xStart + x * dx,
+											   settings.sphere_drop_height,
+											   plane->zStart + z * dz,
+											   1.f),
+									 glm::vec4(0.f, 0.f, 0.f, 0.f),
+									 settings.sphere_radius,
+									 plane,
+									 glm::vec4(sin(x * M_PI / x_n), cos(z * M_PI / z_n) / 2.f + 0.5f, exp(x * z / x_n / z_n) / 2.718282f, 1.f),
+									 settings.sphere_appearance_frame + phy::gauss_rand(0, 60));
+		}
+	}
+}
+
+// Clean up
+simulation::~simulation()
+{
+	for (size_t i = 0; i < spheres.size(); i++)
+	{
+		delete spheres[i];
+	}
+	delete plane;
+	delete terr;
+}
+
+// Apply the events of the timeline at the current frame
+void simulation::apply_timeline()
+{
+	// Tilting
+	if (frame == settings.tilt_vertically_start_frame) {
+		angular_velocity = settings.tilt_vertically_angular_velocity;
+		plane->set_angular_velocity(&angular_velocity);
+	} else if (frame == settings.tilt_vertically_end_frame) {
+		plane->set_angular_velocity(nullptr);
+	} else if (frame == settings.tilt_start_frame) {
+		plane->set_angular_velocity(&angular_velocity);
+	} else if (frame == settings.tilt_end_frame) {
+		plane->set_angular_velocity(nullptr);
+	} else if (frame == settings.tilt_start_frame + settings.tilt_interval / 2) {
+		angular_velocity *= -1;
+		// The the first tilt only take (tilt_interval / 2) frames
+		// make tilting symmetric
+	} else if ((frame - (settings.tilt_start_frame + settings.tilt_interval / 2))
+			   % settings.tilt_interval == 0
+			   && (frame < settings.tilt_end_frame)) {
+		// All but the first tilt take tilt_interval frames
+		angular_velocity *= -1;
+	}
+
+	// Dropping
+	if (frame == settings.drop_start_frame) {
+		plane->set_vertical_velocity(&vertical_velocity);
+	} else if (frame > settings.drop_start_frame) {
+		vertical_velocity *= settings.drop_factor;
+	}
+}
+
+// Simulate the next frame and return its index
+int simulation::step()
+{
+	int stepped = step_physics();
+	// Copy transformations to the terrain
+	terr->set_model_mat(plane->get_model_mat());
+	return stepped;
+}
+
+// Simulate the next frame without updating the terrain
+int simulation::step_physics()
+{
+	apply_timeline();
+
+	// Apply plane transformations
+	plane->step(settings.seconds_per_frame);
+
+	// Let the spheres fall
+	if (frame >= settings.sphere_release_frame) {
+		PROFILE_SCOPE("spheres step");
+		for (size_t i = 0; i < spheres.size(); i++) {
+			spheres[i]->step(settings.sphere_time_step);
+		}
+	}
+
+	return frame++;
+}
+
+// Get the next frame that will be simulated
+int simulation::get_frame()
+{
+	return frame;
+}
+
+// Simulate without rendering until frame is the next frame
+void simulation::fast_forward(int frame, camera & cam)
+{
+	while (this->frame < frame)
+	{
+		step();
+		// Done by terrain::render() and the render loop otherwise
+		terr->increase_current_frame();
+		cam.rotate();
+	}
+}
+
+// Get the terrain
+terrain & simulation::get_terrain()
+{
+	return *terr;
+}
+
+// Get the physics plane
+phy::phyPlane & simulation::get_plane()
+{
+	return *plane;
+}
+
+// Get the spheres
+phy::phySphere ** simulation::get_spheres()
+{
+	return spheres.data();
+}
+
+// Get the number of spheres
+int simulation::get_sphere_count()
+{
+	return (int)spheres.size();
+}
+
+// Capture the state before the next frame
+simulation_snapshot simulation::capture(const camera & cam)
+{
+	simulation_snapshot snapshot;
+	snapshot.frame = frame;
+	snapshot.seed = settings.seed;
+	snapshot.plane_model_mat = plane->model_mat;
+	snapshot.plane_inv_model_mat = plane->inv_model_mat;
+	snapshot.angular_velocity = angular_velocity;
+	snapshot.vertical_velocity = vertical_velocity;
+	snapshot.angular_velocity_active = plane->angular_velocity != nullptr;
+	snapshot.vertical_velocity_active = plane->vertical_velocity != nullptr;
+	snapshot.terrain_frame = terr->get_current_frame();
+	snapshot.camera_phi = cam.get_phi();
+	snapshot.camera_theta = cam.get_theta();
+	snapshot.camera_distance = cam.get_distance();
+
+	snapshot.spheres.resize(spheres.size());
+	for (size_t i = 0; i < spheres.size(); i++)
+	{
+		const phy::phySphere * sphere = spheres[i];
+		simulation_snapshot::sphere_state & state = snapshot.spheres[i];
+		// Zero the padding, so that equal states have equal bytes
+		memset(&state, 0, sizeof(state));
+		state.x = sphere->x;
+		state.v = sphere->v;
+		state.a = sphere->a;
+		state.offset_vec = sphere->offset_vec;
+		state.custom_color = sphere->custom_color;
+		state.radius = sphere->radius;
+		state.visibility_frame = sphere->visibility_frame;
+		state.last_triangle_index = sphere->lastTriangleIndex;
+		state.touched_plane_last_step = sphere->touched_plane_last_step;
+		state.attached = sphere->plane != nullptr;
+	}
+	return snapshot;
+}
+
+// Continue from a snapshot
+bool simulation::restore(const simulation_snapshot & snapshot, camera & cam)
+{
+	if (snapshot.spheres.size() != spheres.size() || snapshot.seed != settings.seed)
+	{
+		std::cerr << "simulation:: snapshot of frame " << snapshot.frame << " does not fit the scene\n";
+		return false;
+	}
+
+	frame = snapshot.frame;
+	plane->model_mat = snapshot.plane_model_mat;
+	plane->inv_model_mat = snapshot.plane_inv_model_mat;
+	angular_velocity = snapshot.angular_velocity;
+	vertical_velocity = snapshot.vertical_velocity;
+	plane->set_angular_velocity(snapshot.angular_velocity_active ? &angular_velocity : nullptr);
+	plane->set_vertical_velocity(snapshot.vertical_velocity_active ? &vertical_velocity : nullptr);
+	terr->set_model_mat(plane->get_model_mat());
+	terr->set_current_frame(snapshot.terrain_frame);
+	cam.set_orbit(snapshot.camera_phi, snapshot.camera_theta, snapshot.camera_distance);
+
+	for (size_t i = 0; i < spheres.size(); i++)
+	{
+		phy::phySphere * sphere = spheres[i];
+		const simulation_snapshot::sphere_state & state = snapshot.spheres[i];
+		sphere->x = state.x;
+		sphere->v = state.v;
+		sphere->a = state.a;
+		sphere->offset_vec = state.offset_vec;
+		sphere->custom_color = state.custom_color;
+		sphere->radius = state.radius;
+		sphere->visibility_frame = state.visibility_frame;
+		sphere->lastTriangleIndex = state.last_triangle_index;
+		sphere->touched_plane_last_step = state.touched_plane_last_step != 0;
+		// Spheres that left the plane fall freely
+		sphere->plane = state.attached ? plane : nullptr;
+	}
+	return true;
+}
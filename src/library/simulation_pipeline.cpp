@@ -0,0 +1,167 @@
+#include "simulation_pipeline.hpp"
+#include "profiler.hpp"
+
+#include <chrono>
+
+// Times a waiting side yields before it starts to sleep, and the
+// length of a sleep in microseconds
+#define PIPELINE_SPIN_COUNT 64
+#define PIPELINE_SLEEP_US 20
+
+namespace
+{
+	// Wait until done() returns true, spinning first and then sleeping
+	template <typename F>
+	void wait_until(F done)
+	{
+		for (int i = 0; !done(); i++)
+		{
+			if (i < PIPELINE_SPIN_COUNT)
+			{
+				std::this_thread::yield();
+			}
+			else
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(PIPELINE_SLEEP_US));
+			}
+		}
+	}
+}
+
+// Prepare the states for the spheres of the simulation
+simulation_pipeline::simulation_pipeline(simulation & sim) : sim(sim)
+{
+	produced = 0;
+	consumed = 0;
+	stopping = false;
+	next_frame = 0;
+
+	phy::phySphere ** spheres = sim.get_spheres();
+	int count = sim.get_sphere_count();
+	for (int i = 0; i < 2; i++)
+	{
+		states[i].frame = -1;
+		states[i].spheres.reserve(count);
+		for (int j = 0; j < count; j++)
+		{
+			states[i].spheres.push_back(*spheres[j]);
+		}
+		states[i].sphere_pointers.resize(count);
+		for (int j = 0; j < count; j++)
+		{
+			states[i].sphere_pointers[j] = &states[i].spheres[j];
+		}
+	}
+}
+
+// Stop the simulation thread
+simulation_pipeline::~simulation_pipeline()
+{
+	stop();
+}
+
+// Simulate the next frame into a state
+void simulation_pipeline::simulate(render_state & state)
+{
+	{
+		PROFILE_SCOPE("simulate");
+		state.frame = sim.step_physics();
+	}
+	state.plane_model_mat = sim.get_plane().get_model_mat();
+	phy::phySphere ** spheres = sim.get_spheres();
+	for (size_t i = 0; i < state.spheres.size(); i++)
+	{
+		state.spheres[i] = *spheres[i];
+	}
+	state.counters = phy::collectCounters();
+}
+
+// Main loop of the simulation thread
+void simulation_pipeline::simulation_loop()
+{
+	PROFILE_THREAD_NAME("simulation");
+	for (;;)
+	{
+		// Wait until the renderer released the older state
+		unsigned int head = produced.load(std::memory_order_relaxed);
+		wait_until([&] {
+			return head - consumed.load(std::memory_order_acquire) < 2 || stopping.load(std::memory_order_relaxed);
+		});
+		if (stopping.load(std::memory_order_relaxed))
+		{
+			return;
+		}
+
+		simulate(states[head % 2]);
+		produced.store(head + 1, std::memory_order_release);
+	}
+}
+
+// Start simulating on a thread of its own
+void simulation_pipeline::start()
+{
+	if (thread.joinable())
+	{
+		return;
+	}
+	stopping = false;
+	produced = 0;
+	consumed = 0;
+	next_frame = sim.get_frame();
+	thread = std::thread(&simulation_pipeline::simulation_loop, this);
+}
+
+// Stop the thread
+void simulation_pipeline::stop()
+{
+	if (!thread.joinable())
+	{
+		return;
+	}
+	stopping = true;
+	thread.join();
+	thread = std::thread();
+}
+
+// Whether the simulation runs on its own thread
+bool simulation_pipeline::is_threaded() const
+{
+	return thread.joinable();
+}
+
+// Get the state of the next frame
+const render_state & simulation_pipeline::acquire()
+{
+	if (!thread.joinable())
+	{
+		simulate(states[0]);
+		return states[0];
+	}
+
+	unsigned int tail = consumed.load(std::memory_order_relaxed);
+	if (produced.load(std::memory_order_acquire) == tail)
+	{
+		PROFILE_SCOPE("wait for simulation");
+		wait_until([&] { return produced.load(std::memory_order_acquire) != tail; });
+	}
+	return states[tail % 2];
+}
+
+// Done with the state of acquire()
+void simulation_pipeline::release()
+{
+	if (thread.joinable())
+	{
+		// The state may be overwritten as soon as it is released
+		unsigned int tail = consumed.load(std::memory_order_relaxed);
+		next_frame = states[tail % 2].frame + 1;
+		consumed.store(tail + 1, std::memory_order_release);
+	}
+}
+
+// Get the next frame that will be rendered
+int simulation_pipeline::get_frame() const
+{
+	// Serially the simulation is at the next frame between the frames
+	return thread.joinable() ? next_frame : sim.get_frame();
+}
@@ -0,0 +1,182 @@
+#include "static_batch.hpp"
+#include "buffer.hpp"
+
+#include <algorithm>
+#include <utility>
+
+// Delete the buffers
+static_batch::~static_batch()
+{
+	destroy();
+}
+
+// Add a mesh with its transform applied
+void static_batch::add(const geometry & m)
+{
+	// Meshes built in place keep their data in m.data
+	const geometry_data & data = m.data;
+	bool in_place = data.vertex_count() > 0;
+	size_t n_vertices = in_place ? data.vertex_count() : m.positions.size();
+	size_t n_faces = in_place ? data.face_count() : m.faces.size();
+
+	glm::mat3 normal_mat = glm::transpose(glm::inverse(glm::mat3(m.transform)));
+	size_t first_vertex = vertex_count;
+	staged_vertices.resize((vertex_count + n_vertices) * mesh_vertex_layout::stride);
+	void * vertices = staged_vertices.data();
+	for (size_t i = 0; i < n_vertices; i++)
+	{
+		glm::vec3 position = in_place ? mesh_vertex_layout::read<0>(data.vertex_data(), i) : m.positions[i];
+		glm::vec3 normal = in_place ? mesh_vertex_layout::read<1>(data.vertex_data(), i) : m.normals[i];
+		glm::vec4 color = in_place ? mesh_vertex_layout::read<2>(data.vertex_data(), i) : m.colors[i];
+		normal = normal_mat * normal;
+		float length = glm::length(normal);
+		mesh_vertex_layout::write<0>(vertices, first_vertex + i, glm::vec3(m.transform * glm::vec4(position, 1.f)));
+		mesh_vertex_layout::write<1>(vertices, first_vertex + i, length > 0.f ? normal / length : normal);
+		mesh_vertex_layout::write<2>(vertices, first_vertex + i, color);
+	}
+	vertex_count += n_vertices;
+
+	// A mirroring transform turns the triangles inside out
+	bool flip = glm::determinant(glm::mat3(m.transform)) < 0.f;
+	piece entry;
+	entry.material = m.material;
+	entry.first_index = staged_indices.size();
+	entry.count = 3 * n_faces;
+	staged_indices.reserve(staged_indices.size() + entry.count);
+	const glm::uvec3 * faces = in_place ? (const glm::uvec3 *)data.index_data() : m.faces.data();
+	for (size_t i = 0; i < n_faces; i++)
+	{
+		glm::uvec3 face = faces[i];
+		if (flip)
+		{
+			std::swap(face.y, face.z);
+		}
+		staged_indices.push_back((unsigned int)first_vertex + face.x);
+		staged_indices.push_back((unsigned int)first_vertex + face.y);
+		staged_indices.push_back((unsigned int)first_vertex + face.z);
+	}
+	pieces.push_back(entry);
+	mesh_count++;
+}
+
+// Add all meshes of a scene
+void static_batch::add(const std::vector<geometry> & scene)
+{
+	for (size_t i = 0; i < scene.size(); i++)
+	{
+		add(scene[i]);
+	}
+}
+
+// Create the buffers and the draw list
+void static_batch::upload()
+{
+	// Order the index ranges by material, the vertices stay where
+	// they are since the indices are absolute
+	std::stable_sort(pieces.begin(), pieces.end(), [](const piece & a, const piece & b) {
+		return a.material < b.material;
+	});
+	std::vector<unsigned int> indices;
+	indices.reserve(staged_indices.size());
+	draws.clear();
+	for (size_t i = 0; i < pieces.size(); i++)
+	{
+		const piece & entry = pieces[i];
+		if (entry.count == 0)
+		{
+			continue;
+		}
+		// Consecutive meshes of the same material share a draw
+		if (draws.empty() || draws.back().material != entry.material)
+		{
+			draw range;
+			range.offset = indices.size() * sizeof(unsigned int);
+			range.count = 0;
+			range.material = entry.material;
+			draws.push_back(range);
+		}
+		draws.back().count += (GLsizei)entry.count;
+		indices.insert(indices.end(), staged_indices.begin() + entry.first_index,
+			staged_indices.begin() + entry.first_index + entry.count);
+	}
+	index_count = (GLsizei)indices.size();
+
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	vbo = makeBuffer(GL_ARRAY_BUFFER, GL_STATIC_DRAW, staged_vertices.size(), staged_vertices.data());
+	ibo = makeBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW, indices.size() * sizeof(unsigned int), indices.data());
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	mesh_vertex_layout::setup();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+	glBindVertexArray(0);
+
+	// The GPU holds the only copy from now on
+	std::vector<unsigned char>().swap(staged_vertices);
+	std::vector<unsigned int>().swap(staged_indices);
+	std::vector<piece>().swap(pieces);
+}
+
+// Draw all meshes in one call
+void static_batch::render() const
+{
+	if (index_count == 0)
+	{
+		return;
+	}
+	// The entries of the draw list are contiguous, so one draw covers
+	// all of them
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, (void*)0);
+	glBindVertexArray(0);
+}
+
+// Draw the meshes of one material
+void static_batch::render(int index) const
+{
+	const draw & range = draws[index];
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (const void *)range.offset);
+	glBindVertexArray(0);
+}
+
+// Delete the buffers and forget all meshes
+void static_batch::destroy()
+{
+	if (vao != 0)
+	{
+		glDeleteVertexArrays(1, &vao);
+		glDeleteBuffers(1, &vbo);
+		glDeleteBuffers(1, &ibo);
+		vao = vbo = ibo = 0;
+	}
+	std::vector<unsigned char>().swap(staged_vertices);
+	std::vector<unsigned int>().swap(staged_indices);
+	pieces.clear();
+	draws.clear();
+	index_count = 0;
+	vertex_count = 0;
+	mesh_count = 0;
+}
+
+// Get the draw list
+const std::vector<static_batch::draw> & static_batch::get_draws() const
+{
+	return draws;
+}
+
+// Get the vertex array
+unsigned int static_batch::get_vertex_array() const
+{
+	return vao;
+}
+
+// Get the number of meshes and vertices in the batch
+size_t static_batch::get_mesh_count() const
+{
+	return mesh_count;
+}
+
+size_t static_batch::get_vertex_count() const
+{
+	return vertex_count;
+}
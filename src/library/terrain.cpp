@@ -1,14 +1,23 @@
 #include "terrain.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+
+// Number of quads per side of a terrain chunk
+#define TERRAIN_CHUNK_QUADS 32
+// Safety margin of the chunk bounding boxes for the displacement
+// mapping in the vertex shader
+#define TERRAIN_CHUNK_MARGIN 0.05f
 
 // Generate heights using the perlin_noise class
 float * terrain::get_heights(float range, float rigidity)
 {
 	// Create an array of the required size
-	float * heights = new float[resolution * resolution];
+	float * heights = memory_new_array<float>(memory_terrain, (size_t)resolution * resolution);
 
 	// Instantiate two frequencies of perlin noise
-	perlin_noise noise = perlin_noise(resolution, 1.0, 0.0, 1.3);
-	perlin_noise noise2 = perlin_noise(resolution * 3, 0.333333, 0.0, 1.3);
+	perlin_noise noise = perlin_noise(resolution, 1.0, 0.0, 1.3, seed);
+	perlin_noise noise2 = perlin_noise(resolution * 3, 0.333333, 0.0, 1.3, seed);
 
     // For each vertex, generate a height
 	for (int z = 0; z < resolution; z++)
@@ -47,7 +56,7 @@ glm::vec3 * terrain::get_normal_at_pos(float x, float z)
 	int index_z = (int)((z + radius) / face_delta);
 	int index = 2 * (index_z * (resolution - 1) + index_x);
 	index = x > z ? index : index + 1;
-	return &(this->terra.faces_normals[index]);
+	return &(this->terra.data.face_normals()[index]);
 }
 
 // Clamp the terrain heights to be in [min_height,max_height]
@@ -62,25 +71,24 @@ void terrain::clamp_heights()
 // Build the terrain (create vertices etc.)
 void terrain::build()
 {
-	geometry m;
 	int nVertices = resolution * resolution;
 	int nFaces = (resolution - 1) * (resolution - 1) * 2;
 	float deltaX = size / (resolution - 1);
 	float deltaZ = size / (resolution - 1);
 
-	m.positions.resize(nVertices);
-	m.normals.resize(nVertices);
-	m.colors.resize(nVertices, glm::vec4(1.0,1.0,1.0,1.0));
-	m.faces.resize(nFaces);
-	m.faces_normals.resize(nFaces);
+	// The vertices, the indices (sorted by chunk) and the face normals
+	// (in face order, see get_normal_at_pos) share one allocation,
+	// which is uploaded as it is
+	geometry & m = terra;
+	m.data.allocate(nVertices, nFaces, true);
+	void* vertices = m.data.vertex_data();
+	strided_view<glm::vec3> faces_normals = m.data.face_normals();
 
-	float* vbo_data = new float[nVertices * 10];
-	unsigned int* ibo_data = new unsigned int[nFaces * 3];
 	int step = nVertices / 100;
 	// Calculate vertices
 	for (uint32_t i = 0; i < nVertices; ++i) {
 		// Log to console
-		if ((i + 1) % step == 0)
+		if (log_progress && (i + 1) % step == 0)
 		{
 			std::cout << (i + 1) / step << "%" << std::endl;
 		}
@@ -94,75 +102,91 @@ void terrain::build()
 		float hu = (i + resolution) / resolution < resolution ? heights[i + resolution] : heights[i];
 		float hd = i >= resolution ? heights[i - resolution] : heights[i];
 		nrm = glm::normalize(glm::vec3(hl - hr, deltaX, hd - hu));
-		glm::vec4 col = m.colors[0];
-
-		// Set geometry properties
-		m.positions[i] = pos;
-		m.normals[i] = nrm;
-		m.colors[i] = col;
 
 		// Texture coordinates
-		float one = 1.0;
-		float scaling = resolution / fmax(size,8.0);
-		col[0] = (i % resolution) / (float) resolution;// (i % resolution) / scaling;
-		col[1] = (i / resolution) / (float)resolution;//(i / resolution) / scaling;
-
-		// Fill VBO
-		vbo_data[10 * i + 0] = pos[0];
-		vbo_data[10 * i + 1] = pos[1];
-		vbo_data[10 * i + 2] = pos[2];
-		vbo_data[10 * i + 3] = nrm[0];
-		vbo_data[10 * i + 4] = nrm[1];
-		vbo_data[10 * i + 5] = nrm[2];
-		vbo_data[10 * i + 6] = col[0];
-		vbo_data[10 * i + 7] = col[1];
-		vbo_data[10 * i + 8] = col[2];
-		vbo_data[10 * i + 9] = col[3];
-	}
+		glm::vec4 col(1.0, 1.0, 1.0, 1.0);
+		col[0] = (i % resolution) / (float) resolution;
+		col[1] = (i / resolution) / (float)resolution;
 
-	// Calculate faces
-	for (uint32_t i = 0; i < nFaces; ++i) {
-		int pos = i / 2 + i / ((resolution - 1) * 2);
-			glm::uvec3 face(pos,
-				pos + resolution + (i % 2),
-				pos + resolution * ((i+1) % 2) + 1);
-
-			// Save faces
-			m.faces[i] = face;
-			ibo_data[i * 3 + 0] = face[0];
-			ibo_data[i * 3 + 1] = face[1];
-			ibo_data[i * 3 + 2] = face[2];
-
-			// Save normals of faces
-			glm::vec3 v = m.positions[face[1]] - m.positions[face[0]];
-			glm::vec3 w = m.positions[face[2]] - m.positions[face[0]];
-			m.faces_normals[i] = glm::normalize(glm::cross(v, w));
+		// Set geometry properties
+		mesh_vertex_layout::write<0>(vertices, i, pos);
+		mesh_vertex_layout::write<1>(vertices, i, nrm);
+		mesh_vertex_layout::write<2>(vertices, i, col);
 	}
 
-	glGenVertexArrays(1, &m.vao);
-	glBindVertexArray(m.vao);
-
-	m.vbo = makeBuffer(GL_ARRAY_BUFFER, GL_STATIC_DRAW, nVertices * 10 * sizeof(float), vbo_data);
-	m.ibo = makeBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW, nFaces * 3 * sizeof(unsigned int), ibo_data);
-	glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(3 * sizeof(float)));
-	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(6 * sizeof(float)));
+	// Face i of the grid, two per quad
+	auto face_at = [this](int i) {
+		int pos = i / 2 + i / ((resolution - 1) * 2);
+		return glm::uvec3(pos,
+			pos + resolution + (i % 2),
+			pos + resolution * ((i+1) % 2) + 1);
+	};
 
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
+	// Calculate the normals of the faces
+	for (uint32_t i = 0; i < nFaces; ++i) {
+		glm::uvec3 face = face_at(i);
+		glm::vec3 p0 = mesh_vertex_layout::read<0>(vertices, face[0]);
+		glm::vec3 v = mesh_vertex_layout::read<0>(vertices, face[1]) - p0;
+		glm::vec3 w = mesh_vertex_layout::read<0>(vertices, face[2]) - p0;
+		faces_normals[i] = glm::normalize(glm::cross(v, w));
+	}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.ibo);
+	// Sort the faces into square chunks, so that each chunk is a
+	// contiguous range of the IBO and can be culled on its own.
+	// Quad (row, col) consists of the faces 2 * (row * quads + col)
+	// and the one after it, rows run along x and columns along z.
+	unsigned int* ibo_data = (unsigned int*)m.data.index_data();
+	int quads = resolution - 1;
+	int chunks_per_side = (quads + TERRAIN_CHUNK_QUADS - 1) / TERRAIN_CHUNK_QUADS;
+	chunks.clear();
+	int index = 0;
+	for (int chunk_row = 0; chunk_row < chunks_per_side; chunk_row++) {
+		for (int chunk_col = 0; chunk_col < chunks_per_side; chunk_col++) {
+			int row_start = chunk_row * TERRAIN_CHUNK_QUADS;
+			int row_end = std::min(row_start + TERRAIN_CHUNK_QUADS, quads);
+			int col_start = chunk_col * TERRAIN_CHUNK_QUADS;
+			int col_end = std::min(col_start + TERRAIN_CHUNK_QUADS, quads);
+
+			chunk c;
+			c.first_index = index;
+			for (int row = row_start; row < row_end; row++) {
+				for (int col = col_start; col < col_end; col++) {
+					for (int k = 0; k < 2; k++) {
+						glm::uvec3 face = face_at(2 * (row * quads + col) + k);
+						ibo_data[index++] = face[0];
+						ibo_data[index++] = face[1];
+						ibo_data[index++] = face[2];
+					}
+				}
+			}
+			c.index_count = index - c.first_index;
+
+			// The terrain rises from a flat plane, so y = 0 is always
+			// part of the bounding box
+			float low = 0.0;
+			float high = 0.0;
+			for (int row = row_start; row <= row_end; row++) {
+				for (int col = col_start; col <= col_end; col++) {
+					float h = heights[row * resolution + col];
+					low = fmin(low, h);
+					high = fmax(high, h);
+				}
+			}
+			c.box_min = glm::vec3(-size / 2.0 + row_start * deltaX - TERRAIN_CHUNK_MARGIN,
+								  low - TERRAIN_CHUNK_MARGIN,
+								  -size / 2.0 + col_start * deltaZ - TERRAIN_CHUNK_MARGIN);
+			c.box_max = glm::vec3(-size / 2.0 + row_end * deltaX + TERRAIN_CHUNK_MARGIN,
+								  high + TERRAIN_CHUNK_MARGIN,
+								  -size / 2.0 + col_end * deltaZ + TERRAIN_CHUNK_MARGIN);
+			chunks.push_back(c);
+		}
+	}
+	draw_counts.resize(chunks.size());
+	draw_offsets.resize(chunks.size());
 
+	uploadGeometry(m);
 	m.transform = glm::identity<glm::mat4>();
 	m.vertex_count = 3 * nFaces;
-
-	terra = m;
-
-	delete[] vbo_data;
-	delete[] ibo_data;
 }
 
 // Allocate shader frame locations
@@ -191,6 +215,18 @@ void terrain::increase_current_frame(int increase)
 	this->current_frame += (this->current_frame < this->frames ? increase : 0);
 }
 
+// Get the current frame of the rise of the terrain
+int terrain::get_current_frame()
+{
+	return this->current_frame;
+}
+
+// Set the current frame
+void terrain::set_current_frame(int frame)
+{
+	this->current_frame = frame;
+}
+
 int terrain::view_mat_loc;
 int terrain::proj_mat_loc;
 int terrain::light_dir_loc;
@@ -201,6 +237,7 @@ int terrain::terr_model_loc;
 // Render the terrain
 void terrain::render(camera * cam, glm::mat4 proj_matrix, glm::vec3 light_dir)
 {
+	PROFILE_SCOPE("terrain::render");
 	glUseProgram(terrainShaderProgram);
 	glm::mat4 view_matrix = cam->view_matrix();
 	glUniformMatrix4fv(view_mat_loc, 1, GL_FALSE, &view_matrix[0][0]);
@@ -220,22 +257,52 @@ void terrain::render(camera * cam, glm::mat4 proj_matrix, glm::vec3 light_dir)
 
 	glUniformMatrix4fv(terr_model_loc, 1, GL_FALSE, &this->terra.transform[0][0]);
 	this->terra.bind();
-	glDrawElements(GL_TRIANGLES, this->terra.vertex_count, GL_UNSIGNED_INT, (void*)0);
+
+	// Cull the chunks against the view frustum, chunks that follow
+	// each other in the IBO are merged into a single draw
+	frustum view_frustum(proj_matrix * view_matrix);
+	int draws = 0;
+	int last_end = -1;
+	visible_chunks = 0;
+	for (size_t i = 0; i < chunks.size(); i++) {
+		const chunk & c = chunks[i];
+		if (!view_frustum.contains_box(c.box_min, c.box_max, this->terra.transform)) {
+			continue;
+		}
+		visible_chunks++;
+		if (c.first_index == last_end) {
+			draw_counts[draws - 1] += c.index_count;
+		} else {
+			draw_counts[draws] = c.index_count;
+			draw_offsets[draws] = (void*)(c.first_index * sizeof(unsigned int));
+			draws++;
+		}
+		last_end = c.first_index + c.index_count;
+	}
+	culled_chunks = (int)chunks.size() - visible_chunks;
+
+	if (draws > 0) {
+		glMultiDrawElements(GL_TRIANGLES, draw_counts.data(), GL_UNSIGNED_INT, draw_offsets.data(), draws);
+	}
 
 	increase_current_frame();
 }
 
 // Create a new instance of terrain
-terrain::terrain(float size, int resolution, int start_frame, int max_frame, std::string stone, std::string grass, std::string snow)
+terrain::terrain(float size, int resolution, int start_frame, int max_frame, std::string stone, std::string grass, std::string snow, unsigned int seed, asset_loader * assets)
 {
 	this->size = size;
 	this->resolution = resolution;
-	heights = get_heights(size, 1.0);
-	clamp_heights();
-	build();
-	create_terrain_shaders();
+	this->seed = seed;
+	{
+		PROFILE_SCOPE("terrain generation");
+		heights = get_heights(size, 1.0);
+		clamp_heights();
+		build();
+	}
+	create_terrain_shaders(assets);
 	get_texture_locations(terrainShaderProgram);
-	load_textures(stone, grass, snow);
+	load_textures(stone, grass, snow, assets);
 	get_frame_locations(terrainShaderProgram);
 	set_frames(start_frame, max_frame);
 }
@@ -257,26 +324,23 @@ void terrain::get_texture_locations(int shader_program)
 }
 
 // Load the stone, grass and snow textures
-void terrain::load_textures(std::string stone, std::string grass, std::string snow) {
-	int image_width, image_height;
-
-	// Stone texture
-	float* image_tex_data = terrain::load_texture_data(std::string(DATA_ROOT) + stone, &image_width, &image_height);
-	unsigned int image_tex1 = terrain::create_texture_rgba32f(image_width, image_height, image_tex_data);
+void terrain::load_textures(std::string stone, std::string grass, std::string snow, asset_loader * assets) {
+	// The textures are decoded and mipmapped once, later runs map the
+	// cache files and upload all levels as RGBA8
+	unsigned int image_tex1, image_tex2, image_tex3;
+	if (assets) {
+		image_tex1 = assets->texture(std::string(DATA_ROOT) + stone);
+		image_tex2 = assets->texture(std::string(DATA_ROOT) + grass);
+		image_tex3 = assets->texture(std::string(DATA_ROOT) + snow);
+	}
+	else {
+		image_tex1 = texture_cache(std::string(DATA_ROOT) + stone).upload();
+		image_tex2 = texture_cache(std::string(DATA_ROOT) + grass).upload();
+		image_tex3 = texture_cache(std::string(DATA_ROOT) + snow).upload();
+	}
 	glBindTextureUnit(10, image_tex1);
-	delete[] image_tex_data;
-
-	// Grass texture
-	image_tex_data = terrain::load_texture_data(std::string(DATA_ROOT) + grass, &image_width, &image_height);
-	unsigned int image_tex2 = terrain::create_texture_rgba32f(image_width, image_height, image_tex_data);
 	glBindTextureUnit(11, image_tex2);
-	delete[] image_tex_data;
-
-	// Snow texture
-	image_tex_data = terrain::load_texture_data(std::string(DATA_ROOT) + snow, &image_width, &image_height);
-	unsigned int image_tex3 = terrain::create_texture_rgba32f(image_width, image_height, image_tex_data);
 	glBindTextureUnit(12, image_tex3);
-	delete[] image_tex_data;
 
 	// Set properties
 	set_texture_filter_mode(image_tex1, GL_LINEAR_MIPMAP_LINEAR);
@@ -288,40 +352,6 @@ void terrain::load_textures(std::string stone, std::string grass, std::string sn
 	set_texture_wrap_mode(image_tex3, GL_MIRRORED_REPEAT);
 }
 
-// Create textures from raw data
-unsigned terrain::create_texture_rgba32f(int width, int height, float* data) {
-	unsigned handle;
-	glCreateTextures(GL_TEXTURE_2D, 1, &handle);
-	glTextureStorage2D(handle, 1, GL_RGBA32F, width, height);
-	glTextureSubImage2D(handle, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, data);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	return handle;
-}
-
-// Load raw texture data
-float* terrain::load_texture_data(std::string filename, int* width, int* height) {
-	int channels;
-	unsigned char* file_data = stbi_load(filename.c_str(), width, height, &channels, 3);
-
-	int w = *width;
-	int h = *height;
-
-	float* data = new float[4 * w * h];
-	for (int j = 0; j < h; ++j) {
-		for (int i = 0; i < w; ++i) {
-			data[j*w * 4 + i * 4 + 0] = static_cast<float>(file_data[j*w * 3 + i * 3 + 0]) / 255;
-			data[j*w * 4 + i * 4 + 1] = static_cast<float>(file_data[j*w * 3 + i * 3 + 1]) / 255;
-			data[j*w * 4 + i * 4 + 2] = static_cast<float>(file_data[j*w * 3 + i * 3 + 2]) / 255;
-			data[j*w * 4 + i * 4 + 3] = 1.f;
-		}
-	}
-
-	delete[] file_data;
-
-	return data;
-}
-
 // Set the texture filter mode of a texture
 void terrain::set_texture_filter_mode(unsigned int texture, GLenum mode) {
 	glTextureParameteri(texture, /*GL_TEXTURE_MAG_FILTER*/GL_TEXTURE_MIN_FILTER, mode);
@@ -335,15 +365,22 @@ void terrain::set_texture_wrap_mode(unsigned int texture, GLenum mode) {
 
 int terrain::terrainShaderProgram;
 // Create the terrain shader program
-void terrain::create_terrain_shaders()
+void terrain::create_terrain_shaders(asset_loader * assets)
 {
 	// load and compile shaders and link program
-	unsigned int vertexShader = compileShader("terrain_shader.vert", GL_VERTEX_SHADER);
-	unsigned int fragmentShader = compileShader("terrain_shader.frag", GL_FRAGMENT_SHADER);
-	terrainShaderProgram = linkProgram(vertexShader, fragmentShader);
-	// after linking the program the shader objects are no longer needed
-	glDeleteShader(fragmentShader);
-	glDeleteShader(vertexShader);
+	if (assets)
+	{
+		terrainShaderProgram = assets->program("terrain_shader.vert", "terrain_shader.frag");
+	}
+	else
+	{
+		unsigned int vertexShader = compileShader("terrain_shader.vert", GL_VERTEX_SHADER);
+		unsigned int fragmentShader = compileShader("terrain_shader.frag", GL_FRAGMENT_SHADER);
+		terrainShaderProgram = linkProgram(vertexShader, fragmentShader);
+		// after linking the program the shader objects are no longer needed
+		glDeleteShader(fragmentShader);
+		glDeleteShader(vertexShader);
+	}
 
 	glUseProgram(terrainShaderProgram);
 	terr_model_loc = glGetUniformLocation(terrainShaderProgram, "terr_model_mat");
@@ -360,3 +397,15 @@ void terrain::create_terrain_shaders()
 void terrain::set_model_mat(glm::mat4 mm) {
   terra.transform = mm;
 }
+
+// Get the number of chunks drawn by the last render()
+int terrain::get_visible_chunks()
+{
+	return visible_chunks;
+}
+
+// Get the number of chunks culled by the last render()
+int terrain::get_culled_chunks()
+{
+	return culled_chunks;
+}
@@ -0,0 +1,274 @@
+#include "texture_cache.hpp"
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <stb_image.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_CACHE_USE_SSE2
+#endif
+
+// Size of the header and alignment of the levels
+#define TEXTURE_CACHE_HEADER_SIZE 64
+#define TEXTURE_CACHE_ALIGNMENT 16
+
+// Map the cache file of an image, building it first if needed
+texture_cache::texture_cache(const std::string & image_path, thread_pool * pool)
+{
+	file_header = nullptr;
+	levels = nullptr;
+
+	uint64_t source_size;
+	int64_t source_time;
+	if (!mapped_file::stat(image_path, &source_size, &source_time))
+	{
+		std::cerr << "texture_cache:: cannot find " << image_path << "\n";
+		return;
+	}
+
+	// An outdated cache file is simply rebuilt
+	std::string path = cache_path(image_path);
+	if (map(path) && file_header->source_size == source_size && file_header->source_time == source_time)
+	{
+		return;
+	}
+	unmap();
+
+	if (!build(image_path, path, pool) || !map(path))
+	{
+		unmap();
+		std::cerr << "texture_cache:: cannot cache " << image_path << "\n";
+	}
+}
+
+// Unmap the file
+texture_cache::~texture_cache()
+{
+	unmap();
+}
+
+// Map a cache file
+bool texture_cache::map(const std::string & path)
+{
+	if (!file.open(path) || file.size() < TEXTURE_CACHE_HEADER_SIZE)
+	{
+		return false;
+	}
+	const unsigned char * memory = file.data();
+	size_t memory_size = file.size();
+
+	// Check the header and that all levels lie inside the file
+	file_header = (const header *)memory;
+	levels = (const level *)(memory + TEXTURE_CACHE_HEADER_SIZE);
+	if (file_header->magic != TEXTURE_CACHE_MAGIC || file_header->version != TEXTURE_CACHE_VERSION
+		|| file_header->level_count == 0 || file_header->level_count > 32
+		|| TEXTURE_CACHE_HEADER_SIZE + file_header->level_count * sizeof(level) > memory_size)
+	{
+		return false;
+	}
+	for (uint32_t i = 0; i < file_header->level_count; i++)
+	{
+		if (levels[i].offset + (uint64_t)levels[i].width * levels[i].height * 4 > memory_size)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Unmap the file
+void texture_cache::unmap()
+{
+	file.close();
+	file_header = nullptr;
+	levels = nullptr;
+}
+
+// Whether the cache file could be built and mapped
+bool texture_cache::is_valid() const
+{
+	return file_header != nullptr;
+}
+
+// Get the size of the full resolution level
+int texture_cache::get_width() const
+{
+	return file_header ? (int)file_header->width : 0;
+}
+
+int texture_cache::get_height() const
+{
+	return file_header ? (int)file_header->height : 0;
+}
+
+// Get the number of mip levels
+int texture_cache::get_level_count() const
+{
+	return file_header ? (int)file_header->level_count : 0;
+}
+
+// Get the texels of a mip level and its size
+const unsigned char * texture_cache::get_level(int index, int * width, int * height) const
+{
+	*width = (int)levels[index].width;
+	*height = (int)levels[index].height;
+	return file.data() + levels[index].offset;
+}
+
+// Create an immutable GL_RGBA8 texture with all mip levels
+unsigned int texture_cache::upload() const
+{
+	unsigned int handle;
+	glCreateTextures(GL_TEXTURE_2D, 1, &handle);
+	if (!is_valid())
+	{
+		return handle;
+	}
+
+	// The rows of all levels are tightly packed
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTextureStorage2D(handle, get_level_count(), GL_RGBA8, get_width(), get_height());
+	for (int i = 0; i < get_level_count(); i++)
+	{
+		int width, height;
+		const unsigned char * texels = get_level(i, &width, &height);
+		glTextureSubImage2D(handle, i, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+	}
+	return handle;
+}
+
+// Get the path of the cache file of an image
+std::string texture_cache::cache_path(const std::string & image_path)
+{
+	size_t slash = image_path.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? image_path : image_path.substr(slash + 1);
+	return CACHE_ROOT + name + ".tex";
+}
+
+// Decode an image and write its cache file
+bool texture_cache::build(const std::string & image_path, const std::string & path, thread_pool * pool)
+{
+	uint64_t source_size;
+	int64_t source_time;
+	if (!mapped_file::stat(image_path, &source_size, &source_time))
+	{
+		return false;
+	}
+
+	int width, height, channels;
+	unsigned char * image = stbi_load(image_path.c_str(), &width, &height, &channels, 4);
+	if (!image)
+	{
+		return false;
+	}
+	size_t image_size = (size_t)width * height * 4;
+	memory_allocated(memory_textures, image_size);
+
+	// Lay out the full mip chain down to 1x1
+	std::vector<level> table;
+	uint64_t offset = TEXTURE_CACHE_HEADER_SIZE;
+	int level_width = width, level_height = height;
+	while (true)
+	{
+		level entry;
+		entry.width = (uint32_t)level_width;
+		entry.height = (uint32_t)level_height;
+		table.push_back(entry);
+		if (level_width == 1 && level_height == 1)
+		{
+			break;
+		}
+		level_width = level_width > 1 ? level_width / 2 : 1;
+		level_height = level_height > 1 ? level_height / 2 : 1;
+	}
+	offset += table.size() * sizeof(level);
+	for (size_t i = 0; i < table.size(); i++)
+	{
+		offset = (offset + TEXTURE_CACHE_ALIGNMENT - 1) & ~(uint64_t)(TEXTURE_CACHE_ALIGNMENT - 1);
+		table[i].offset = offset;
+		offset += (uint64_t)table[i].width * table[i].height * 4;
+	}
+
+	// Build the whole file in memory, each level from the previous one
+	tracked_vector<unsigned char, memory_textures> content((size_t)offset, 0);
+	header * file_header = (header *)content.data();
+	file_header->magic = TEXTURE_CACHE_MAGIC;
+	file_header->version = TEXTURE_CACHE_VERSION;
+	file_header->width = (uint32_t)width;
+	file_header->height = (uint32_t)height;
+	file_header->level_count = (uint32_t)table.size();
+	file_header->source_size = source_size;
+	file_header->source_time = source_time;
+	memcpy(content.data() + TEXTURE_CACHE_HEADER_SIZE, table.data(), table.size() * sizeof(level));
+	memcpy(content.data() + table[0].offset, image, image_size);
+	stbi_image_free(image);
+	memory_released(memory_textures, image_size);
+	for (size_t i = 1; i < table.size(); i++)
+	{
+		downsample(content.data() + table[i - 1].offset, (int)table[i - 1].width, (int)table[i - 1].height,
+			content.data() + table[i].offset, pool);
+	}
+
+	return mapped_file::write(path, content.data(), content.size());
+}
+
+// Compute the next mip level of an RGBA8 image
+void texture_cache::downsample(const unsigned char * src, int src_width, int src_height,
+	unsigned char * dst, thread_pool * pool)
+{
+	int dst_width = src_width > 1 ? src_width / 2 : 1;
+	int dst_height = src_height > 1 ? src_height / 2 : 1;
+	// Steps between the two texels that are averaged, 0 for a side of 1
+	int step_x = src_width > 1 ? 4 : 0;
+	size_t step_y = src_height > 1 ? (size_t)src_width * 4 : 0;
+
+	pool->parallel_for(0, dst_height, 16, [&](int begin, int end) {
+		for (int y = begin; y < end; y++)
+		{
+			const unsigned char * row0 = src + (size_t)(src_height > 1 ? 2 * y : y) * src_width * 4;
+			const unsigned char * row1 = row0 + step_y;
+			unsigned char * out = dst + (size_t)y * dst_width * 4;
+			int x = 0;
+#ifdef TEXTURE_CACHE_USE_SSE2
+			// Four output texels from two times eight input texels,
+			// summed in 16 bits and rounded like the scalar loop
+			if (step_x != 0)
+			{
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i two = _mm_set1_epi16(2);
+				for (; x + 4 <= dst_width; x += 4)
+				{
+					__m128i a = _mm_loadu_si128((const __m128i *)(row0 + 8 * x));
+					__m128i b = _mm_loadu_si128((const __m128i *)(row0 + 8 * x + 16));
+					__m128i c = _mm_loadu_si128((const __m128i *)(row1 + 8 * x));
+					__m128i d = _mm_loadu_si128((const __m128i *)(row1 + 8 * x + 16));
+					// Vertical sums of the texel pairs (0,1), (2,3), (4,5), (6,7)
+					__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(c, zero));
+					__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(c, zero));
+					__m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(d, zero));
+					__m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(d, zero));
+					// Horizontal sums, the result is in the low half
+					s0 = _mm_add_epi16(s0, _mm_srli_si128(s0, 8));
+					s1 = _mm_add_epi16(s1, _mm_srli_si128(s1, 8));
+					s2 = _mm_add_epi16(s2, _mm_srli_si128(s2, 8));
+					s3 = _mm_add_epi16(s3, _mm_srli_si128(s3, 8));
+					__m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s0, s1), two), 2);
+					__m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s2, s3), two), 2);
+					_mm_storeu_si128((__m128i *)(out + 4 * x), _mm_packus_epi16(lo, hi));
+				}
+			}
+#endif // TEXTURE_CACHE_USE_SSE2
+			for (; x < dst_width; x++)
+			{
+				const unsigned char * p0 = row0 + (size_t)x * 2 * step_x;
+				const unsigned char * p1 = row1 + (size_t)x * 2 * step_x;
+				for (int c = 0; c < 4; c++)
+				{
+					out[4 * x + c] = (unsigned char)((p0[c] + p0[c + step_x] + p1[c] + p1[c + step_x] + 2) >> 2);
+				}
+			}
+		}
+	});
+}
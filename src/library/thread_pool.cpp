@@ -0,0 +1,147 @@
+#include "thread_pool.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+
+namespace
+{
+	// Set while the thread runs (a chunk of) a job, on a worker as well
+	// as on the calling thread
+	thread_local bool in_job = false;
+
+	// Sets in_job for its lifetime and restores the previous value
+	struct job_scope
+	{
+		bool previous;
+		job_scope() : previous(in_job) { in_job = true; }
+		~job_scope() { in_job = previous; }
+	};
+}
+
+// Create a pool with the given number of threads, including the
+// calling thread (0 = number of hardware threads)
+thread_pool::thread_pool(int threads)
+{
+	if (threads <= 0)
+	{
+		threads = (int)std::thread::hardware_concurrency();
+	}
+	job_next = 0;
+	for (int i = 1; i < threads; i++)
+	{
+		workers.push_back(std::thread(&thread_pool::worker_loop, this));
+	}
+}
+
+// Join all workers
+thread_pool::~thread_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+}
+
+// Get the number of threads working on a loop (including the caller)
+int thread_pool::get_thread_count() const
+{
+	return (int)workers.size() + 1;
+}
+
+// Main loop of the worker threads
+void thread_pool::worker_loop()
+{
+	PROFILE_THREAD_NAME("pool worker");
+	unsigned long seen = 0;
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		wake.wait(lock, [&] { return stopping || generation != seen; });
+		if (stopping)
+		{
+			return;
+		}
+		seen = generation;
+
+		lock.unlock();
+		run_chunks();
+		lock.lock();
+
+		if (--active_workers == 0)
+		{
+			done.notify_all();
+		}
+	}
+}
+
+// Take and run chunks of the current job until none are left
+void thread_pool::run_chunks()
+{
+	job_scope scope;
+	for (;;)
+	{
+		int begin = job_next.fetch_add(job_grain);
+		if (begin >= job_end)
+		{
+			return;
+		}
+		job_fn(job_ctx, begin, std::min(begin + job_grain, job_end));
+	}
+}
+
+// Run fn(ctx, begin, end) for chunks of grain iterations
+void thread_pool::run(int begin, int end, int grain, void (*fn)(void *, int, int), void * ctx)
+{
+	if (end <= begin)
+	{
+		return;
+	}
+	grain = std::max(grain, 1);
+
+	// Run inline if called from inside a job (waiting for a pool there
+	// could deadlock and would oversubscribe the cores) or if there is
+	// nothing to split
+	if (in_job || workers.empty() || end - begin <= grain)
+	{
+		job_scope scope;
+		fn(ctx, begin, end);
+		return;
+	}
+	// Also if an unrelated thread currently uses the pool
+	std::unique_lock<std::mutex> job_lock(job_mutex, std::try_to_lock);
+	if (!job_lock.owns_lock())
+	{
+		job_scope scope;
+		fn(ctx, begin, end);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job_fn = fn;
+		job_ctx = ctx;
+		job_end = end;
+		job_grain = grain;
+		job_next = begin;
+		active_workers = (int)workers.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	run_chunks();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&] { return active_workers == 0; });
+}
+
+// Get the pool that is shared by the whole program
+thread_pool & thread_pool::shared()
+{
+	static thread_pool pool;
+	return pool;
+}
@@ -0,0 +1,200 @@
+#include "yuv_convert.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define YUV_USE_SSE2
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#define YUV_USE_AVX2
+#endif
+
+// BT.709 coefficients scaled to the limited range, in 1.15 fixed point
+#define YUV_Y_R 5983
+#define YUV_Y_G 20127
+#define YUV_Y_B 2032
+#define YUV_U_R -3298
+#define YUV_U_G -11094
+#define YUV_U_B 14392
+#define YUV_V_R 14392
+#define YUV_V_G -13073
+#define YUV_V_B -1320
+
+// Offsets including the rounding, luma is shifted by 15 bits and
+// chroma by 17 bits as it is computed from the sum of 2x2 pixels
+#define YUV_Y_OFFSET ((16 << 15) + (1 << 14))
+#define YUV_C_OFFSET ((128 << 17) + (1 << 16))
+
+// Two coefficients as 16 bit pair for a multiply-add
+#define YUV_PAIR(lo, hi) ((int)((((unsigned)(hi) & 0xFFFF) << 16) | ((unsigned)(lo) & 0xFFFF)))
+
+namespace
+{
+	// Luma of one pixel
+	inline unsigned char luma(const unsigned char * p)
+	{
+		return (unsigned char)((YUV_Y_R * p[0] + YUV_Y_G * p[1] + YUV_Y_B * p[2] + YUV_Y_OFFSET) >> 15);
+	}
+
+	// Convert count pixels of a row to luma, starting at pixel x
+	void luma_span(const unsigned char * src, unsigned char * dst, int x, int count)
+	{
+		int end = x + count;
+#ifdef YUV_USE_AVX2
+		{
+			// The pixels are split into (R, B) and (G, A) 16 bit pairs, so
+			// that a multiply-add per pair computes the weighted sum
+			const __m256i mask = _mm256_set1_epi32(0x00FF00FF);
+			const __m256i coeff_rb = _mm256_set1_epi32(YUV_PAIR(YUV_Y_R, YUV_Y_B));
+			const __m256i coeff_ga = _mm256_set1_epi32(YUV_Y_G);
+			const __m256i offset = _mm256_set1_epi32(YUV_Y_OFFSET);
+			for (; x + 16 <= end; x += 16)
+			{
+				__m256i y[2];
+				for (int i = 0; i < 2; i++)
+				{
+					__m256i px = _mm256_loadu_si256((const __m256i *)(src + 4 * (x + 8 * i)));
+					__m256i rb = _mm256_and_si256(px, mask);
+					__m256i ga = _mm256_and_si256(_mm256_srli_epi32(px, 8), mask);
+					__m256i sum = _mm256_add_epi32(_mm256_madd_epi16(rb, coeff_rb), _mm256_madd_epi16(ga, coeff_ga));
+					y[i] = _mm256_srai_epi32(_mm256_add_epi32(sum, offset), 15);
+				}
+				// Packing works per 128 bit lane, restore the pixel order
+				__m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(y[0], y[1]), 0xD8);
+				__m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+				_mm_storeu_si128((__m128i *)(dst + x), bytes);
+			}
+		}
+#endif // YUV_USE_AVX2
+#ifdef YUV_USE_SSE2
+		const __m128i mask = _mm_set1_epi32(0x00FF00FF);
+		const __m128i coeff_rb = _mm_set1_epi32(YUV_PAIR(YUV_Y_R, YUV_Y_B));
+		const __m128i coeff_ga = _mm_set1_epi32(YUV_Y_G);
+		const __m128i offset = _mm_set1_epi32(YUV_Y_OFFSET);
+		for (; x + 8 <= end; x += 8)
+		{
+			__m128i y[2];
+			for (int i = 0; i < 2; i++)
+			{
+				__m128i px = _mm_loadu_si128((const __m128i *)(src + 4 * (x + 4 * i)));
+				__m128i rb = _mm_and_si128(px, mask);
+				__m128i ga = _mm_and_si128(_mm_srli_epi32(px, 8), mask);
+				__m128i sum = _mm_add_epi32(_mm_madd_epi16(rb, coeff_rb), _mm_madd_epi16(ga, coeff_ga));
+				y[i] = _mm_srai_epi32(_mm_add_epi32(sum, offset), 15);
+			}
+			__m128i words = _mm_packs_epi32(y[0], y[1]);
+			_mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(words, words));
+		}
+#endif // YUV_USE_SSE2
+		for (; x < end; x++)
+		{
+			dst[x] = luma(src + 4 * x);
+		}
+	}
+
+	// Chroma of the 2x2 block at pixel x of two rows (row0 may equal
+	// row1 and the last column is repeated for odd widths)
+	inline void chroma(const unsigned char * row0, const unsigned char * row1, int x, int width,
+		unsigned char * u, unsigned char * v)
+	{
+		int x1 = x + 1 < width ? x + 1 : x;
+		int r = row0[4 * x + 0] + row0[4 * x1 + 0] + row1[4 * x + 0] + row1[4 * x1 + 0];
+		int g = row0[4 * x + 1] + row0[4 * x1 + 1] + row1[4 * x + 1] + row1[4 * x1 + 1];
+		int b = row0[4 * x + 2] + row0[4 * x1 + 2] + row1[4 * x + 2] + row1[4 * x1 + 2];
+		*u = (unsigned char)((YUV_U_R * r + YUV_U_G * g + YUV_U_B * b + YUV_C_OFFSET) >> 17);
+		*v = (unsigned char)((YUV_V_R * r + YUV_V_G * g + YUV_V_B * b + YUV_C_OFFSET) >> 17);
+	}
+
+	// Convert the 2x2 blocks of two rows to chroma
+	void chroma_span(const unsigned char * row0, const unsigned char * row1, int width,
+		unsigned char * u, unsigned char * v)
+	{
+		int x = 0;
+#ifdef YUV_USE_SSE2
+		const __m128i mask = _mm_set1_epi32(0x00FF00FF);
+		const __m128i coeff_u_rb = _mm_set1_epi32(YUV_PAIR(YUV_U_R, YUV_U_B));
+		const __m128i coeff_u_ga = _mm_set1_epi32(YUV_PAIR(YUV_U_G, 0));
+		const __m128i coeff_v_rb = _mm_set1_epi32(YUV_PAIR(YUV_V_R, YUV_V_B));
+		const __m128i coeff_v_ga = _mm_set1_epi32(YUV_PAIR(YUV_V_G, 0));
+		const __m128i offset = _mm_set1_epi32(YUV_C_OFFSET);
+		// 8 pixels of both rows give 4 chroma samples
+		for (; x + 8 <= width; x += 8)
+		{
+			__m128i us[2], vs[2];
+			for (int i = 0; i < 2; i++)
+			{
+				__m128i p0 = _mm_loadu_si128((const __m128i *)(row0 + 4 * (x + 4 * i)));
+				__m128i p1 = _mm_loadu_si128((const __m128i *)(row1 + 4 * (x + 4 * i)));
+				// Vertical sums as (R, B) and (G, A) 16 bit pairs
+				__m128i rb = _mm_add_epi16(_mm_and_si128(p0, mask), _mm_and_si128(p1, mask));
+				__m128i ga = _mm_add_epi16(_mm_and_si128(_mm_srli_epi32(p0, 8), mask),
+					_mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+				// Horizontal sums of neighbouring pixels end up in lanes 0 and 2,
+				// alpha is multiplied by zero
+				rb = _mm_add_epi16(rb, _mm_srli_epi64(rb, 32));
+				ga = _mm_add_epi16(ga, _mm_srli_epi64(ga, 32));
+				__m128i su = _mm_add_epi32(_mm_madd_epi16(rb, coeff_u_rb), _mm_madd_epi16(ga, coeff_u_ga));
+				__m128i sv = _mm_add_epi32(_mm_madd_epi16(rb, coeff_v_rb), _mm_madd_epi16(ga, coeff_v_ga));
+				us[i] = _mm_shuffle_epi32(su, _MM_SHUFFLE(3, 1, 2, 0));
+				vs[i] = _mm_shuffle_epi32(sv, _MM_SHUFFLE(3, 1, 2, 0));
+			}
+			__m128i su = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi64(us[0], us[1]), offset), 17);
+			__m128i sv = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi64(vs[0], vs[1]), offset), 17);
+			__m128i words = _mm_packs_epi32(su, sv);
+			__m128i bytes = _mm_packus_epi16(words, words);
+			int32_t packed_u = _mm_cvtsi128_si32(bytes);
+			int32_t packed_v = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 4));
+			memcpy(u + x / 2, &packed_u, 4);
+			memcpy(v + x / 2, &packed_v, 4);
+		}
+#endif // YUV_USE_SSE2
+		for (; x < width; x += 2)
+		{
+			chroma(row0, row1, x, width, u + x / 2, v + x / 2);
+		}
+	}
+}
+
+// Size of a YUV 4:2:0 frame in bytes
+size_t yuv420p_frame_size(int width, int height)
+{
+	size_t chroma_size = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+	return (size_t)width * height + 2 * chroma_size;
+}
+
+// Convert an RGBA frame to YUV 4:2:0 (BT.709, limited range)
+void rgba_to_yuv420p(const unsigned char * rgba, int width, int height, bool flip,
+	unsigned char * yuv, thread_pool * pool)
+{
+	int chroma_width = (width + 1) / 2;
+	int chroma_height = (height + 1) / 2;
+	unsigned char * y_plane = yuv;
+	unsigned char * u_plane = y_plane + (size_t)width * height;
+	unsigned char * v_plane = u_plane + (size_t)chroma_width * chroma_height;
+
+	// Source row of an output row
+	auto source_row = [&](int y) {
+		return rgba + (size_t)4 * width * (flip ? height - 1 - y : y);
+	};
+
+	// Each chunk converts pairs of rows together with their chroma row
+	pool->parallel_for(0, chroma_height, 8, [&](int begin, int end) {
+		for (int j = begin; j < end; j++)
+		{
+			int y0 = 2 * j;
+			int y1 = y0 + 1 < height ? y0 + 1 : y0;
+			const unsigned char * row0 = source_row(y0);
+			const unsigned char * row1 = source_row(y1);
+
+			luma_span(row0, y_plane + (size_t)width * y0, 0, width);
+			if (y1 != y0)
+			{
+				luma_span(row1, y_plane + (size_t)width * y1, 0, width);
+			}
+			chroma_span(row0, row1, width, u_plane + (size_t)chroma_width * j, v_plane + (size_t)chroma_width * j);
+		}
+	});
+}
@@ -0,0 +1,517 @@
+#include "common.hpp"
+#include "simulation.hpp"
+#include "animation_scene.hpp"
+#include "checkpoint_store.hpp"
+#include "memory_tracker.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+
+Golden trajectory harness for changes to the physics
+(phySphere::step, phyPlane::reflect, ...), which change the floating
+point results even when they are correct:
+
+    physics_regression --record golden.bin [--resolution 100]
+                       [--frames 1920] [--every 1]
+    physics_regression --compare golden.bin [--tolerance 0.001]
+    physics_regression --check-seek [--resolution 100] [--frames 1920]
+
+--record runs the scripted scene of terraining_testing_2 (see
+animation_scene.hpp) with a fixed seed and stores the positions of
+all spheres every --every frames from the release of the spheres on,
+together with the total energy and the number of tunnelled spheres
+of those frames and the runtime.
+
+--compare runs the same scene (the parameters are taken from the
+file) and reports the divergence of the positions from the golden
+file (max, mean, p50, p95, p99 over all spheres and frames, and the
+first frame whose maximum exceeds the tolerance), the energy drift,
+the tunnelling events and the runtime of both runs. It fails (exit
+code 1) if the p99 divergence exceeds the tolerance, more spheres
+tunnel through the terrain than in the golden run or a simulation
+step after the first one allocates on the heap.
+
+--check-seek runs the scene to --frames with checkpoints, seeks back
+to 3/4 of it and simulates to the end again; the states (capture())
+at the seek target and at the end must have the same bytes as in the
+straight run, i.e. restoring a checkpoint loses nothing.
+
+data/physics_golden.bin is the golden run of the physics as it is
+(--resolution 100 --frames 1920 --every 60, 1.5 MB). Builds with -O0
+and -O3 (x86-64) reproduce it exactly; record it again with a change
+that is meant to change the trajectories.
+
+A sphere tunnels when it is above the terrain area and more than
+TUNNEL_DEPTH below the triangle under it; each sphere is counted
+once per frame in which it newly gets there. The energy is the sum
+over all spheres of 0.5 |v|^2 - a . x (unit mass).
+
+Needs an OpenGL context (a hidden window) to build the terrain.
+
+ */
+
+// Defaults of the command line
+#define DEFAULT_RESOLUTION 100
+#define DEFAULT_FRAMES 1920
+#define DEFAULT_TOLERANCE 0.001f
+// Interval of the checkpoints of --check-seek, the seek target is
+// not on a checkpoint so that some frames are simulated again
+#define SEEK_CHECKPOINT_INTERVAL 64
+// Depth below the terrain that counts as tunnelling
+#define TUNNEL_DEPTH (2.f * SPHERE_RADIUS)
+
+// Identifies a golden file ("CGGT") and the version of its layout
+#define GOLDEN_MAGIC 0x54474743u
+#define GOLDEN_VERSION 1u
+
+namespace
+{
+	// Header of a golden file, followed by frame_count records of a
+	// frame_header and sphere_count positions (3 floats)
+	struct golden_header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t seed;
+		int32_t resolution;
+		int32_t frames;
+		int32_t every;
+		int32_t first_frame;
+		int32_t frame_count;
+		int32_t sphere_count;
+		int32_t reserved;
+		double runtime_ms;
+	};
+
+	struct frame_header
+	{
+		int32_t frame;
+		int32_t tunnelled;
+		double energy;
+	};
+
+	// The settings of the scene at a terrain resolution
+	simulation_settings scene_settings(int resolution)
+	{
+		return animation_settings(resolution, "mountain.jpg", "grass.jpg", "snow.jpg");
+	}
+
+	// Total energy of the spheres (unit mass)
+	double total_energy(simulation & sim)
+	{
+		phy::phySphere ** spheres = sim.get_spheres();
+		double energy = 0.0;
+		for (int i = 0; i < sim.get_sphere_count(); i++)
+		{
+			glm::vec3 v(spheres[i]->v);
+			energy += 0.5 * glm::dot(v, v) - glm::dot(glm::vec3(spheres[i]->a), glm::vec3(spheres[i]->x));
+		}
+		return energy;
+	}
+
+	// Whether a sphere is deeper than TUNNEL_DEPTH below the terrain
+	bool is_tunnelled(phy::phyPlane & plane, const phy::phySphere & sphere)
+	{
+		glm::vec3 x = glm::vec3(plane.inv_model_mat * sphere.x);
+		if (x.x < plane.xStart || x.x > plane.xEnd || x.z < plane.zStart || x.z > plane.zEnd)
+		{
+			return false;
+		}
+		int index = plane.getTriangleAt(x);
+		const float * vertex = plane.vbo_data + index * 3 * (phy::phy_vertex_layout::stride / sizeof(float));
+		glm::vec3 v1(vertex[0], vertex[1], vertex[2]);
+		glm::vec3 norm(vertex[3], vertex[4], vertex[5]);
+		return glm::dot(x - v1, norm) < -TUNNEL_DEPTH;
+	}
+
+	// Count the spheres that newly tunnelled, tunnelled holds the state
+	// of every sphere from the last call
+	int count_tunnelled(simulation & sim, std::vector<char> & tunnelled)
+	{
+		phy::phySphere ** spheres = sim.get_spheres();
+		int count = 0;
+		for (int i = 0; i < sim.get_sphere_count(); i++)
+		{
+			bool now = is_tunnelled(sim.get_plane(), *spheres[i]);
+			if (now && !tunnelled[i])
+			{
+				count++;
+			}
+			tunnelled[i] = now;
+		}
+		return count;
+	}
+
+	// Nearest rank percentile, reorders values
+	float percentile(std::vector<float> & values, double p)
+	{
+		if (values.empty())
+		{
+			return 0.f;
+		}
+		size_t rank = (size_t)(p / 100.0 * values.size());
+		rank = std::min(rank, values.size() - 1);
+		std::nth_element(values.begin(), values.begin() + rank, values.end());
+		return values[rank];
+	}
+
+	// Statistics of the simulation steps
+	struct run_statistics
+	{
+		// Heap allocations of the steps after the first one
+		size_t allocations;
+		phy::phyCounters counters;
+	};
+
+	// Print the collision events per frame
+	void print_counters(const phy::phyCounters & counters, int frames)
+	{
+		printf("  per frame     ");
+		for (int i = 0; i < phy::counter_count; i++)
+		{
+			printf(" %s %.1f", phy::getCounterName((phy::phyCounter)i), (double)counters.values[i] / frames);
+		}
+		printf("\n");
+	}
+
+	// Run the scene, call record(frame) after every recorded frame,
+	// returns the runtime of the simulation in ms and the statistics
+	// of the steps
+	template <typename F>
+	double run(simulation & sim, int frames, int every, run_statistics & statistics, F record)
+	{
+		double runtime_ms = 0.0;
+		statistics = run_statistics();
+		while (sim.get_frame() < frames)
+		{
+			// Leave out the lookups of the tunnelling check
+			phy::collectCounters();
+			size_t allocations_before = memory_thread_allocations();
+			auto start = std::chrono::steady_clock::now();
+			int frame = sim.step();
+			runtime_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			if (frame > 0)
+			{
+				statistics.allocations += memory_thread_allocations() - allocations_before;
+			}
+			phy::phyCounters counters = phy::collectCounters();
+			for (int i = 0; i < phy::counter_count; i++)
+			{
+				statistics.counters.values[i] += counters.values[i];
+			}
+			if (frame >= SPHERES_RELEASE_FRAME && (frame - SPHERES_RELEASE_FRAME) % every == 0)
+			{
+				record(frame);
+			}
+		}
+		return runtime_ms;
+	}
+
+	int record_golden(const std::string & path, int resolution, int frames, int every)
+	{
+		simulation sim(scene_settings(resolution));
+		int sphere_count = sim.get_sphere_count();
+		FILE * file = fopen(path.c_str(), "wb");
+		if (!file)
+		{
+			std::cerr << "physics_regression:: cannot write " << path << "\n";
+			return 1;
+		}
+
+		golden_header header = golden_header();
+		header.magic = GOLDEN_MAGIC;
+		header.version = GOLDEN_VERSION;
+		header.seed = SCENE_SEED;
+		header.resolution = resolution;
+		header.frames = frames;
+		header.every = every;
+		header.first_frame = SPHERES_RELEASE_FRAME;
+		header.sphere_count = sphere_count;
+		// The counts are written again at the end
+		fwrite(&header, sizeof(header), 1, file);
+
+		std::vector<char> tunnelled(sphere_count, 0);
+		std::vector<float> positions(3 * sphere_count);
+		int total_tunnelled = 0;
+		bool written = true;
+		run_statistics statistics;
+		header.runtime_ms = run(sim, frames, every, statistics, [&](int frame) {
+			frame_header entry;
+			entry.frame = frame;
+			entry.tunnelled = count_tunnelled(sim, tunnelled);
+			entry.energy = total_energy(sim);
+			total_tunnelled += entry.tunnelled;
+			phy::phySphere ** spheres = sim.get_spheres();
+			for (int i = 0; i < sphere_count; i++)
+			{
+				positions[3 * i + 0] = spheres[i]->x.x;
+				positions[3 * i + 1] = spheres[i]->x.y;
+				positions[3 * i + 2] = spheres[i]->x.z;
+			}
+			written = written && fwrite(&entry, sizeof(entry), 1, file) == 1
+				&& fwrite(positions.data(), sizeof(float), positions.size(), file) == positions.size();
+			header.frame_count++;
+		});
+
+		fseek(file, 0, SEEK_SET);
+		written = written && fwrite(&header, sizeof(header), 1, file) == 1;
+		if (fclose(file) != 0 || !written)
+		{
+			std::cerr << "physics_regression:: cannot write " << path << "\n";
+			return 1;
+		}
+		printf("physics_regression:: recorded %d frames of %d spheres, %d tunnelling events, %.1f ms (%.3f ms/frame), "
+			"%zu allocations\n", header.frame_count, sphere_count, total_tunnelled, header.runtime_ms,
+			header.runtime_ms / frames, statistics.allocations);
+		print_counters(statistics.counters, frames);
+		return 0;
+	}
+
+	int compare_golden(const std::string & path, float tolerance)
+	{
+		FILE * file = fopen(path.c_str(), "rb");
+		golden_header header;
+		if (!file || fread(&header, sizeof(header), 1, file) != 1 || header.magic != GOLDEN_MAGIC
+			|| header.version != GOLDEN_VERSION || header.every < 1)
+		{
+			std::cerr << "physics_regression:: " << path << " is not a golden file\n";
+			if (file) fclose(file);
+			return 1;
+		}
+
+		simulation sim(scene_settings(header.resolution));
+		int sphere_count = sim.get_sphere_count();
+		if (sphere_count != header.sphere_count)
+		{
+			std::cerr << "physics_regression:: the golden file has " << header.sphere_count
+					  << " spheres, the scene " << sphere_count << "\n";
+			fclose(file);
+			return 1;
+		}
+
+		std::vector<char> tunnelled(sphere_count, 0);
+		std::vector<float> golden(3 * sphere_count);
+		std::vector<float> divergences;
+		divergences.reserve((size_t)header.frame_count * sphere_count);
+		double divergence_sum = 0.0;
+		float divergence_max = 0.f;
+		int first_bad_frame = -1;
+		int tunnelled_golden = 0, tunnelled_run = 0;
+		double energy_golden_first = 0.0, energy_golden_last = 0.0;
+		double energy_run_first = 0.0, energy_run_last = 0.0;
+		double energy_difference_max = 0.0;
+		int compared_frames = 0;
+		bool read = true;
+
+		run_statistics statistics;
+		double runtime_ms = run(sim, header.frames, header.every, statistics, [&](int frame) {
+			frame_header entry;
+			if (!read || fread(&entry, sizeof(entry), 1, file) != 1
+				|| fread(golden.data(), sizeof(float), golden.size(), file) != golden.size() || entry.frame != frame)
+			{
+				read = false;
+				return;
+			}
+			double energy = total_energy(sim);
+			if (compared_frames == 0)
+			{
+				energy_golden_first = entry.energy;
+				energy_run_first = energy;
+			}
+			energy_golden_last = entry.energy;
+			energy_run_last = energy;
+			energy_difference_max = std::max(energy_difference_max, std::fabs(energy - entry.energy));
+			tunnelled_golden += entry.tunnelled;
+			tunnelled_run += count_tunnelled(sim, tunnelled);
+
+			phy::phySphere ** spheres = sim.get_spheres();
+			float frame_max = 0.f;
+			for (int i = 0; i < sphere_count; i++)
+			{
+				glm::vec3 expected(golden[3 * i + 0], golden[3 * i + 1], golden[3 * i + 2]);
+				float divergence = glm::length(glm::vec3(spheres[i]->x) - expected);
+				// A NaN position is as far off as it gets
+				if (divergence != divergence)
+				{
+					divergence = INFINITY;
+				}
+				divergences.push_back(divergence);
+				divergence_sum += divergence;
+				frame_max = std::max(frame_max, divergence);
+			}
+			divergence_max = std::max(divergence_max, frame_max);
+			if (first_bad_frame < 0 && frame_max > tolerance)
+			{
+				first_bad_frame = frame;
+			}
+			compared_frames++;
+		});
+		fclose(file);
+
+		if (!read || compared_frames != header.frame_count)
+		{
+			std::cerr << "physics_regression:: " << path << " does not match the scene (frame "
+					  << compared_frames << " of " << header.frame_count << ")\n";
+			return 1;
+		}
+
+		size_t samples = divergences.size();
+		float p50 = percentile(divergences, 50.0);
+		float p95 = percentile(divergences, 95.0);
+		float p99 = percentile(divergences, 99.0);
+		printf("physics_regression:: %d frames of %d spheres (resolution %d, every %d frames)\n",
+			compared_frames, sphere_count, header.resolution, header.every);
+		printf("  divergence     max %.3g  mean %.3g  p50 %.3g  p95 %.3g  p99 %.3g\n", divergence_max,
+			samples ? divergence_sum / samples : 0.0, p50, p95, p99);
+		if (first_bad_frame >= 0)
+		{
+			printf("  first frame with a divergence above %g: %d\n", tolerance, first_bad_frame);
+		}
+		printf("  energy drift   golden %+.6g  run %+.6g  (max difference to golden %.6g)\n",
+			energy_golden_last - energy_golden_first, energy_run_last - energy_run_first, energy_difference_max);
+		printf("  tunnelling     golden %d  run %d\n", tunnelled_golden, tunnelled_run);
+		printf("  runtime        golden %.1f ms (%.3f ms/frame)  run %.1f ms (%.3f ms/frame)\n",
+			header.runtime_ms, header.runtime_ms / header.frames, runtime_ms, runtime_ms / header.frames);
+		printf("  allocations    %zu in the steps after the first\n", statistics.allocations);
+		print_counters(statistics.counters, header.frames);
+
+		bool passed = p99 <= tolerance && tunnelled_run <= tunnelled_golden && statistics.allocations == 0;
+		printf("physics_regression:: %s\n", passed ? "PASSED" : "FAILED");
+		return passed ? 0 : 1;
+	}
+
+	// Whether two snapshots have the same bytes
+	bool same_snapshot(const simulation_snapshot & a, const simulation_snapshot & b)
+	{
+		return a.frame == b.frame && a.seed == b.seed
+			&& memcmp(&a.plane_model_mat, &b.plane_model_mat, sizeof(a.plane_model_mat)) == 0
+			&& memcmp(&a.plane_inv_model_mat, &b.plane_inv_model_mat, sizeof(a.plane_inv_model_mat)) == 0
+			&& memcmp(&a.angular_velocity, &b.angular_velocity, sizeof(a.angular_velocity)) == 0
+			&& memcmp(&a.vertical_velocity, &b.vertical_velocity, sizeof(a.vertical_velocity)) == 0
+			&& a.angular_velocity_active == b.angular_velocity_active
+			&& a.vertical_velocity_active == b.vertical_velocity_active
+			&& a.terrain_frame == b.terrain_frame
+			&& memcmp(&a.camera_phi, &b.camera_phi, sizeof(float)) == 0
+			&& memcmp(&a.camera_theta, &b.camera_theta, sizeof(float)) == 0
+			&& memcmp(&a.camera_distance, &b.camera_distance, sizeof(float)) == 0
+			&& a.spheres.size() == b.spheres.size()
+			&& (a.spheres.empty() || memcmp(a.spheres.data(), b.spheres.data(),
+				a.spheres.size() * sizeof(simulation_snapshot::sphere_state)) == 0);
+	}
+
+	// Number of spheres that left the plane in a snapshot
+	int detached_spheres(const simulation_snapshot & snapshot)
+	{
+		int count = 0;
+		for (size_t i = 0; i < snapshot.spheres.size(); i++)
+		{
+			count += snapshot.spheres[i].attached ? 0 : 1;
+		}
+		return count;
+	}
+
+	int check_seek(GLFWwindow * window, int resolution, int frames)
+	{
+		simulation sim(scene_settings(resolution));
+		camera cam(window);
+		checkpoint_store checkpoints(SEEK_CHECKPOINT_INTERVAL, (size_t)-1);
+		int target = frames * 3 / 4;
+
+		// Straight run, recording checkpoints like the render loop
+		simulation_snapshot straight_target;
+		while (sim.get_frame() < frames)
+		{
+			if (sim.get_frame() == target)
+			{
+				straight_target = sim.capture(cam);
+			}
+			checkpoints.record(sim, cam);
+			sim.fast_forward(sim.get_frame() + 1, cam);
+		}
+		simulation_snapshot straight_end = sim.capture(cam);
+
+		// Seek back and simulate to the end again
+		int simulated = checkpoints.seek(sim, cam, target);
+		bool target_matches = simulated >= 0 && same_snapshot(sim.capture(cam), straight_target);
+		sim.fast_forward(frames, cam);
+		bool end_matches = simulated >= 0 && same_snapshot(sim.capture(cam), straight_end);
+
+		printf("physics_regression:: seek from frame %d to %d (%d frames simulated, %d spheres off the plane)\n",
+			frames, target, simulated, detached_spheres(straight_target));
+		printf("  state at %d     %s\n", target, target_matches ? "same" : "DIFFERENT");
+		printf("  state at %d     %s\n", frames, end_matches ? "same" : "DIFFERENT");
+
+		bool passed = target_matches && end_matches;
+		printf("physics_regression:: %s\n", passed ? "PASSED" : "FAILED");
+		return passed ? 0 : 1;
+	}
+
+	void print_usage(const char * name)
+	{
+		std::cerr << "Usage: " << name << " --record FILE [--resolution N] [--frames N] [--every N]\n"
+				  << "       " << name << " --compare FILE [--tolerance T]\n"
+				  << "       " << name << " --check-seek [--resolution N] [--frames N]\n";
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	std::string record_path, compare_path;
+	bool seek = false;
+	int resolution = DEFAULT_RESOLUTION;
+	int frames = DEFAULT_FRAMES;
+	int every = 1;
+	float tolerance = DEFAULT_TOLERANCE;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+		bool has_value = i + 1 < argc;
+		if (option == "--record" && has_value) {
+			record_path = argv[++i];
+		} else if (option == "--compare" && has_value) {
+			compare_path = argv[++i];
+		} else if (option == "--check-seek") {
+			seek = true;
+		} else if (option == "--resolution" && has_value) {
+			resolution = atoi(argv[++i]);
+		} else if (option == "--frames" && has_value) {
+			frames = atoi(argv[++i]);
+		} else if (option == "--every" && has_value) {
+			every = std::max(1, atoi(argv[++i]));
+		} else if (option == "--tolerance" && has_value) {
+			tolerance = (float)atof(argv[++i]);
+		} else {
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+	int modes = !record_path.empty() + !compare_path.empty() + seek;
+	if (modes != 1 || resolution < 2 || frames < 4)
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	GLFWwindow * window = initOpenGLHidden(argv[0]);
+	if (!window)
+	{
+		std::cerr << "physics_regression:: cannot create an OpenGL context\n";
+		return 1;
+	}
+
+	int result = seek ? check_seek(window, resolution, frames)
+		: record_path.empty() ? compare_golden(compare_path, tolerance)
+		: record_golden(record_path, resolution, frames, every);
+	glfwTerminate();
+	return result;
+}
@@ -0,0 +1,216 @@
+#include "common.hpp"
+#include "ffmpeg_wrapper.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+
+Headless check of the asynchronous readback of ffmpeg_wrapper: the
+same deterministic frames are captured with synchronous glReadPixels
+and through pixel buffer objects (set_readback_pbos), written as raw
+image sequences, and compared byte by byte:
+
+    LIBGL_ALWAYS_SOFTWARE=1 readback_check [--frames 12]
+
+Every frame has to exist under the index it was rendered with (the
+index passed to submit_frame names the file), including the frames
+that are still in a PBO after the last save_frame() and only drained
+by finish(). The frames differ from each other, so a frame submitted
+under the wrong index is found too. Fails (exit code 1) on any
+difference.
+
+Needs an OpenGL context (a hidden window), Mesa's software rasterizer
+is enough; the frames are rendered into a framebuffer object of
+their own, so the size of the window does not matter.
+
+ */
+
+// Size of the frames, odd so that rows are not multiples of a
+// convenient alignment
+#define CHECK_WIDTH 173
+#define CHECK_HEIGHT 97
+// Defaults of the command line
+#define DEFAULT_FRAMES 12
+// Numbers of PBOs that are checked against the synchronous readback
+#define CHECK_PBO_COUNTS {2, 3}
+
+namespace
+{
+	// Render frame n: a background and a few rectangles that depend on
+	// n, drawn with scissored clears so that no shader is needed
+	void render_frame(int n)
+	{
+		glDisable(GL_SCISSOR_TEST);
+		glClearColor((n * 37 % 256) / 255.f, (n * 91 % 256) / 255.f, (n * 13 % 256) / 255.f, 1.f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glEnable(GL_SCISSOR_TEST);
+		for (int i = 0; i < 4; i++)
+		{
+			int x = (n * 17 + i * 41) % CHECK_WIDTH;
+			int y = (n * 11 + i * 23) % CHECK_HEIGHT;
+			glScissor(x, y, 9 + i * 7, 5 + i * 3);
+			glClearColor((i * 60 % 256) / 255.f, 1.f - i / 4.f, (n * 29 % 256) / 255.f, (n % 2) ? 1.f : 0.5f);
+			glClear(GL_COLOR_BUFFER_BIT);
+		}
+		glDisable(GL_SCISSOR_TEST);
+	}
+
+	// Read a whole file, returns false if it cannot be read
+	bool read_file(const std::string & path, std::vector<unsigned char> & content)
+	{
+		FILE * file = fopen(path.c_str(), "rb");
+		if (!file)
+		{
+			return false;
+		}
+		content.clear();
+		unsigned char chunk[65536];
+		size_t read;
+		while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		{
+			content.insert(content.end(), chunk, chunk + read);
+		}
+		fclose(file);
+		return true;
+	}
+
+	// Capture the frames as a raw image sequence named after pattern,
+	// with pbo_count PBOs (0 = synchronous)
+	void capture(const std::string & pattern, int frames, int pbo_count)
+	{
+		std::vector<char> filename(pattern.begin(), pattern.end());
+		filename.push_back('\0');
+		ffmpeg_wrapper fw(CHECK_WIDTH, CHECK_HEIGHT, frames, filename.data(), 4, ffmpeg_wrapper::output_raw_images);
+		fw.set_readback_pbos(pbo_count);
+		for (int n = 0; n < frames; n++)
+		{
+			render_frame(n);
+			fw.save_frame();
+		}
+		// The last frames are still in PBOs
+		fw.finish();
+	}
+
+	// Remove the files of a captured sequence
+	void remove_frames(const std::string & pattern, int frames)
+	{
+		for (int n = 0; n <= frames; n++)
+		{
+			remove(image_sequence_path(FFMPEG_ROOT + pattern, n).c_str());
+		}
+	}
+
+	// Compare a sequence with the synchronous one, returns the number
+	// of frames that are missing or differ
+	int compare(const std::string & pattern, const std::string & reference, int frames)
+	{
+		int errors = 0;
+		std::vector<unsigned char> expected, actual, previous;
+		for (int n = 0; n < frames; n++)
+		{
+			if (!read_file(image_sequence_path(FFMPEG_ROOT + reference, n), expected)
+				|| expected.size() != (size_t)4 * CHECK_WIDTH * CHECK_HEIGHT)
+			{
+				printf("  frame %d: the synchronous readback is missing\n", n);
+				errors++;
+				continue;
+			}
+			if (expected == previous)
+			{
+				printf("  frame %d: equal to the frame before, the indices cannot be checked\n", n);
+				errors++;
+			}
+			previous = expected;
+
+			if (!read_file(image_sequence_path(FFMPEG_ROOT + pattern, n), actual))
+			{
+				printf("  frame %d: missing\n", n);
+				errors++;
+			}
+			else if (actual != expected)
+			{
+				printf("  frame %d: differs from the synchronous readback\n", n);
+				errors++;
+			}
+		}
+		// Nothing may be submitted after the last frame
+		if (read_file(image_sequence_path(FFMPEG_ROOT + pattern, frames), actual))
+		{
+			printf("  frame %d: submitted, but only %d frames were rendered\n", frames, frames);
+			errors++;
+		}
+		return errors;
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	int frames = DEFAULT_FRAMES;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+		if (option == "--frames" && i + 1 < argc) {
+			frames = atoi(argv[++i]);
+		} else {
+			frames = 0;
+		}
+	}
+	if (frames < 1)
+	{
+		std::cerr << "Usage: " << argv[0] << " [--frames N]\n";
+		return 1;
+	}
+
+	GLFWwindow * window = initOpenGLHidden(argv[0]);
+	if (!window)
+	{
+		std::cerr << "readback_check:: cannot create an OpenGL context\n";
+		return 1;
+	}
+	printf("readback_check:: %s\n", (const char *)glGetString(GL_RENDERER));
+
+	// Render into a framebuffer object of the frame size
+	unsigned int fbo, color, depth;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glGenRenderbuffers(1, &color);
+	glBindRenderbuffer(GL_RENDERBUFFER, color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, CHECK_WIDTH, CHECK_HEIGHT);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+	glGenRenderbuffers(1, &depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, CHECK_WIDTH, CHECK_HEIGHT);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cerr << "readback_check:: cannot create the framebuffer\n";
+		glfwTerminate();
+		return 1;
+	}
+	glViewport(0, 0, CHECK_WIDTH, CHECK_HEIGHT);
+
+	std::string reference = "readback_check_sync_%05d.raw";
+	capture(reference, frames, 0);
+
+	bool passed = true;
+	int pbo_counts[] = CHECK_PBO_COUNTS;
+	for (int pbo_count : pbo_counts)
+	{
+		std::string pattern = "readback_check_pbo" + std::to_string(pbo_count) + "_%05d.raw";
+		capture(pattern, frames, pbo_count);
+		int errors = compare(pattern, reference, frames);
+		printf("  %d PBOs: %d frames, %s\n", pbo_count, frames, errors == 0 ? "same" : "DIFFERENT");
+		passed = passed && errors == 0;
+		remove_frames(pattern, frames);
+	}
+	remove_frames(reference, frames);
+
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(1, &color);
+	glDeleteRenderbuffers(1, &depth);
+	printf("readback_check:: %s\n", passed ? "PASSED" : "FAILED");
+	glfwTerminate();
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,262 @@
+#include "shm_frame_ring.hpp"
+#include "yuv_convert.hpp"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#ifdef __linux__
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/*
+
+Reference consumer of the shared memory frame ring of ffmpeg_wrapper
+(output_shm) and a small harness that stands in for the renderer or
+the encoder:
+
+    shm_frame_consumer NAME --y4m     convert the frames to a Y4M
+                                      stream on stdout, e.g. piped
+                                      into "ffmpeg -f yuv4mpegpipe -i -"
+    shm_frame_consumer NAME --raw     write the RGBA frames to stdout
+    shm_frame_consumer NAME --verify  check the test pattern written
+                                      by --produce and report the rate
+    shm_frame_consumer NAME --produce WIDTH HEIGHT FRAMES [SLOTS]
+                                      write FRAMES test pattern frames
+    shm_frame_consumer --selftest WIDTH HEIGHT FRAMES [SLOTS]
+                                      run --produce and --verify in two
+                                      processes
+
+ */
+
+// Seconds to wait for the producer to create the ring
+#define ATTACH_TIMEOUT 30.0
+// Seconds the producer waits for the consumer to release a frame
+#define RELEASE_TIMEOUT 30.0
+// Name of the ring used by the self test
+#define SELFTEST_NAME "/shm_frame_consumer_selftest"
+
+// Fill a frame with the test pattern of frame index n
+void write_pattern(unsigned char * frame, size_t size, uint64_t n)
+{
+	uint64_t seed = n * 0x9E3779B97F4A7C15ull;
+	size_t words = size / 8;
+	for (size_t i = 0; i < words; i++)
+	{
+		uint64_t value = seed + i;
+		memcpy(frame + 8 * i, &value, 8);
+	}
+	memset(frame + 8 * words, (int)(n & 0xFF), size - 8 * words);
+}
+
+// Check a frame against the test pattern of frame index n
+bool check_pattern(const unsigned char * frame, size_t size, uint64_t n)
+{
+	uint64_t seed = n * 0x9E3779B97F4A7C15ull;
+	size_t words = size / 8;
+	for (size_t i = 0; i < words; i++)
+	{
+		uint64_t value;
+		memcpy(&value, frame + 8 * i, 8);
+		if (value != seed + i)
+		{
+			return false;
+		}
+	}
+	for (size_t i = 8 * words; i < size; i++)
+	{
+		if (frame[i] != (unsigned char)(n & 0xFF))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Act as the renderer: publish frames with the test pattern
+int produce(const std::string & name, int width, int height, int frames, int slots)
+{
+	shm_frame_ring ring(name, width, height, slots, 0);
+	if (!ring.is_valid())
+	{
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (int n = 0; n < frames; n++)
+	{
+		unsigned char * slot = ring.acquire(RELEASE_TIMEOUT);
+		if (!slot)
+		{
+			fprintf(stderr, "produce: %s for %.0f s, %llu of %d frames consumed\n",
+					ring.is_consumer_attached() ? "the consumer released no frame" : "no consumer attached", RELEASE_TIMEOUT,
+					(unsigned long long)ring.get_released(), frames);
+			return 1;
+		}
+		write_pattern(slot, ring.get_frame_size(), n);
+		ring.publish();
+	}
+	ring.close();
+
+	// Keep the name alive until the consumer has seen all frames
+	uint64_t released = ring.get_released();
+	auto progress = std::chrono::steady_clock::now();
+	while (released < (uint64_t)frames)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		if (ring.get_released() != released)
+		{
+			released = ring.get_released();
+			progress = std::chrono::steady_clock::now();
+		}
+		else if (std::chrono::duration<double>(std::chrono::steady_clock::now() - progress).count() > RELEASE_TIMEOUT)
+		{
+			fprintf(stderr, "produce: the consumer stopped after %llu of %d frames\n",
+					(unsigned long long)released, frames);
+			return 1;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "produce: %d frames in %.3f s, %d stalls (%.3f s)\n",
+			frames, seconds, ring.get_stalls(), ring.get_stall_seconds());
+	return 0;
+}
+
+// Act as the encoder: consume the frames and check the test pattern
+int verify(const std::string & name)
+{
+	shm_frame_ring ring(name, ATTACH_TIMEOUT);
+	if (!ring.is_valid())
+	{
+		return 1;
+	}
+
+	size_t frame_size = ring.get_frame_size();
+	uint64_t frames = 0;
+	uint64_t errors = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (const unsigned char * frame = ring.wait_frame())
+	{
+		if (!check_pattern(frame, frame_size, frames))
+		{
+			if (errors == 0)
+			{
+				fprintf(stderr, "verify: frame %llu does not match the test pattern\n", (unsigned long long)frames);
+			}
+			errors++;
+		}
+		ring.release();
+		frames++;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "verify: %llu frames of %dx%d, %llu errors, %.1f frames/s, %.1f MB/s\n",
+			(unsigned long long)frames, ring.get_width(), ring.get_height(), (unsigned long long)errors,
+			frames / seconds, frames * frame_size / seconds / 1e6);
+	return errors == 0 && frames > 0 ? 0 : 1;
+}
+
+// Write the frames to stdout, converted to Y4M or as raw RGBA
+int stream(const std::string & name, bool y4m)
+{
+	shm_frame_ring ring(name, ATTACH_TIMEOUT);
+	if (!ring.is_valid())
+	{
+		return 1;
+	}
+
+	int width = ring.get_width();
+	int height = ring.get_height();
+	bool bottom_up = (ring.get_flags() & SHM_FRAME_BOTTOM_UP) != 0;
+	std::vector<unsigned char> yuv;
+	if (y4m)
+	{
+		yuv.resize(yuv420p_frame_size(width, height));
+		printf("YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C420jpeg\n", width, height);
+	}
+
+	while (const unsigned char * frame = ring.wait_frame())
+	{
+		if (y4m)
+		{
+			rgba_to_yuv420p(frame, width, height, bottom_up, yuv.data());
+			// The slot can be reused as soon as it is converted
+			ring.release();
+			fwrite("FRAME\n", 6, 1, stdout);
+			fwrite(yuv.data(), yuv.size(), 1, stdout);
+		}
+		else
+		{
+			fwrite(frame, ring.get_frame_size(), 1, stdout);
+			ring.release();
+		}
+	}
+	fflush(stdout);
+	return 0;
+}
+
+// Run a producer and a verifying consumer in two processes
+int selftest(int width, int height, int frames, int slots)
+{
+#ifdef __linux__
+	pid_t child = fork();
+	if (child < 0)
+	{
+		perror("fork");
+		return 1;
+	}
+	if (child == 0)
+	{
+		_exit(produce(SELFTEST_NAME, width, height, frames, slots));
+	}
+	int result = verify(SELFTEST_NAME);
+	int status = 0;
+	waitpid(child, &status, 0);
+	bool passed = result == 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	fprintf(stderr, "selftest: %s\n", passed ? "passed" : "FAILED");
+	return passed ? 0 : 1;
+#else
+	(void)width; (void)height; (void)frames; (void)slots;
+	fprintf(stderr, "selftest: only supported on Linux\n");
+	return 1;
+#endif
+}
+
+int
+main(int argc, char* argv[]) {
+	if (argc >= 5 && std::string(argv[1]) == "--selftest")
+	{
+		int slots = argc >= 6 ? atoi(argv[5]) : 4;
+		return selftest(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]), slots);
+	}
+	if (argc >= 3)
+	{
+		std::string name = argv[1];
+		std::string mode = argv[2];
+		if (mode == "--y4m" || mode == "--raw")
+		{
+			return stream(name, mode == "--y4m");
+		}
+		if (mode == "--verify")
+		{
+			return verify(name);
+		}
+		if (mode == "--produce" && argc >= 6)
+		{
+			int slots = argc >= 7 ? atoi(argv[6]) : 4;
+			return produce(name, atoi(argv[3]), atoi(argv[4]), atoi(argv[5]), slots);
+		}
+	}
+
+	fprintf(stderr,
+			"usage: %s NAME --y4m | --raw | --verify\n"
+			"       %s NAME --produce WIDTH HEIGHT FRAMES [SLOTS]\n"
+			"       %s --selftest WIDTH HEIGHT FRAMES [SLOTS]\n",
+			argv[0], argv[0], argv[0]);
+	return 1;
+}
@@ -0,0 +1,259 @@
+#include "common.hpp"
+#include "shader.hpp"
+#include "static_batch.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+
+Headless check of static_batch: three triangles are merged, the
+vertex and index buffers are read back and compared with the
+expected data, and the batch is drawn once:
+
+    LIBGL_ALWAYS_SOFTWARE=1 static_batch_check
+
+The meshes cover both sources of add() (the vectors of a geometry
+and geometry_data built in place), a mirrored transform (its winding
+has to be flipped), a non-uniform scale (the normals are transformed
+by the inverse transpose) and two materials in an order that
+upload() has to sort. The draw uses back face culling and takes the
+positions as clip space coordinates, so a triangle that is inside
+out or misplaced leaves its pixel black. Fails (exit code 1) on any
+difference.
+
+Needs an OpenGL context (a hidden window), Mesa's software rasterizer
+is enough; the batch is drawn into a framebuffer object of its own.
+
+ */
+
+// Size of the framebuffer
+#define CHECK_SIZE 64
+// Allowed difference of the transformed floats
+#define CHECK_EPSILON 1e-5f
+
+namespace
+{
+	// Shader that draws the vertex colors at the batch positions
+	const char * vertex_source =
+		"#version 330 core\n"
+		"layout (location = 0) in vec3 position;\n"
+		"layout (location = 2) in vec4 color;\n"
+		"out vec4 vertex_color;\n"
+		"void main() { vertex_color = color; gl_Position = vec4(position, 1.0); }\n";
+	const char * fragment_source =
+		"#version 330 core\n"
+		"in vec4 vertex_color;\n"
+		"out vec4 frag_color;\n"
+		"void main() { frag_color = vertex_color; }\n";
+
+	// The triangle all meshes are made of, counter-clockwise seen from +z
+	const glm::vec3 triangle[3] = { glm::vec3(0.1f, 0.1f, 0.f), glm::vec3(0.9f, 0.1f, 0.f), glm::vec3(0.1f, 0.9f, 0.f) };
+	// Its (not normalized) normal, tilted so that the transforms change it
+	const glm::vec3 triangle_normal(1.f, 0.f, 1.f);
+
+	// A mesh of the triangle in the vectors of a geometry
+	geometry vector_mesh(const glm::mat4 & transform, unsigned int material, const glm::vec4 & color)
+	{
+		geometry m{};
+		m.transform = transform;
+		m.material = material;
+		for (int i = 0; i < 3; i++)
+		{
+			m.positions.push_back(triangle[i]);
+			m.normals.push_back(triangle_normal);
+			m.colors.push_back(color);
+		}
+		m.faces.push_back(glm::uvec3(0, 1, 2));
+		return m;
+	}
+
+	// The same mesh built in place in geometry_data
+	geometry in_place_mesh(const glm::mat4 & transform, unsigned int material, const glm::vec4 & color)
+	{
+		geometry m{};
+		m.transform = transform;
+		m.material = material;
+		m.data.allocate(3, 1, false);
+		for (int i = 0; i < 3; i++)
+		{
+			mesh_vertex_layout::write<0>(m.data.vertex_data(), i, triangle[i]);
+			mesh_vertex_layout::write<1>(m.data.vertex_data(), i, triangle_normal);
+			mesh_vertex_layout::write<2>(m.data.vertex_data(), i, color);
+		}
+		m.data.faces()[0] = glm::uvec3(0, 1, 2);
+		return m;
+	}
+
+	bool same(const glm::vec3 & a, const glm::vec3 & b)
+	{
+		return glm::all(glm::lessThanEqual(glm::abs(a - b), glm::vec3(CHECK_EPSILON)));
+	}
+
+	bool same(const glm::vec4 & a, const glm::vec4 & b)
+	{
+		return glm::all(glm::lessThanEqual(glm::abs(a - b), glm::vec4(CHECK_EPSILON)));
+	}
+
+	// Read the pixel at clip space position p of the framebuffer
+	glm::uvec4 read_pixel(const glm::vec3 & p)
+	{
+		unsigned char rgba[4];
+		int x = (int)((p.x + 1.f) * 0.5f * CHECK_SIZE);
+		int y = (int)((p.y + 1.f) * 0.5f * CHECK_SIZE);
+		glReadPixels(x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+		return glm::uvec4(rgba[0], rgba[1], rgba[2], rgba[3]);
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	if (argc > 1)
+	{
+		std::cerr << "Usage: " << argv[0] << "\n";
+		return 1;
+	}
+
+	GLFWwindow * window = initOpenGLHidden(argv[0]);
+	if (!window)
+	{
+		std::cerr << "static_batch_check:: cannot create an OpenGL context\n";
+		return 1;
+	}
+	printf("static_batch_check:: %s\n", (const char *)glGetString(GL_RENDERER));
+
+	// Draw into a framebuffer object
+	unsigned int fbo, color;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glGenRenderbuffers(1, &color);
+	glBindRenderbuffer(GL_RENDERBUFFER, color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, CHECK_SIZE, CHECK_SIZE);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+	unsigned int program = linkProgram(compileShaderSource(vertex_source, GL_VERTEX_SHADER),
+		compileShaderSource(fragment_source, GL_FRAGMENT_SHADER));
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE || program == 0)
+	{
+		std::cerr << "static_batch_check:: cannot create the framebuffer or the shader\n";
+		glfwTerminate();
+		return 1;
+	}
+	glViewport(0, 0, CHECK_SIZE, CHECK_SIZE);
+
+	// Material 1 (added first), material 0 mirrored at x = 0 and
+	// material 1 again, scaled and moved down, built in place
+	const glm::vec4 colors[3] = { glm::vec4(1.f, 0.f, 0.f, 1.f), glm::vec4(0.f, 1.f, 0.f, 1.f), glm::vec4(0.f, 0.f, 1.f, 1.f) };
+	const glm::mat4 transforms[3] = {
+		glm::mat4(1.f),
+		glm::scale(glm::mat4(1.f), glm::vec3(-1.f, 1.f, 1.f)),
+		glm::translate(glm::mat4(1.f), glm::vec3(-1.f, -1.f, 0.f)) * glm::scale(glm::mat4(1.f), glm::vec3(2.f, 1.f, 1.f))
+	};
+	std::vector<geometry> scene;
+	scene.push_back(vector_mesh(transforms[0], 1, colors[0]));
+	scene.push_back(vector_mesh(transforms[1], 0, colors[1]));
+	scene.push_back(in_place_mesh(transforms[2], 1, colors[2]));
+
+	static_batch batch;
+	batch.add(scene);
+	batch.upload();
+
+	bool passed = true;
+	if (batch.get_mesh_count() != 3 || batch.get_vertex_count() != 9)
+	{
+		printf("  %zu meshes and %zu vertices instead of 3 and 9\n", batch.get_mesh_count(), batch.get_vertex_count());
+		passed = false;
+	}
+
+	// The material 0 mesh comes first, its winding flipped, then the
+	// two material 1 meshes in the order they were added
+	const std::vector<static_batch::draw> & draws = batch.get_draws();
+	if (draws.size() != 2
+		|| draws[0].material != 0 || draws[0].offset != 0 || draws[0].count != 3
+		|| draws[1].material != 1 || draws[1].offset != 3 * sizeof(unsigned int) || draws[1].count != 6)
+	{
+		printf("  unexpected draw list:");
+		for (size_t i = 0; i < draws.size(); i++)
+		{
+			printf(" (material %u, offset %zu, count %d)", draws[i].material, draws[i].offset, (int)draws[i].count);
+		}
+		printf("\n");
+		passed = false;
+	}
+
+	// Read the buffers back through the vertex array
+	int vbo = 0, ibo = 0;
+	glBindVertexArray(batch.get_vertex_array());
+	glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &ibo);
+	glGetVertexAttribiv(0, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &vbo);
+	glBindVertexArray(0);
+	std::vector<unsigned char> vertices(9 * mesh_vertex_layout::stride);
+	unsigned int indices[9];
+	glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, vertices.size(), vertices.data());
+	glBindBuffer(GL_COPY_READ_BUFFER, ibo);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(indices), indices);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	const unsigned int expected_indices[9] = { 3, 5, 4, 0, 1, 2, 6, 7, 8 };
+	for (int i = 0; i < 9; i++)
+	{
+		if (indices[i] != expected_indices[i])
+		{
+			printf("  index %d: %u instead of %u\n", i, indices[i], expected_indices[i]);
+			passed = false;
+		}
+	}
+	for (int i = 0; i < 9; i++)
+	{
+		const glm::mat4 & transform = transforms[i / 3];
+		glm::vec3 position = glm::vec3(transform * glm::vec4(triangle[i % 3], 1.f));
+		glm::vec3 normal = glm::normalize(glm::transpose(glm::inverse(glm::mat3(transform))) * triangle_normal);
+		if (!same(mesh_vertex_layout::read<0>(vertices.data(), i), position)
+			|| !same(mesh_vertex_layout::read<1>(vertices.data(), i), normal)
+			|| !same(mesh_vertex_layout::read<2>(vertices.data(), i), colors[i / 3]))
+		{
+			printf("  vertex %d differs\n", i);
+			passed = false;
+		}
+	}
+
+	// Draw the whole batch once, with the back faces culled every
+	// triangle has to cover its centroid
+	glUseProgram(program);
+	glEnable(GL_CULL_FACE);
+	glClearColor(0.f, 0.f, 0.f, 0.f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	batch.render();
+	for (int i = 0; i < 3; i++)
+	{
+		glm::vec3 centroid(0.f);
+		for (int j = 0; j < 3; j++)
+		{
+			centroid += glm::vec3(transforms[i] * glm::vec4(triangle[j], 1.f)) / 3.f;
+		}
+		glm::uvec4 pixel = read_pixel(centroid);
+		glm::uvec4 expected = glm::uvec4(colors[i] * 255.f);
+		if (pixel != expected)
+		{
+			printf("  mesh %d: pixel (%u, %u, %u, %u) instead of (%u, %u, %u, %u)\n", i,
+				pixel.r, pixel.g, pixel.b, pixel.a, expected.r, expected.g, expected.b, expected.a);
+			passed = false;
+		}
+	}
+	GLenum error = glGetError();
+	if (error != GL_NO_ERROR)
+	{
+		printf("  OpenGL error 0x%x\n", error);
+		passed = false;
+	}
+
+	batch.destroy();
+	glDeleteProgram(program);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(1, &color);
+	printf("static_batch_check:: %s\n", passed ? "PASSED" : "FAILED");
+	glfwTerminate();
+	return passed ? 0 : 1;
+}
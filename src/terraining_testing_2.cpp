@@ -6,8 +6,19 @@
 #include "ffmpeg_wrapper.hpp"
 #include "physics.hpp"
 #include "after_effects.hpp"
+#include "culling.hpp"
+#include "simulation.hpp"
+#include "animation_scene.hpp"
+#include "simulation_pipeline.hpp"
+#include "checkpoint_store.hpp"
+#include "profiler.hpp"
+#include "memory_tracker.hpp"
 
 #include <string>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <fstream>
 
 // Global settings
 #define DEBUG
@@ -31,9 +42,7 @@
 #define FAR_VALUE 100.0f
 #define BACKGROUND_COLOR 0.2f, 0.2f, 0.2f, 1.0f
 
-// Terrain settings
-#define TERRAIN_SIZE 8.0f
-#define TERRAIN_FRAMES 360
+// Terrain settings (the scene itself is in animation_scene.hpp)
 #if defined(x64) && !defined(DEBUG)
 #define TERRAIN_RESOLUTION 1000
 #else
@@ -60,38 +69,87 @@
 #define SNOW "snow_large.jpg"
 #endif
 
-// Physics settings
-#define SECONDS_PER_FRAME (1.f / 60.f)
-#define SPHERE_RADIUS 0.04f
-#define X_N_SPHERES 80
-#define Z_N_SPHERES 80
+// Physics settings (the scene itself is in animation_scene.hpp)
 // #define RENDER_PHY_PLANE
-#define SPHERES_DROP_HEIGHT 1.f
-#define SPHERES_APPEARANCE_FRAME 560
-#define SPHERES_RELEASE_FRAME 760
+// Draw all spheres with one instanced draw call instead of one draw
+// call per sphere
+#define RENDER_SPHERES_INSTANCED
 
-// Tilting and Dropping
-#define ENABLE_PLANE_TILT_AND_DROP
 
-// First Round of Tilts
-#define PLANE_TILT_ANGULAR_VELOCITY 0.6f, 0.f, 0.f
-#define PLANE_TILT_START_FRAME 920
-#define PLANE_TILT_INTERVAL 64
-#define PLANE_TILT_END_FRAME (920 + 8 * 64)
-
-// Second Round of Tilts
-#define PLANE_TILT_VERTICALLY_ANGULAR_VELOCITY 0.4f, -0.4f, 0.0f
-#define PLANE_TILT_VERTICALLY_START_FRAME (PLANE_TILT_END_FRAME + 2 * PLANE_TILT_INTERVAL)
-#define PLANE_TILT_VERTICALLY_END_FRAME 9999
+// Whether to render with effects
+// #define ENABLE_EFFECTS
 
-// Drop
-#define PLANE_DROP_START_FRAME PLANE_TILT_VERTICALLY_START_FRAME
-#define PLANE_DROP_INITIAL_VELOCITY 0.f, -0.001f, 0.f
-#define PLANE_DROP_FACTOR 1.05f
+// Whether to apply the CPU effects to the frames of the video
+// (independent of the GPU effects above)
+// #define ENABLE_CPU_EFFECTS
+#define CPU_MOTION_BLUR_SIZE 8
+
+// Simulate the next frame on a thread of its own while the current
+// one is rendered (only while rendering a video without
+// --save-snapshots, the interactive loop needs the simulation between
+// the frames for checkpoints and seeking)
+#define PIPELINED_SIMULATION
+
+// Number of pixel buffer objects for the asynchronous readback of
+// the video frames (0 = synchronous glReadPixels)
+#define READBACK_PBOS 2
+// Format of the frames sent to ffmpeg, ffmpeg_wrapper::output_y4m
+// converts to YUV 4:2:0 in-process and needs less than half the
+// pipe bandwidth of ffmpeg_wrapper::output_rgba, with
+// ffmpeg_wrapper::output_shm the frames go to an external encoder
+// through shared memory and RENDER_FILENAME names the shared memory
+// object (e.g. "/cg_frames", read by shm_frame_consumer), and
+// ffmpeg_wrapper::output_png / output_qoi / output_raw_images write a
+// lossless image sequence named after RENDER_FILENAME
+#define VIDEO_OUTPUT_FORMAT ffmpeg_wrapper::output_y4m
+// Preview videos encoded from the same frames (scaled on the CPU, so
+// the scene is rendered only once) and a contact sheet of every
+// THUMBNAIL_INTERVAL-th frame
+// #define RENDER_PREVIEWS
+#define PREVIEW_720P_FILENAME "vorschau_720p.mp4"
+#define PREVIEW_360P_FILENAME "vorschau_360p.mp4"
+#define THUMBNAIL_FILENAME "vorschau_thumbnails.png"
+#define THUMBNAIL_WIDTH 192
+#define THUMBNAIL_HEIGHT 108
+#define THUMBNAIL_INTERVAL 120
+#define THUMBNAIL_COLUMNS 8
+
+// Segment rendering: frames rendered (but not saved) before the start
+// of a segment, so that motion blur has its history
+#define SEGMENT_PREROLL 8
+// File name of the snapshots saved with --save-snapshots
+#define SNAPSHOT_FILENAME "snapshot_%05d.bin"
+
+// Timeline scrubbing: frames between in-memory checkpoints, the
+// memory they may use and the frames skipped per key press
+// (left/right arrow and page down/up, home goes back to frame 0)
+#define CHECKPOINT_INTERVAL 60
+#define CHECKPOINT_MEMORY_BUDGET (256u << 20)
+#define SEEK_FRAMES 60
+#define SEEK_FRAMES_LARGE 600
+
+// Memory accounting: the CPU memory the subsystems may use together
+// before the program aborts with a report (0 = no limit), the report
+// is printed before the first frame and when M is pressed
+#define MEMORY_BUDGET 0
+// Allocation check: after this many rendered frames a frame must not
+// allocate on the heap anymore, the first allocation aborts so that
+// it can be found in a debugger (0 = no check)
+#if defined(DEBUG)
+#define ALLOCATION_CHECK_WARMUP 120
+#else
+#define ALLOCATION_CHECK_WARMUP 0
+#endif
 
+// Profiling (cmake -DENABLE_PROFILER=ON): the Chrome trace written
+// next to the video and the per-frame timings printed at the end
+#define PROFILE_TRACE_FILENAME "profile_trace.json"
 
-// Whether to render with effects
-// #define ENABLE_EFFECTS
+// Collision counters (cmake -DENABLE_PHYSICS_COUNTERS=ON, the
+// default): reflections, detachments, triangle lookups etc. of every
+// frame, written as CSV next to the video if a file name is defined,
+// printed every 60 frames in DEBUG and recorded by the profiler
+// #define PHYSICS_COUNTERS_FILENAME "physics_counters.csv"
 
 // Miscellaneous
 #ifndef M_PI
@@ -99,12 +157,75 @@
 #endif
 
 glm::mat4 proj_matrix;
+// Frames to seek, requested by the key callback
+int seek_request = 0;
 
 void
 resizeCallback(GLFWwindow* window, int width, int height);
 
+void
+keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+
+// Insert the frame range of a segment before the file extension,
+// e.g. "vorschau_00480_00960.mp4"
+std::string
+segment_filename(std::string filename, int start, int end);
+
+// Print the command line options
+void
+print_usage(const char* name);
+
 int
-main(int, char* argv[]) {
+main(int argc, char* argv[]) {
+	// Command line options
+	int snapshot_interval = 0;
+	int segment_start = 0;
+	int segment_end = 0;
+	std::string snapshot_file;
+	for (int i = 1; i < argc; i++) {
+		std::string option = argv[i];
+		if (option == "--save-snapshots" && i + 1 < argc) {
+			snapshot_interval = atoi(argv[++i]);
+		} else if (option == "--segment" && i + 2 < argc) {
+			segment_start = atoi(argv[++i]);
+			segment_end = atoi(argv[++i]);
+			if (i + 1 < argc && argv[i + 1][0] != '-') {
+				snapshot_file = argv[++i];
+			}
+		} else if (option == "--concat" && i + 2 < argc) {
+			std::vector<std::string> segments(argv + i + 2, argv + argc);
+			return ffmpeg_wrapper::concat_segments(segments, argv[i + 1]) ? 0 : 1;
+		} else {
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (segment_end > 0 && segment_end <= segment_start) {
+		std::cerr << "The segment must contain at least one frame\n";
+		return 1;
+	}
+
+	// A segment continues from a snapshot, which also decides the seed
+	simulation_snapshot snapshot;
+	bool snapshot_loaded = false;
+	if (!snapshot_file.empty()) {
+		if (!load_snapshot(snapshot_file, snapshot)) {
+			return 1;
+		}
+		if (snapshot.frame > segment_start) {
+			std::cerr << "The snapshot of frame " << snapshot.frame
+					  << " is after the start of the segment\n";
+			return 1;
+		}
+		if (snapshot.frame > segment_start - SEGMENT_PREROLL) {
+			std::cerr << "The snapshot leaves less than " << SEGMENT_PREROLL
+					  << " frames of pre-roll, motion blur may differ\n";
+		}
+		snapshot_loaded = true;
+	}
+
+	PROFILE_THREAD_NAME("main");
+
 	// Create a window
 #ifdef DO_FULLSCREEN
 	GLFWwindow* window = initOpenGL(0, 0, argv[0]);
@@ -112,6 +233,7 @@ main(int, char* argv[]) {
 	GLFWwindow * window = initOpenGL(WINDOW_WIDTH, WINDOW_HEIGHT, argv[0]);
 #endif // DO_FULLSCREEN
 	glfwSetFramebufferSizeCallback(window, resizeCallback);
+	glfwSetKeyCallback(window, keyCallback);
 
 	// Instantiate camera and modify it
 	camera cam(window);
@@ -135,77 +257,139 @@ main(int, char* argv[]) {
 	float light_phi = LIGHT_PHI;
 	float light_theta = LIGHT_THETA;
 
-	// Prepare terrain
-	terrain terr = terrain(TERRAIN_SIZE,
-						   TERRAIN_RESOLUTION,
-						   0,
-						   TERRAIN_FRAMES,
-						   STONE,
-						   GRASS,
-						   SNOW);
-
-	///////////////////////// Physics /////////////////////////
-	phy::initShader();
-
-	glm::vec3 ang_vel(PLANE_TILT_ANGULAR_VELOCITY);
-	glm::vec3 vertical_velocity(PLANE_DROP_INITIAL_VELOCITY);
-
-	// Prepare physics plane
-	phy::phyPlane phyplane(-TERRAIN_SIZE / 2.f,
-						   TERRAIN_SIZE / 2.f,
-						   -TERRAIN_SIZE / 2.f,
-						   TERRAIN_SIZE / 2.f,
-						   terr.heights,
-						   TERRAIN_RESOLUTION,
-						   TERRAIN_RESOLUTION,
-						   false,
-						   nullptr,
-						   nullptr,
-						   glm::vec4(0.9f, 0.9f, 0.9f, 1.f));
-
-	glm::mat4 plane_model_mat(1.f);
-	float plane_angle = 0.f;
-
-	// Set model matrices
-	phyplane.set_model_mat(glm::rotate(plane_model_mat, plane_angle, glm::vec3(1.f, 0.f, 0.f)));
-	terr.set_model_mat(phyplane.get_model_mat());
-
-
-	// Prepare spheres
-	phy::phySphere * spheres[X_N_SPHERES * Z_N_SPHERES];
-
-	float dx = (phyplane.xEnd - phyplane.xStart) / X_N_SPHERES;
-	float dz = (phyplane.zEnd - phyplane.zStart) / Z_N_SPHERES;
-
-	for (int x = 0; x < X_N_SPHERES; x++ ) {
-		for (int z = 0; z < Z_N_SPHERES; z++ ) {
-			//float col = (float)x * (float)z / X_N_SPHERES / X_N_SPHERES;
-			printf("%f\n", phy::gauss_rand(0, 200));
-			spheres[x * Z_N_SPHERES + z]
-				= new phy::phySphere(glm::vec4(phyplane.xStart + x * dx,
-											   SPHERES_DROP_HEIGHT,
-											   phyplane.zStart + z * dz,
-											   1.f),
-									 glm::vec4(0.f, 0.f, 0.f, 0.f),
-									 SPHERE_RADIUS,
-									 &phyplane,
-									 glm::vec4(sin(x * M_PI / X_N_SPHERES), cos(z * M_PI / X_N_SPHERES) / 2.f + 0.5f, exp(x * z / X_N_SPHERES / Z_N_SPHERES) / 2.718282f, 1.f),
-									 SPHERES_APPEARANCE_FRAME + phy::gauss_rand(0, 60));
-		}
+	// Build the scene
+	memory_set_budget(MEMORY_BUDGET);
+	simulation_settings settings = animation_settings(TERRAIN_RESOLUTION, STONE, GRASS, SNOW);
+	if (snapshot_loaded) {
+		settings.seed = snapshot.seed;
 	}
 
+	// Decode the textures, import the sphere and read the shaders on
+	// worker threads while the terrain heights are generated, the
+	// uploads happen here once the assets are needed
+	asset_loader assets;
+	assets.request_texture(DATA_ROOT + settings.stone);
+	assets.request_texture(DATA_ROOT + settings.grass);
+	assets.request_texture(DATA_ROOT + settings.snow);
+	assets.request_mesh("sphere.obj", false);
+	assets.request_shader("terrain_shader.vert");
+	assets.request_shader("terrain_shader.frag");
+	assets.request_shader("physics.vert");
+	assets.request_shader("physics.frag");
+	assets.request_shader("physics_instanced.vert");
+	simulation sim(settings, &assets);
+	phy::initShader(&assets);
+	if (snapshot_loaded && !sim.restore(snapshot, cam)) {
+		glfwTerminate();
+		return 1;
+	}
+	terrain & terr = sim.get_terrain();
+#ifdef RENDER_PHY_PLANE
+	phy::phyPlane & phyplane = sim.get_plane();
+#endif // RENDER_PHY_PLANE
+
+	// In-memory checkpoints for seeking
+	checkpoint_store checkpoints(CHECKPOINT_INTERVAL, CHECKPOINT_MEMORY_BUDGET);
+
+	// Frustum culling of the spheres
+	sphere_culler culler(X_N_SPHERES * Z_N_SPHERES);
+
 	// "ffmpeg" command and preparation
 #ifdef RENDER_VIDEO
-	ffmpeg_wrapper fw(RENDER_WIDTH, RENDER_HEIGHT, RENDER_FRAMES, RENDER_FILENAME);
+	// A segment gets its own file, is_finished() is true after
+	// frames + 1 saved frames
+	std::string render_filename = RENDER_FILENAME;
+	int render_frames = RENDER_FRAMES;
+	if (segment_end > 0) {
+		render_filename = segment_filename(render_filename, segment_start, segment_end);
+		render_frames = segment_end - segment_start - 1;
+	}
+	ffmpeg_wrapper fw(RENDER_WIDTH, RENDER_HEIGHT, render_frames, &render_filename[0], 4, VIDEO_OUTPUT_FORMAT);
+#ifdef RENDER_PREVIEWS
+	std::string preview_720p_filename = PREVIEW_720P_FILENAME;
+	std::string preview_360p_filename = PREVIEW_360P_FILENAME;
+	std::string thumbnail_filename = THUMBNAIL_FILENAME;
+	if (segment_end > 0) {
+		preview_720p_filename = segment_filename(preview_720p_filename, segment_start, segment_end);
+		preview_360p_filename = segment_filename(preview_360p_filename, segment_start, segment_end);
+		thumbnail_filename = segment_filename(thumbnail_filename, segment_start, segment_end);
+	}
+	fw.add_output(1280, 720, &preview_720p_filename[0], ffmpeg_wrapper::output_y4m, scale_bilinear);
+	fw.add_output(640, 360, &preview_360p_filename[0], ffmpeg_wrapper::output_y4m, scale_bilinear);
+	fw.add_thumbnail_strip(THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, THUMBNAIL_INTERVAL, THUMBNAIL_COLUMNS,
+		&thumbnail_filename[0]);
+#endif // RENDER_PREVIEWS
+#ifdef ENABLE_CPU_EFFECTS
+	// Same order as the GPU effects: depth of field, then motion blur
+	CpuDepthBlur cpu_depth_blur(RENDER_WIDTH, RENDER_HEIGHT, NEAR_VALUE, FAR_VALUE, 0.01, 0.2);
+	CpuMotionBlur cpu_motion_blur(RENDER_WIDTH, RENDER_HEIGHT, CPU_MOTION_BLUR_SIZE);
+	fw.add_effect(&cpu_depth_blur);
+	fw.add_effect(&cpu_motion_blur);
+#endif // ENABLE_CPU_EFFECTS
+	// After adding the effects, so that depth PBOs are created if needed
+	fw.set_readback_pbos(READBACK_PBOS);
 #endif // RENDER_VIDEO
 
-	int frame = 0;
+	memory_report(std::cout);
+	int rendered_frames = 0;
+
+	// Hands the simulated frames to the rendering, serial until started
+	simulation_pipeline pipeline(sim);
+
+#ifdef PHYSICS_COUNTERS_FILENAME
+	std::ofstream counter_log(FFMPEG_ROOT + PHYSICS_COUNTERS_FILENAME);
+	phy::writeCounterHeader(counter_log);
+#endif // PHYSICS_COUNTERS_FILENAME
+
 	// rendering loop
 	while (glfwWindowShouldClose(window) == false)
 		{
+			// Save the state before this frame
+			if (snapshot_interval > 0 && pipeline.get_frame() % snapshot_interval == 0) {
+				char snapshot_name[64];
+				snprintf(snapshot_name, sizeof(snapshot_name), SNAPSHOT_FILENAME, sim.get_frame());
+				save_snapshot(FFMPEG_ROOT + snapshot_name, sim.capture(cam));
+			}
+
+			// Frames long before the segment are only simulated
+			if (pipeline.get_frame() < segment_start - SEGMENT_PREROLL) {
+				sim.fast_forward(sim.get_frame() + 1, cam);
+				continue;
+			}
+
+#if defined(PIPELINED_SIMULATION) && defined(RENDER_VIDEO) && !defined(RENDER_PHY_PLANE)
+			// From here on the simulation is only used by the pipeline
+			if (snapshot_interval == 0) {
+				pipeline.start();
+			}
+#endif // PIPELINED_SIMULATION
+
 			// Poll and set background color
 			glfwPollEvents();
 			glClearColor(BACKGROUND_COLOR);
+
+			// Seek: restore the nearest checkpoint and simulate the rest
+			// (checkpoints are only needed when seeking is possible)
+#ifndef RENDER_VIDEO
+			checkpoints.record(sim, cam);
+#endif // RENDER_VIDEO
+			if (seek_request != 0) {
+#ifdef RENDER_VIDEO
+				std::cerr << "Seeking is disabled while rendering a video\n";
+#else
+				int target = std::max(0, sim.get_frame() + seek_request);
+				auto seek_start = std::chrono::steady_clock::now();
+				int simulated = checkpoints.seek(sim, cam, target);
+				double seek_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - seek_start).count();
+				std::cout << "seek:: frame " << sim.get_frame() << ", " << simulated << " frames simulated in "
+						  << seek_ms << " ms (" << checkpoints.get_count() << " checkpoints every "
+						  << checkpoints.get_interval() << " frames, " << (checkpoints.get_memory() >> 20) << " MB)\n";
+#endif // RENDER_VIDEO
+				seek_request = 0;
+			}
+
+			// From here on the frame only uses preallocated memory
+			memory_forbid_allocations(ALLOCATION_CHECK_WARMUP > 0 && rendered_frames >= ALLOCATION_CHECK_WARMUP);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 			// Light direction
@@ -213,37 +397,21 @@ main(int, char* argv[]) {
 								std::cos(light_theta),
 								std::sin(light_phi) * std::sin(light_theta));
 
-			if (frame == PLANE_TILT_VERTICALLY_START_FRAME) {
-				ang_vel = glm::vec3(PLANE_TILT_VERTICALLY_ANGULAR_VELOCITY);
-				phyplane.set_angular_velocity(&ang_vel);
-			} else if (frame == PLANE_TILT_VERTICALLY_END_FRAME) {
-				phyplane.set_angular_velocity(nullptr);
-			} else if (frame == PLANE_TILT_START_FRAME) {
-				phyplane.set_angular_velocity(&ang_vel);
-			} else if (frame == PLANE_TILT_END_FRAME) {
-				phyplane.set_angular_velocity(nullptr);
-			} else if (frame == PLANE_TILT_START_FRAME + PLANE_TILT_INTERVAL / 2) {
-				ang_vel *= -1;
-				// The the first tilt only take (PLANE_TILT_INTERVAL / 2)
-				// frames make tilting symmetric
-			} else if ((frame - (PLANE_TILT_START_FRAME + PLANE_TILT_INTERVAL / 2))
-					   % PLANE_TILT_INTERVAL == 0
-					   && (frame < PLANE_TILT_END_FRAME)) {
-				// All but the first tilt take PLANE_TILT_INTERVAL frames
-				ang_vel *= -1;
-			}
-
-			// Dropping
-			if (frame == PLANE_DROP_START_FRAME) {
-				phyplane.set_vertical_velocity(&vertical_velocity);
-			} else if (frame > PLANE_DROP_START_FRAME) {
-				vertical_velocity *= PLANE_DROP_FACTOR;
-			}
-
-			// Apply plane transformations
-			phyplane.step(SECONDS_PER_FRAME);
-			// Copy transformations to the terrain
-			terr.set_model_mat(phyplane.get_model_mat());
+			// Advance the timeline and the physics (or take the frame
+			// the simulation thread has finished meanwhile)
+			PROFILE_FRAME(pipeline.get_frame());
+			const render_state & state = pipeline.acquire();
+			int frame = state.frame;
+			phy::phySphere * const * spheres = state.sphere_pointers.data();
+			terr.set_model_mat(state.plane_model_mat);
+
+			// Collision events of this frame
+			const phy::phyCounters & counters = state.counters;
+			PROFILE_COUNTER("reflections", counters.values[phy::counter_reflections]);
+			PROFILE_COUNTER("triangle lookups", counters.values[phy::counter_triangle_lookups]);
+#ifdef PHYSICS_COUNTERS_FILENAME
+			phy::writeCounterLine(counter_log, frame, counters);
+#endif // PHYSICS_COUNTERS_FILENAME
 
 			// Render terrain
 #ifdef RENDER_PHY_PLANE
@@ -253,20 +421,51 @@ main(int, char* argv[]) {
 			terr.render(&cam, proj_matrix, light_dir);
 #endif // RENDER_PHY_PLANE
 
-			phy::useShader(&cam, proj_matrix, light_dir);
-			// Render spheres
-			if (frame >= SPHERES_RELEASE_FRAME) {
-				for (int i = 0; i < X_N_SPHERES * Z_N_SPHERES; i++) {
-					spheres[i]->step(0.015);
+			// Cull the visible spheres against the view frustum
+			culler.clear();
+			for (int i = 0; i < X_N_SPHERES * Z_N_SPHERES; i++) {
+				if (frame > spheres[i]->visibility_frame) {
+					culler.add(glm::vec3(spheres[i]->x + spheres[i]->offset_vec),
+							   spheres[i]->radius, i);
 				}
 			}
+			culler.cull(frustum(proj_matrix * cam.view_matrix()));
+
 			// render all spheres
-			phy::useShader(&cam, proj_matrix, light_dir);
-			for (int i = 0; i < X_N_SPHERES * Z_N_SPHERES; i++) {
-				if (frame > spheres[i]->visibility_frame) {
-					spheres[i]->render();
+			{
+				PROFILE_SCOPE("spheres render");
+#ifdef RENDER_SPHERES_INSTANCED
+				phy::renderSpheres(&cam, proj_matrix, light_dir, spheres,
+								   culler.get_visible(),
+								   culler.get_visible_count());
+#else
+				phy::useShader(&cam, proj_matrix, light_dir);
+				for (int i = 0; i < culler.get_visible_count(); i++) {
+					spheres[culler.get_visible()[i]]->render();
+				}
+#endif // RENDER_SPHERES_INSTANCED
+			}
+			PROFILE_COUNTER("visible spheres", culler.get_visible_count());
+			PROFILE_COUNTER("visible terrain chunks", terr.get_visible_chunks());
+
+#ifdef DEBUG
+			// Report the draw calls issued for the physics objects and
+			// the culling results
+			if (frame % 60 == 0) {
+				std::cout << "phy:: draw calls in frame " << frame << ": "
+						  << phy::getDrawCalls() << "\n";
+				std::cout << "culling:: spheres visible: " << culler.get_visible_count()
+						  << ", culled: " << culler.get_culled_count()
+						  << "; terrain chunks visible: " << terr.get_visible_chunks()
+						  << ", culled: " << terr.get_culled_chunks() << "\n";
+				std::cout << "phy:: in frame " << frame << ":";
+				for (int i = 0; i < phy::counter_count; i++) {
+					std::cout << " " << phy::getCounterName((phy::phyCounter)i) << " " << counters.values[i];
 				}
+				std::cout << "\n";
 			}
+			phy::resetDrawCalls();
+#endif // DEBUG
 
 #ifdef ENABLE_EFFECTS
 			depth_blur.render();
@@ -278,11 +477,22 @@ main(int, char* argv[]) {
 
 			// Before swapping, read the pixels and feed them to "ffmpeg"
 #ifdef RENDER_VIDEO
-			fw.save_frame();
+			if (frame >= segment_start) {
+				fw.save_frame();
+			} else {
+				// Pre-roll, only feeds the history of the CPU effects
+				fw.preroll_frame();
+			}
 #endif // RENDER_VIDEO
 
 			// render UI
-			glfwSwapBuffers(window);
+			{
+				PROFILE_SCOPE("swap buffers");
+				glfwSwapBuffers(window);
+			}
+			pipeline.release();
+			memory_forbid_allocations(false);
+			rendered_frames++;
 
 			// Check for stop
 #ifdef RENDER_VIDEO
@@ -291,12 +501,71 @@ main(int, char* argv[]) {
 					break;
 				}
 #endif // RENDER_VIDEO
-			frame++;
 		}
+	pipeline.stop();
+
+#ifdef RENDER_VIDEO
+	// Submit the frames still in flight while the context is alive
+	fw.finish();
+#endif // RENDER_VIDEO
+
+	PROFILE_REPORT(std::cout);
+	PROFILE_WRITE_TRACE(FFMPEG_ROOT + PROFILE_TRACE_FILENAME);
 
 	glfwTerminate();
 }
 
+// Insert the frame range of a segment before the file extension
+std::string segment_filename(std::string filename, int start, int end)
+{
+	char range[32];
+	snprintf(range, sizeof(range), "_%05d_%05d", start, end);
+	size_t dot = filename.find_last_of('.');
+	return dot == std::string::npos ? filename + range : filename.insert(dot, range);
+}
+
+// Print the command line options
+void print_usage(const char* name)
+{
+	std::cerr << "usage: " << name << " [--save-snapshots INTERVAL]\n"
+			  << "       " << name << " --segment START END [SNAPSHOT]\n"
+			  << "       " << name << " --concat OUTPUT SEGMENT...\n"
+			  << "  --save-snapshots  save the simulation state every INTERVAL frames\n"
+			  << "                    as " << SNAPSHOT_FILENAME << "\n"
+			  << "  --segment         render frames [START, END) into their own file,\n"
+			  << "                    starting from SNAPSHOT (frame <= START) if given\n"
+			  << "  --concat          join segment files without re-encoding\n";
+}
+
+void keyCallback(GLFWwindow*, int key, int, int action, int)
+{
+	if (action != GLFW_PRESS && action != GLFW_REPEAT)
+	{
+		return;
+	}
+	switch (key)
+	{
+	case GLFW_KEY_RIGHT:
+		seek_request += SEEK_FRAMES;
+		break;
+	case GLFW_KEY_LEFT:
+		seek_request -= SEEK_FRAMES;
+		break;
+	case GLFW_KEY_PAGE_UP:
+		seek_request += SEEK_FRAMES_LARGE;
+		break;
+	case GLFW_KEY_PAGE_DOWN:
+		seek_request -= SEEK_FRAMES_LARGE;
+		break;
+	case GLFW_KEY_HOME:
+		seek_request = INT_MIN / 2;
+		break;
+	case GLFW_KEY_M:
+		memory_report(std::cout);
+		break;
+	}
+}
+
 void resizeCallback(GLFWwindow*, int width, int height)
 {
 	// set new width and height as viewport size